@@ -2,10 +2,23 @@
 
 layout (location = 0) in vec3 a_Position;
 
+// Per particle
+layout (location = 1) in vec4 a_Center; // Position, and size in w
+layout (location = 2) in vec4 a_Color;
+layout (location = 3) in float a_Rotation;
+
 uniform mat4 u_ViewProj;
-uniform mat4 u_Transform;
+
+out vec4 v_Color;
 
 void main()
 {
-	gl_Position = u_ViewProj * u_Transform * vec4(a_Position, 1.0);
+	// Scale, rotate about z, then translate to the particle
+	vec3 p = a_Position * a_Center.w;
+	float c = cos(a_Rotation);
+	float s = sin(a_Rotation);
+	p.xy = vec2(c * p.x - s * p.y, s * p.x + c * p.y);
+
+	gl_Position = u_ViewProj * vec4(a_Center.xyz + p, 1.0);
+	v_Color = a_Color;
 }
@@ -0,0 +1,11 @@
+////////////////////////////////////////////////////////////////////////////////
+// Full-screen triangle for the deferred lighting and composite passes. Needs
+// no vertex data: the three corners come from gl_VertexID.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+void main() {
+  vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
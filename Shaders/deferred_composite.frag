@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+// Final pass of the deferred renderer: adds emission to the accumulated light,
+// applies fog and writes the G-buffer depth so that later forward passes
+// (sky, particles) are depth tested against the scene.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+out vec4 fcolor;
+
+struct Scene {
+  bool fog;
+  bool dissection;
+};
+
+uniform sampler2D gEmission;
+uniform sampler2D gDepth;
+uniform sampler2D lightBuffer;
+
+uniform mat4 inverse_proj_matrix;
+uniform Scene scene;
+
+void main() {
+
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+
+  // Background keeps the clear color of the target
+  if (depth == 1.0) {
+    discard;
+  }
+  gl_FragDepth = depth;
+
+  vec4 emission = texelFetch(gEmission, pixel, 0);
+  vec3 result = texelFetch(lightBuffer, pixel, 0).rgb + emission.rgb;
+
+  if (scene.fog && emission.a > 0.5) {
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 p = inverse_proj_matrix * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    float d = length(p.xyz / p.w);
+    float fs = 0.0f;
+    float fe = 100.0f;
+
+    float f = (fe - d) / (fe - fs);
+    vec4 cf = vec4(.1f, 0.0f, .2f, 1.0f);
+    f = 1.0 - clamp(f, 0.0, 1.0);
+
+    fcolor = mix(vec4(result, 1.0), cf, f);
+
+  } else {
+    fcolor = vec4(result, 1.0);
+  }
+}
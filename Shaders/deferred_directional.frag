@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////
+// Adds one directional light to the light buffer, for every covered pixel.
+// Shading matches CalcDirLight in experimental.frag.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+out vec4 fcolor;
+
+struct DirectionalLight {
+  vec3 position;
+  vec4 diffuseIntensity;
+  vec4 specularIntensity;
+  vec4 color;
+};
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+uniform mat4 inverse_proj_matrix;
+uniform vec4 ambientIntensity;
+uniform DirectionalLight light;
+
+void main() {
+
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+  if (depth == 1.0) {
+    discard;
+  }
+
+  // view space position from the depth buffer
+  vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+  vec4 p = inverse_proj_matrix * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+  vec3 P = p.xyz / p.w;
+  vec3 V = -normalize(P);
+
+  vec4 normalShininess = texelFetch(gNormal, pixel, 0);
+  vec3 normal = normalShininess.xyz;
+  vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+  vec3 specularColor = texelFetch(gSpecular, pixel, 0).rgb;
+
+  vec3 lightDir = normalize(light.position - P);
+
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(V, reflectDir), 0.0), normalShininess.w);
+
+  vec3 ambient = vec3(ambientIntensity) * albedo * vec3(light.color);
+  vec3 diffuse = vec3(light.diffuseIntensity) * diff * albedo * vec3(light.color);
+  vec3 specular = vec3(light.specularIntensity) * spec * specularColor
+    * vec3(light.color);
+
+  fcolor = vec4(pow(ambient + diffuse + specular, vec3(2.2)), 0.0);
+}
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+// Adds one point or spot light to the light buffer, only for the pixels its
+// volume covers. Shading matches CalcPointLight and CalcSpotLight in
+// experimental.frag, except that every light has its own attenuation.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+flat in vec4 L_positionRadius;
+flat in vec4 L_color;
+flat in vec4 L_diffuse;
+flat in vec4 L_specular;
+flat in vec4 L_attenuation;
+flat in vec4 L_direction;
+flat in float L_outer;
+
+out vec4 fcolor;
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+uniform mat4 inverse_proj_matrix;
+uniform vec4 ambientIntensity;
+uniform bool spot;
+
+void main() {
+
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+
+  // view space position from the depth buffer
+  vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+  vec4 p = inverse_proj_matrix * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+  vec3 P = p.xyz / p.w;
+
+  // Surfaces in front of the volume also pass the depth test
+  float distance = length(L_positionRadius.xyz - P);
+  if (depth == 1.0 || distance > L_positionRadius.w) {
+    discard;
+  }
+
+  vec3 V = -normalize(P);
+
+  vec4 normalShininess = texelFetch(gNormal, pixel, 0);
+  vec3 normal = normalShininess.xyz;
+  vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+  vec3 specularColor = texelFetch(gSpecular, pixel, 0).rgb;
+
+  vec3 lightDir = normalize(L_positionRadius.xyz - P);
+
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(V, reflectDir), 0.0), normalShininess.w);
+
+  // attenuation
+  float attenuation = 1.0 / (L_attenuation.x + (L_attenuation.y * distance) +
+    (L_attenuation.z * distance * distance));
+
+  float exponent = 1.2;
+  if (spot) {
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-L_direction.xyz));
+    float epsilon = L_direction.w - L_outer;
+    attenuation *= clamp((theta - L_outer) / epsilon, 0.0, 1.0);
+    exponent = 0.8;
+  }
+
+  vec3 ambient = vec3(ambientIntensity) * albedo * vec3(L_color);
+  vec3 diffuse = vec3(L_diffuse) * diff * albedo * vec3(L_color);
+  vec3 specular = vec3(L_specular) * spec * specularColor * vec3(L_color);
+
+  vec3 result = (ambient + diffuse + specular) * attenuation;
+
+  fcolor = vec4(pow(result, vec3(exponent)), 0.0);
+}
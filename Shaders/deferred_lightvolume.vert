@@ -0,0 +1,39 @@
+////////////////////////////////////////////////////////////////////////////////
+// Light volume of the deferred renderer: a sphere mesh scaled to the range of
+// one point or spot light, one instance per light.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+layout (location = 0) in vec3 vpos;                // Unit sphere vertex
+layout (location = 1) in vec4 positionRadius;      // View space center, range
+layout (location = 2) in vec4 lightColor;
+layout (location = 3) in vec4 lightDiffuse;
+layout (location = 4) in vec4 lightSpecular;
+layout (location = 5) in vec4 lightAttenuation;    // Constant, linear, quadratic
+layout (location = 6) in vec4 lightDirection;      // View space direction, cos inner
+layout (location = 7) in vec4 lightOuter;          // cos outer
+
+flat out vec4 L_positionRadius;
+flat out vec4 L_color;
+flat out vec4 L_diffuse;
+flat out vec4 L_specular;
+flat out vec4 L_attenuation;
+flat out vec4 L_direction;
+flat out float L_outer;
+
+uniform mat4 proj_matrix;
+
+void main() {
+
+  L_positionRadius = positionRadius;
+  L_color = lightColor;
+  L_diffuse = lightDiffuse;
+  L_specular = lightSpecular;
+  L_attenuation = lightAttenuation;
+  L_direction = lightDirection;
+  L_outer = lightOuter.x;
+
+  vec3 p = positionRadius.xyz + vpos * positionRadius.w;
+  gl_Position = proj_matrix * vec4(p, 1.0);
+}
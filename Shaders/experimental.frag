@@ -10,6 +10,7 @@ in vec3 N;
 in vec3 V;
 in vec3 P;
 in vec2 tc; // interpolated incoming texture coordinate
+in vec4 C;  // object color of this instance
 
 out vec4 fcolor; // Output fragment color
 
@@ -85,21 +86,31 @@ uniform DirectionalLight dirLights[size];
 uniform PointLight pointLights[size];
 uniform SpotLight spotLights[size];
 
-uniform vec4 obj_color;
-uniform vec4 lightSource_color;
 uniform vec4 ambientIntensity;
 uniform vec3 cameraPosition;
 
+// Clustered shading: point and spot lights come from the fragment's cluster
+// instead of the arrays above, seven texels per light, see LightVolume
+uniform bool clustered;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;    // offset and count per cluster
+uniform usamplerBuffer clusterIndices; // light indices of all clusters
+uniform ivec3 clusterCount;            // tiles across, tiles down, slices
+uniform vec2 clusterScale;             // tiles per pixel
+uniform float clusterNear;
+uniform float clusterSliceScale;       // slices / log(far / near)
+
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir);
 vec3 CalcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir, vec2 tc);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 tc);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec2 tc);
+vec3 CalcClusterLight(int index, vec3 normal, vec2 tc);
 
 void main() {
 
   if (object.isLocalLightSource) {
 
-    fcolor = lightSource_color;
+    fcolor = C;
 
   } else {
 
@@ -152,6 +163,22 @@ void main() {
       result += CalcDirLight(dirLights[i], norm, V, textCoord);
     }
 
+    if (clustered) {
+
+      // phase 2 and 3: the point and spot lights reaching this cluster
+      ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterScale),
+        int(log(max(-P.z, clusterNear) / clusterNear) * clusterSliceScale));
+      cell = clamp(cell, ivec3(0), clusterCount - 1);
+      int cluster = (cell.z * clusterCount.y + cell.y) * clusterCount.x + cell.x;
+
+      uvec2 list = texelFetch(clusterGrid, cluster).rg;
+      for (int i = 0; i < int(list.y); i++) {
+        int index = int(texelFetch(clusterIndices, int(list.x) + i).r);
+        result += CalcClusterLight(index, norm, textCoord);
+      }
+
+    } else {
+
     // phase 2: point lights
     for(int i = 0; i < pointCount; i++) {
         result += CalcPointLight(pointLights[i], norm, P, V, textCoord);
@@ -162,6 +189,8 @@ void main() {
       result += CalcSpotLight(spotLights[i], norm, P, V, textCoord);
     }
 
+    }
+
     vec3 emission = vec3(0.0f);
     if (material.hasEmission) {
       emission = vec3(texture(material.emission, textCoord));
@@ -374,3 +403,72 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec
 
     return pow(result, vec3(0.8));
 }
+
+// calculates the color of a point or spot light of the cluster light buffer;
+// like CalcPointLight and CalcSpotLight, but with the light's own attenuation
+// and nothing beyond its range
+vec3 CalcClusterLight(int index, vec3 normal, vec2 tc)
+{
+    int base = index * 7;
+    vec4 positionRadius = texelFetch(clusterLights, base);
+    vec4 color = texelFetch(clusterLights, base + 1);
+    vec4 diffuseIntensity = texelFetch(clusterLights, base + 2);
+    vec4 specularIntensity = texelFetch(clusterLights, base + 3);
+    vec4 attenuationFactors = texelFetch(clusterLights, base + 4);
+
+    float distance = length(positionRadius.xyz - P);
+    if (distance > positionRadius.w) {
+      return vec3(0.0f);
+    }
+
+    vec3 lightDir = normalize(positionRadius.xyz - P);
+
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(V, reflectDir), 0.0), material.shininess);
+
+    // attenuation
+    float attenuation = 1.0 / (attenuationFactors.x + (attenuationFactors.y * distance) +
+      (attenuationFactors.z * distance * distance));
+
+    float exponent = 1.2;
+    if (attenuationFactors.w > 0.5) {
+      // spotlight intensity
+      vec4 direction = texelFetch(clusterLights, base + 5);
+      float outer = texelFetch(clusterLights, base + 6).x;
+      float theta = dot(lightDir, normalize(-direction.xyz));
+      float epsilon = direction.w - outer;
+      attenuation *= clamp((theta - outer) / epsilon, 0.0, 1.0);
+      exponent = 0.8;
+    }
+
+    // combine results
+    vec3 ambient;
+    vec3 diffuse;
+
+    if (material.hasDiffuse) {
+      ambient = vec3(ambientIntensity) * vec3(texture(material.diffuse, tc))
+      * vec3(color);
+      diffuse = vec3(diffuseIntensity) * diff * vec3(texture(material.diffuse, tc))
+      * vec3(color);
+    } else {
+      ambient = vec3(ambientIntensity) * vec3(color);
+      diffuse = vec3(diffuseIntensity) * diff * vec3(color);
+    }
+
+    vec3 specular;
+    if (material.hasSpecular) {
+      specular = vec3(specularIntensity) * spec * vec3(texture(material.specular, tc))
+      * vec3(color);
+    } else {
+      specular = vec3(specularIntensity) * spec
+      * vec3(color);
+    }
+
+    vec3 result = (ambient + diffuse + specular) * attenuation;
+
+    return pow(result, vec3(exponent));
+}
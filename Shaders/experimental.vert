@@ -9,6 +9,8 @@
 layout (location = 0)   in vec3   vpos; // Input vertex position from data
 layout (location = 1)   in vec3   vnor; // Input vertex normal from data
 layout (location = 2)   in vec2   vtext;
+layout (location = 3)   in mat4   imodel; // Per-instance model matrix (3-6)
+layout (location = 7)   in vec4   icolor; // Per-instance object color
 
 //                      in vec4   vcolor; // Input vertex color from data
 
@@ -18,6 +20,7 @@ out vec4 fog_position;
 
 out vec3 n;
 out vec3 v;
+out vec4 color;
 
 struct GlobalAmbient {
   vec4 ambientIntensity;
@@ -69,18 +72,21 @@ struct Scene {
 };
 
 uniform Material material;
-uniform mat4 mv_matrix;
+uniform mat4 view_matrix;
 uniform mat4 proj_matrix;
-uniform mat4 norm_matrix;
-uniform vec4 obj_color;
 
 void main() {
 
+  mat4 mv_matrix = view_matrix * imodel;
+  // inverse-transpose of the MV matrix, for transforming normal vectors
+  mat3 norm_matrix = transpose(inverse(mat3(mv_matrix)));
+
   p = vec3(mv_matrix * vec4(vpos, 1.0));
   // direction to camera is equivalent to the negative of view space vertex position
   v = -normalize(p.xyz);
   n = normalize(mat3(norm_matrix) * vnor);
   texture = vtext;
+  color = icolor;
 
   fog_position = mv_matrix * vec4(vpos, 1.0);
   gl_Position = proj_matrix * mv_matrix * vec4(vpos, 1.0);
@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+// Geometry pass of the deferred renderer: writes the surface attributes that
+// the lighting passes need instead of lighting the fragment. Takes the same
+// inputs as experimental.frag.
+////////////////////////////////////////////////////////////////////////////////
+
+#version 330
+
+in vec4 fog_Position;
+in vec3 N;
+in vec3 V;
+in vec3 P;
+in vec2 tc; // interpolated incoming texture coordinate
+in vec4 C;  // object color of this instance
+
+layout (location = 0) out vec4 gNormal;   // view space normal, shininess
+layout (location = 1) out vec4 gAlbedo;   // diffuse color
+layout (location = 2) out vec4 gSpecular; // specular color
+layout (location = 3) out vec4 gEmission; // emitted color, 1 if fog applies
+
+struct Material {
+  vec4 ambient;
+  sampler2D diffuse;
+  sampler2D specular;
+  sampler2D emission;
+  sampler2D bump;
+  sampler2D depth;
+  sampler2D displacement;
+  float shininess;
+  bool hasDiffuse;
+  bool hasSpecular;
+  bool hasEmission;
+  bool hasBump;
+  bool hasDepth;
+  bool hasDisplacement;
+};
+
+struct Object {
+  bool isLocalLightSource;
+};
+
+uniform Object object;
+uniform Material material;
+
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir);
+
+void main() {
+
+  if (object.isLocalLightSource) {
+
+    // Unlit: no light reaches it, it only shows its own color
+    gNormal = vec4(normalize(N), material.shininess);
+    gAlbedo = vec4(0.0);
+    gSpecular = vec4(0.0);
+    gEmission = vec4(C.rgb, 0.0);
+
+  } else {
+
+  // compute derivations of the world position
+  vec3 p_dx = dFdx(P);
+  vec3 p_dy = dFdy(P);
+  // compute derivations of the texture coordinate
+  vec2 tc_dx = dFdx(tc);
+  vec2 tc_dy = dFdy(tc);
+  // compute initial tangent and bi-tangent
+  vec3 t = normalize( tc_dy.y * p_dx - tc_dx.y * p_dy );
+  vec3 b = normalize( tc_dy.x * p_dx - tc_dx.x * p_dy ); // sign inversion
+  // get new tangent from a given mesh normal
+  vec3 n = N;
+  vec3 x = cross(n, t);
+  t = cross(x, n);
+  t = normalize(t);
+  // get updated bi-tangent
+  x = cross(b, n);
+  b = cross(n, x);
+  b = normalize(b);
+  mat3 TBN = mat3(t, b, n);
+
+
+  vec2 textCoord;
+  if (material.hasDepth) {
+
+    vec3 viewDir = normalize(V * transpose(TBN));
+    textCoord = ParallaxMapping(tc, viewDir);
+
+  } else {
+    textCoord = tc;
+  }
+
+    vec3 norm;
+    if (material.hasBump) {
+
+    norm = vec3(texture(material.bump, textCoord).rgb);
+    norm = normalize(norm * 2.0 - 1.0);
+    norm = normalize(TBN * norm);
+
+    } else {
+      norm = normalize(N);
+    }
+
+    vec3 albedo = vec3(1.0f);
+    if (material.hasDiffuse) {
+      albedo = vec3(texture(material.diffuse, textCoord));
+    }
+
+    vec3 specular = vec3(1.0f);
+    if (material.hasSpecular) {
+      specular = vec3(texture(material.specular, textCoord));
+    }
+
+    vec3 emission = vec3(0.0f);
+    if (material.hasEmission) {
+      emission = vec3(texture(material.emission, textCoord));
+    }
+
+    gNormal = vec4(norm, material.shininess);
+    gAlbedo = vec4(albedo, 1.0);
+    gSpecular = vec4(specular, 1.0);
+    gEmission = vec4(emission, 1.0);
+  }
+}
+
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+{
+    // number of depth layers
+    const float minLayers = 8;
+    const float maxLayers = 32;
+    float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+    // calculate the size of each layer
+    float layerDepth = 1.0 / numLayers;
+    // depth of current layer
+    float currentLayerDepth = 0.0;
+    // the amount to shift the texture coordinates per layer (from vector P)
+    vec2 p = (viewDir.xy / viewDir.z) * .1f;
+    vec2 deltaTexCoords = p / numLayers;
+
+    // get initial values
+    vec2  currentTexCoords     = texCoords;
+    float currentDepthMapValue = texture(material.depth, currentTexCoords).r;
+
+    while(currentLayerDepth < currentDepthMapValue)
+    {
+        // shift texture coordinates along direction of P
+        currentTexCoords -= deltaTexCoords;
+        // get depthmap value at current texture coordinates
+        currentDepthMapValue = texture(material.depth, currentTexCoords).r;
+        // get depth of next layer
+        currentLayerDepth += layerDepth;
+    }
+
+    // get texture coordinates before collision (reverse operations)
+    vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
+
+    // get depth after and before collision for linear interpolation
+    float afterDepth  = currentDepthMapValue - currentLayerDepth;
+    float beforeDepth = texture(material.depth, prevTexCoords).r - currentLayerDepth + layerDepth;
+
+    // interpolation of texture coordinates
+    float weight = afterDepth / (afterDepth - beforeDepth);
+    vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
+
+    return finalTexCoords;
+}
@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Allocator for SIMD-aligned containers
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __ALIGNED_H__
+#define __ALIGNED_H__
+
+// STL
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Standard allocator whose blocks start on an Alignment boundary
+///
+/// Lets std::vector hold data that SIMD kernels load with aligned loads.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, size_t Alignment>
+class AlignedAllocator {
+
+  public:
+
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+      typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t _count) {
+      void* block = nullptr;
+      if (posix_memalign(&block, Alignment, _count * sizeof(T)) != 0) {
+        throw std::bad_alloc();
+      }
+      return static_cast<T*>(block);
+    }
+
+    void deallocate(T* _block, size_t) { free(_block); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+/// Float stream aligned for AVX loads
+typedef std::vector<float, AlignedAllocator<float, 32>> AlignedFloats;
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef __ASSETLOADER_CPP__
+#define __ASSETLOADER_CPP__
+
+#include "assetloader.h"
+#include "object.h"
+
+// STL
+#include <chrono>
+
+AssetLoader::AssetLoader(ThreadPool& _pool, MeshCache& _meshes,
+                         TextureManager& _textures,
+                         const std::string& _directory, bool _upload) :
+  m_pool(_pool), m_meshes(_meshes), m_textures(_textures),
+  m_directory(_directory), m_upload(_upload) {}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start loading what an object needs to be drawn
+/// @param _object Object to receive the mesh and texture ids
+/// @param _meshFile OBJ filename inside the asset directory
+/// @param _withMaterial Copy the mesh's material to the object and load the
+///        textures it names
+/// @param _textures Further images to load, with the id each is stored to
+///
+/// The object's asset is set immediately, but is only safe to draw once the
+/// object comes back from pump().
+void AssetLoader::request(const std::shared_ptr<Object>& _object,
+                          const std::string& _meshFile, bool _withMaterial,
+                          const std::vector<std::pair<std::string, GLuint*>>&
+                            _textures) {
+
+  std::shared_ptr<MeshAsset> asset = m_meshes.find(_meshFile);
+
+  if (!asset) {
+    asset = m_meshes.add(_meshFile);
+    m_inFlight++;
+    m_pool.submit([this, asset, _withMaterial]() {
+      asset->load(m_directory, _withMaterial);
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_parsedMeshes.push_back(asset);
+    });
+  }
+
+  _object->asset = asset;
+
+  if (!m_upload) {
+    m_waiting.push_back({_object, _withMaterial, !_withMaterial, {}});
+    return;
+  }
+
+  for (const auto& texture : _textures) {
+    requestTexture(texture.first);
+  }
+
+  m_waiting.push_back({_object, _withMaterial, !_withMaterial, _textures});
+}
+
+void AssetLoader::requestTexture(const std::string& _path) {
+
+  if (m_images.count(_path)) {
+    return;
+  }
+  m_images[_path] = nullptr;
+
+  m_inFlight++;
+  m_pool.submit([this, _path]() {
+    std::shared_ptr<DecodedImage> image(new DecodedImage());
+    TextureManager::decode(_path, *image);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decodedImages.push_back(image);
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Upload finished work and collect objects that became drawable
+/// @param _budget Seconds to spend on uploads; at least one upload is made
+///        per call whatever the budget, so loading always progresses
+/// @param _ready Receives the objects whose assets are all uploaded
+/// @return Whether any object became ready
+bool AssetLoader::pump(double _budget,
+                       std::vector<std::shared_ptr<Object>>& _ready) {
+
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  auto elapsed = [&start]() {
+    return duration_cast<duration<double>>(steady_clock::now() - start).count();
+  };
+
+  bool uploaded;
+  do {
+
+    std::shared_ptr<MeshAsset> asset;
+    std::shared_ptr<DecodedImage> image;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_parsedMeshes.empty()) {
+        asset = m_parsedMeshes.front();
+        m_parsedMeshes.pop_front();
+      }
+      if (!m_decodedImages.empty()) {
+        image = m_decodedImages.front();
+        m_decodedImages.pop_front();
+      }
+    }
+
+    uploaded = asset || image;
+
+    if (asset) {
+      if (m_upload) {
+        asset->upload();
+      } else {
+        m_parsed.insert(asset.get());
+      }
+      m_inFlight--;
+    }
+
+    // The loader holds the first reference, so the texture outlives loading
+    // even if no object has claimed it yet
+    if (image) {
+      m_references.push_back(m_textures.acquire(*image));
+      image->pixels.clear();
+      image->pixels.shrink_to_fit();
+      m_images[image->path] = image;
+      m_inFlight--;
+    }
+  } while (uploaded && elapsed() < _budget);
+
+  size_t before = _ready.size();
+
+  for (size_t i = 0; i < m_waiting.size();) {
+    if (resolve(m_waiting[i])) {
+      _ready.push_back(m_waiting[i].object);
+      m_waiting[i] = std::move(m_waiting.back());
+      m_waiting.pop_back();
+    } else {
+      ++i;
+    }
+  }
+
+  if (idle()) {
+    for (GLuint id : m_references) {
+      m_textures.release(id);
+    }
+    m_references.clear();
+    m_images.clear();
+  }
+
+  return _ready.size() != before;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Advance a waiting object as far as the uploaded assets allow
+/// @return Whether the object is ready to draw
+bool AssetLoader::resolve(Pending& _pending) {
+
+  const std::shared_ptr<Object>& object = _pending.object;
+  std::shared_ptr<MeshAsset> asset = object->asset;
+
+  if (m_upload ? !asset->uploaded() : !m_parsed.count(asset.get())) {
+    return false;
+  }
+
+  if (!_pending.materialResolved) {
+
+    // The first request for this mesh did not want its material
+    if (!asset->hasMaterial) {
+      setupMaterialProperties(m_directory + asset->data.mtlFile, asset->material);
+      asset->hasMaterial = true;
+    }
+    object->material = asset->material;
+
+    const Material& m = object->material;
+    std::vector<std::pair<std::string, GLuint*>> maps;
+    if (m.hasDiffuseTexture) {
+      maps.push_back({m.diffuseTexture, &object->diffuseTextureID});
+    }
+    if (m.hasSpecularTexture) {
+      maps.push_back({m.specularTexture, &object->specularTextureID});
+    }
+    if (m.hasEmissionTexture) {
+      maps.push_back({m.emissionTexture, &object->emissionTextureID});
+    }
+    if (m.hasBumpTexture) {
+      maps.push_back({m.bumpTexture, &object->bumpTextureID});
+    }
+    if (m.hasDepthTexture) {
+      maps.push_back({m.depthTexture, &object->depthTextureID});
+    }
+    if (m.hasDisplacementTexture) {
+      maps.push_back({m.displacementTexture, &object->displacementTextureID});
+    }
+
+    // Without upload, renderers read the material's image files themselves
+    if (m_upload) {
+      for (const auto& map : maps) {
+        requestTexture(map.first);
+        _pending.textures.push_back(map);
+      }
+    }
+    _pending.materialResolved = true;
+  }
+
+  for (const auto& texture : _pending.textures) {
+    if (!m_images[texture.first]) {
+      return false;
+    }
+  }
+
+  // Each object holds its own reference, as with synchronous loading
+  for (const auto& texture : _pending.textures) {
+    *texture.second = m_textures.acquire(*m_images[texture.first]);
+  }
+  object->verticesCount = asset->data.vertexCount();
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Background loading of scene meshes, materials and textures
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __ASSETLOADER_H__
+#define __ASSETLOADER_H__
+
+// STL
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "meshcache.h"
+#include "texturemanager.h"
+#include "threadpool.h"
+
+class Object;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Resolves the assets of scene objects on a worker pool
+///
+/// OBJ parsing, mtl parsing and image decoding run on the pool. Everything
+/// that touches GL (buffer, VAO and texture creation) is deferred to pump(),
+/// which the thread owning the context calls once per frame with a time
+/// budget, so loading never stalls a frame for long. An object is handed back
+/// by pump() once its mesh and every texture it uses are on the GPU.
+///
+/// A loader that does not upload only parses meshes and materials and loads
+/// no textures, for renderers without a GL context.
+////////////////////////////////////////////////////////////////////////////////
+class AssetLoader {
+
+  public:
+
+    AssetLoader(ThreadPool& _pool, MeshCache& _meshes,
+                TextureManager& _textures, const std::string& _directory,
+                bool _upload = true);
+
+    void request(const std::shared_ptr<Object>& _object,
+                 const std::string& _meshFile, bool _withMaterial,
+                 const std::vector<std::pair<std::string, GLuint*>>&
+                   _textures = {});
+
+    bool pump(double _budget, std::vector<std::shared_ptr<Object>>& _ready);
+
+    bool idle() const { return m_waiting.empty() && m_inFlight == 0; }
+    size_t waiting() const { return m_waiting.size(); }
+
+  private:
+
+    /// Object waiting for its assets
+    struct Pending {
+      std::shared_ptr<Object> object;
+      bool withMaterial;
+      bool materialResolved;
+      std::vector<std::pair<std::string, GLuint*>> textures; ///< Path, slot
+    };
+
+    void requestTexture(const std::string& _path);
+    bool resolve(Pending& _pending);
+
+    ThreadPool& m_pool;
+    MeshCache& m_meshes;
+    TextureManager& m_textures;
+    std::string m_directory;
+    bool m_upload;                    ///< Whether assets go to GL
+    std::set<const MeshAsset*> m_parsed; ///< Meshes ready without upload
+
+    std::vector<Pending> m_waiting;
+    size_t m_inFlight{0}; ///< Tasks submitted but not yet consumed by pump
+
+    /// Requested images by path; null until decoded and uploaded. Uploaded
+    /// images keep their keys but not their pixels.
+    std::map<std::string, std::shared_ptr<DecodedImage>> m_images;
+    std::vector<GLuint> m_references; ///< Held until loading goes idle
+
+    // Results handed from the workers to pump()
+    std::mutex m_mutex;
+    std::deque<std::shared_ptr<MeshAsset>> m_parsedMeshes;
+    std::deque<std::shared_ptr<DecodedImage>> m_decodedImages;
+};
+
+#endif
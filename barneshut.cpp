@@ -0,0 +1,296 @@
+#ifndef __BARNESHUT_CPP__
+#define __BARNESHUT_CPP__
+
+#include "barneshut.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+
+#include "particlesystem.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+namespace {
+
+const int BITS = 21;                  ///< Bits of a Morton code per axis
+const uint32_t CELLS = 1u << (3 * BarnesHut::TOP); ///< Cells of the top level
+const size_t CHUNK = 4096;            ///< Particles coded or walked by a task
+
+/// @brief Spread the low 21 bits of a coordinate out to every third bit
+uint64_t spread(uint32_t _v) {
+  uint64_t x = _v & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffull;
+  x = (x | x << 16) & 0x1f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+/// @brief Octant of a code at a level below the root
+uint32_t digit(uint64_t _code, int _level) {
+  return uint32_t(_code >> (3 * (BITS - _level))) & 7;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Add the node of some sorted bodies, and below it their subtree
+/// @param _begin First body
+/// @param _end   One past the last
+/// @param _level Depth of the node, the root's being 0
+/// @param _nodes Subtree to append to
+void BarnesHut::grow(uint32_t _begin, uint32_t _end, int _level,
+                     std::vector<Node>& _nodes) const {
+
+  const uint32_t index = uint32_t(_nodes.size());
+  _nodes.emplace_back();
+
+  Node node;
+  node.size = std::ldexp(m_size, -_level);
+  node.mass = 0.0f;
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+
+  if (_end - _begin <= LEAF || _level == BITS) {
+    node.first = _begin;
+    node.count = _end - _begin;
+    for (uint32_t b = _begin; b < _end; ++b) {
+      const Body& body = m_bodies[b];
+      node.mass += body.mass;
+      x += body.mass * body.x;
+      y += body.mass * body.y;
+      z += body.mass * body.z;
+    }
+  } else {
+    node.first = 0;
+    node.count = 0;
+    for (uint32_t c = 0, begin = _begin; c < 8 && begin < _end; ++c) {
+      // Codes below a node share their leading digits, so each child's bodies
+      // are the run with its digit
+      uint32_t end = uint32_t(std::partition_point(
+        m_bodies.begin() + begin, m_bodies.begin() + _end,
+        [&](const Body& _body) {
+          return digit(_body.code, _level + 1) <= c;
+        }) - m_bodies.begin());
+      if (end == begin) {
+        continue;
+      }
+
+      const uint32_t child = uint32_t(_nodes.size());
+      grow(begin, end, _level + 1, _nodes);
+      const Node& grown = _nodes[child];
+      node.mass += grown.mass;
+      x += grown.mass * grown.x;
+      y += grown.mass * grown.y;
+      z += grown.mass * grown.z;
+      begin = end;
+    }
+  }
+
+  if (node.mass > 0.0f) {
+    node.x = x / node.mass;
+    node.y = y / node.mass;
+    node.z = z / node.mass;
+  } else {
+    node.x = m_bodies[_begin].x;
+    node.y = m_bodies[_begin].y;
+    node.z = m_bodies[_begin].z;
+  }
+  node.next = uint32_t(_nodes.size());
+  _nodes[index] = node;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Add a node above the parallel subtrees, or splice one of them in
+/// @param _cell  Index of the node's cell among those of its level
+/// @param _level Depth of the node, at most TOP
+/// @return Index of the node in the tree
+uint32_t BarnesHut::emit(uint32_t _cell, int _level) {
+
+  const uint32_t index = uint32_t(m_nodes.size());
+
+  if (_level == TOP) {
+    for (Node node : m_subtrees[_cell]) {
+      node.next += index;
+      m_nodes.push_back(node);
+    }
+    return index;
+  }
+
+  m_nodes.emplace_back();
+
+  Node node;
+  node.size = std::ldexp(m_size, -_level);
+  node.mass = 0.0f;
+  node.first = 0;
+  node.count = 0;
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+  bool any = false;
+
+  // Top cells under each child
+  const int below = 3 * (TOP - _level - 1);
+  for (uint32_t c = 0; c < 8; ++c) {
+    uint32_t child = _cell * 8 + c;
+    if (m_start[(child + 1) << below] == m_start[child << below]) {
+      continue;
+    }
+
+    const Node& emitted = m_nodes[emit(child, _level + 1)];
+    node.mass += emitted.mass;
+    x += emitted.mass * emitted.x;
+    y += emitted.mass * emitted.y;
+    z += emitted.mass * emitted.z;
+    if (!any) {
+      node.x = emitted.x;
+      node.y = emitted.y;
+      node.z = emitted.z;
+      any = true;
+    }
+  }
+
+  if (node.mass > 0.0f) {
+    node.x = x / node.mass;
+    node.y = y / node.mass;
+    node.z = z / node.mass;
+  }
+  node.next = uint32_t(m_nodes.size());
+  m_nodes[index] = node;
+  return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Change the particles' velocities by their pull on each other
+/// @param _pool      Workers
+/// @param _particles Pool to update
+/// @param _strength  Gravitational constant; negative to push apart
+/// @param _theta     Opening angle: 0 sums every pair, larger is coarser
+/// @param _softening Distance added in quadrature, so that close particles
+///                   do not fling each other away
+/// @param _deltaTime Tick length in seconds
+void BarnesHut::accelerate(ThreadPool& _pool, ParticlePool& _particles,
+                           float _strength, float _theta, float _softening,
+                           float _deltaTime) {
+
+  const size_t count = _particles.Count();
+  m_nodes.clear();
+  if (count == 0 || _strength == 0.0f) {
+    return;
+  }
+
+  PROFILE_SCOPE("Barnes-Hut");
+
+  // Cube around the particles
+  glm::vec3 low = _particles.Position(0);
+  glm::vec3 high = low;
+  for (size_t i = 1; i < count; ++i) {
+    low = glm::min(low, _particles.Position(i));
+    high = glm::max(high, _particles.Position(i));
+  }
+  glm::vec3 extent = high - low;
+  m_size = std::max(std::max(extent.x, extent.y), extent.z) * 1.0001f + 1e-6f;
+
+  const float scale = float(1u << BITS) / m_size;
+  const uint32_t last = (1u << BITS) - 1;
+  m_unsorted.resize(count);
+  _pool.parallelFor(count, CHUNK, [&](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      Body& body = m_unsorted[i];
+      body.x = _particles.PositionX[i];
+      body.y = _particles.PositionY[i];
+      body.z = _particles.PositionZ[i];
+      body.mass = std::fabs(_particles.SizeBegin[i]);
+      body.particle = uint32_t(i);
+      body.code =
+        spread(std::min(uint32_t((body.x - low.x) * scale), last)) << 2 |
+        spread(std::min(uint32_t((body.y - low.y) * scale), last)) << 1 |
+        spread(std::min(uint32_t((body.z - low.z) * scale), last));
+    }
+  });
+
+  // Counting sort into the top cells
+  const int shift = 3 * (BITS - TOP);
+  m_start.assign(CELLS + 1, 0);
+  for (const Body& body : m_unsorted) {
+    m_start[(body.code >> shift) + 1]++;
+  }
+  for (uint32_t c = 1; c <= CELLS; ++c) {
+    m_start[c] += m_start[c - 1];
+  }
+  m_bodies.resize(count);
+  std::vector<uint32_t> cursor(m_start.begin(), m_start.end() - 1);
+  for (const Body& body : m_unsorted) {
+    m_bodies[cursor[body.code >> shift]++] = body;
+  }
+
+  // Each top cell is sorted and grown on its own
+  m_subtrees.resize(CELLS);
+  _pool.parallelFor(CELLS, 1, [this](size_t _begin, size_t _end) {
+    for (size_t c = _begin; c < _end; ++c) {
+      std::vector<Node>& nodes = m_subtrees[c];
+      nodes.clear();
+      if (m_start[c] == m_start[c + 1]) {
+        continue;
+      }
+      std::sort(m_bodies.begin() + m_start[c], m_bodies.begin() + m_start[c + 1],
+        [](const Body& _a, const Body& _b) { return _a.code < _b.code; });
+      grow(m_start[c], m_start[c + 1], TOP, nodes);
+    }
+  });
+
+  emit(0, 0);
+
+  // Walk the tree for each particle
+  const float theta2 = _theta * _theta;
+  const float softening2 = _softening * _softening;
+  const float k = _strength * _deltaTime;
+  const uint32_t end = uint32_t(m_nodes.size());
+
+  _pool.parallelFor(count, CHUNK, [&](size_t _begin, size_t _end) {
+    for (size_t b = _begin; b < _end; ++b) {
+      const Body& body = m_bodies[b];
+      float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+      for (uint32_t n = 0; n < end; ) {
+        const Node& node = m_nodes[n];
+        float dx = node.x - body.x;
+        float dy = node.y - body.y;
+        float dz = node.z - body.z;
+        float r2 = dx * dx + dy * dy + dz * dz;
+
+        if (node.size * node.size < theta2 * r2) {
+          float inv = 1.0f / std::sqrt(r2 + softening2);
+          float f = node.mass * inv * inv * inv;
+          ax += f * dx;
+          ay += f * dy;
+          az += f * dz;
+          n = node.next;
+        } else if (node.count > 0) {
+          for (uint32_t o = node.first; o < node.first + node.count; ++o) {
+            const Body& other = m_bodies[o];
+            dx = other.x - body.x;
+            dy = other.y - body.y;
+            dz = other.z - body.z;
+            r2 = dx * dx + dy * dy + dz * dz + softening2;
+            if (r2 > 0.0f) {
+              float inv = 1.0f / std::sqrt(r2);
+              float f = other.mass * inv * inv * inv;
+              ax += f * dx;
+              ay += f * dy;
+              az += f * dz;
+            }
+          }
+          n = node.next;
+        } else {
+          ++n;
+        }
+      }
+
+      _particles.VelocityX[body.particle] += k * ax;
+      _particles.VelocityY[body.particle] += k * ay;
+      _particles.VelocityZ[body.particle] += k * az;
+    }
+  });
+}
+
+#endif
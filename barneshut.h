@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Barnes-Hut octree for gravitation between the particles of a system
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __BARNESHUT_H__
+#define __BARNESHUT_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+struct ParticlePool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pulls every particle of a pool towards all the others, or pushes it
+///        away, in O(N log N)
+///
+/// Each tick the live particles are given Morton codes in the cube around
+/// them and an octree is grown over the codes, down to LEAF particles. Every
+/// node keeps the mass and center of mass of its particles, a particle's mass
+/// being its size. A particle then walks the tree and takes a node's pull as a
+/// whole when the node's edge is under the opening angle times its distance,
+/// and otherwise opens it; in leaves it opened, the particles pull one by one.
+///
+/// The particles are counting sorted into the 8^TOP cells of the TOP'th level
+/// first. Those cells are sorted and grown into subtrees on the thread pool,
+/// and the few nodes above them are added once they are done. Nodes are laid
+/// out depth first, each knowing where its subtree ends, so the walk needs no
+/// stack; walking particles in Morton order keeps neighbouring tasks on the
+/// same nodes.
+////////////////////////////////////////////////////////////////////////////////
+class BarnesHut {
+
+  public:
+
+    static const size_t LEAF = 8; ///< Most particles in a leaf above the
+                                  ///< deepest level
+    static const int TOP = 2;     ///< Levels above the subtrees grown in
+                                  ///< parallel
+
+    void accelerate(ThreadPool& _pool, ParticlePool& _particles,
+                    float _strength, float _theta, float _softening,
+                    float _deltaTime);
+
+    size_t nodes() const { return m_nodes.size(); }
+
+  private:
+
+    /// A live particle, in Morton order once sorted
+    struct Body {
+      float x, y, z;
+      float mass;
+      uint64_t code;
+      uint32_t particle;
+    };
+
+    /// Leaves have count bodies from first; inner nodes have count 0 and
+    /// their children right after them. Either way, the node's subtree ends
+    /// at next.
+    struct Node {
+      float x, y, z;         ///< Center of mass
+      float mass;
+      float size;            ///< Edge of the node's cube
+      uint32_t first, count;
+      uint32_t next;
+    };
+
+    void grow(uint32_t _begin, uint32_t _end, int _level,
+              std::vector<Node>& _nodes) const;
+    uint32_t emit(uint32_t _cell, int _level);
+
+    float m_size{1.0f};                     ///< Edge of the root's cube
+
+    std::vector<Body> m_unsorted;           ///< Scratch space of the sort
+    std::vector<Body> m_bodies;             ///< Sorted by code
+    std::vector<uint32_t> m_start;          ///< First body of each top cell,
+                                            ///< and end
+    std::vector<std::vector<Node>> m_subtrees; ///< Grown under each top cell
+    std::vector<Node> m_nodes;              ///< The whole tree, depth first
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef __BENCHMARK_CPP__
+#define __BENCHMARK_CPP__
+
+#include "benchmark.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+////////////////////////////////////////////////////////////////////////////////
+// CameraPath
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Read keyframes from a path file
+/// @param _filename Path file
+/// @return False if the file could not be read or holds no keyframes
+bool CameraPath::load(const std::string& _filename) {
+
+  std::ifstream ifs(_filename);
+  if (!ifs) {
+    std::cout << "Camera path: cannot open " << _filename << std::endl;
+    return false;
+  }
+
+  m_keys.clear();
+
+  std::string line;
+  while (getline(ifs, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream iss(line);
+    Key key;
+    if (iss >> key.time >> key.position.x >> key.position.y >> key.position.z
+            >> key.horizontalAngle >> key.verticalAngle) {
+      m_keys.push_back(key);
+    }
+  }
+
+  std::stable_sort(m_keys.begin(), m_keys.end(),
+    [](const Key& _a, const Key& _b) { return _a.time < _b.time; });
+
+  if (m_keys.empty()) {
+    std::cout << "Camera path: no keyframes in " << _filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Default path: one full turn in place from the scene camera
+/// @param _camera Starting camera
+/// @param _duration Seconds for the turn
+void CameraPath::turn(const Camera& _camera, float _duration) {
+  m_keys.clear();
+  m_keys.push_back({0.0f, _camera.position, _camera.horizontalAngle,
+    _camera.verticalAngle});
+  m_keys.push_back({_duration, _camera.position,
+    _camera.horizontalAngle + 2.0f * float(M_PI), _camera.verticalAngle});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Move a camera to where the path is at a given time
+/// @param _time Seconds since the start of the path
+/// @param _camera Camera to move
+void CameraPath::apply(float _time, Camera& _camera) const {
+
+  if (m_keys.empty()) {
+    return;
+  }
+
+  auto next = std::upper_bound(m_keys.begin(), m_keys.end(), _time,
+    [](float _t, const Key& _key) { return _t < _key.time; });
+
+  Key key;
+  if (next == m_keys.begin()) {
+    key = m_keys.front();
+  } else if (next == m_keys.end()) {
+    key = m_keys.back();
+  } else {
+    const Key& a = *(next - 1);
+    const Key& b = *next;
+    float t = (_time - a.time) / std::max(b.time - a.time, 1e-6f);
+    key.position = glm::mix(a.position, b.position, t);
+    key.horizontalAngle = glm::mix(a.horizontalAngle, b.horizontalAngle, t);
+    key.verticalAngle = glm::mix(a.verticalAngle, b.verticalAngle, t);
+  }
+
+  _camera.position = key.position;
+  _camera.horizontalAngle = key.horizontalAngle;
+  _camera.verticalAngle = key.verticalAngle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FrameReadback
+////////////////////////////////////////////////////////////////////////////////
+
+FrameReadback::~FrameReadback() {
+  for (Slot& slot : m_pending) {
+    glDeleteSync(slot.fence);
+  }
+  if (!m_buffers.empty()) {
+    glDeleteBuffers(m_buffers.size(), m_buffers.data());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Allocate the pixel buffers
+/// @param _width Frame width in pixels
+/// @param _height Frame height in pixels
+/// @param _depth Frames that may be in flight before capture() has to wait
+void FrameReadback::initialize(int _width, int _height, size_t _depth) {
+
+  m_width = _width;
+  m_height = _height;
+  m_buffers.resize(std::max<size_t>(_depth, 1));
+  glGenBuffers(m_buffers.size(), m_buffers.data());
+
+  for (GLuint buffer : m_buffers) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size_t(_width) * _height * 4, nullptr,
+      GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start copying the bound read framebuffer into the next buffer
+void FrameReadback::capture() {
+
+  if (m_buffers.empty()) {
+    return;
+  }
+
+  // Every buffer still in flight: the oldest has to be consumed first
+  if (m_pending.size() == m_buffers.size()) {
+    collect(true);
+  }
+
+  GLuint buffer = m_buffers[m_next];
+  m_next = (m_next + 1) % m_buffers.size();
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  m_pending.push_back({buffer, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Copy out the frames whose readback has finished
+/// @param _wait Block until the oldest pending frame is ready, then take it
+///        and any others already finished
+void FrameReadback::collect(bool _wait) {
+
+  while (!m_pending.empty()) {
+
+    Slot& slot = m_pending.front();
+    GLenum status = glClientWaitSync(slot.fence,
+      _wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+      _wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      break;
+    }
+    glDeleteSync(slot.fence);
+
+    size_t size = size_t(m_width) * m_height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+      GL_MAP_READ_BIT);
+    if (data) {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      m_pixels.assign(bytes, bytes + size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      m_framesRead++;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    m_pending.pop_front();
+    _wait = false;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Write the latest frame read as a binary PPM image
+/// @param _filename Output file
+/// @return False if no frame was read yet or the file could not be written
+bool FrameReadback::writePPM(const std::string& _filename) const {
+
+  if (m_pixels.empty()) {
+    return false;
+  }
+
+  std::ofstream ofs(_filename, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+
+  ofs << "P6\n" << m_width << " " << m_height << "\n255\n";
+
+  // GL rows start at the bottom
+  std::vector<char> row(size_t(m_width) * 3);
+  for (int y = m_height - 1; y >= 0; --y) {
+    const unsigned char* src = &m_pixels[size_t(y) * m_width * 4];
+    for (int x = 0; x < m_width; ++x) {
+      row[3*x + 0] = src[4*x + 0];
+      row[3*x + 1] = src[4*x + 1];
+      row[3*x + 2] = src[4*x + 2];
+    }
+    ofs.write(row.data(), row.size());
+  }
+  return bool(ofs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuFrameTimer
+////////////////////////////////////////////////////////////////////////////////
+
+GpuFrameTimer::~GpuFrameTimer() {
+  for (GLuint query : m_pending) {
+    glDeleteQueries(1, &query);
+  }
+  if (!m_free.empty()) {
+    glDeleteQueries(m_free.size(), m_free.data());
+  }
+}
+
+void GpuFrameTimer::begin() {
+  GLuint query;
+  if (m_free.empty()) {
+    glGenQueries(1, &query);
+  } else {
+    query = m_free.back();
+    m_free.pop_back();
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  m_pending.push_back(query);
+}
+
+void GpuFrameTimer::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Append the frame times that are available, in seconds
+/// @param _wait Block until every pending result is available
+/// @param _times Receives the times in frame order
+void GpuFrameTimer::collect(bool _wait, std::vector<double>& _times) {
+
+  while (!m_pending.empty()) {
+
+    GLuint query = m_pending.front();
+
+    if (!_wait) {
+      GLint available = 0;
+      glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        break;
+      }
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    _times.push_back(elapsed * 1e-9);
+
+    m_free.push_back(query);
+    m_pending.pop_front();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FrameStats
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Summarize samples with nearest-rank percentiles
+/// @param _samples Samples in any order
+FrameStats FrameStats::compute(std::vector<double> _samples) {
+
+  FrameStats stats;
+  if (_samples.empty()) {
+    return stats;
+  }
+
+  std::sort(_samples.begin(), _samples.end());
+
+  auto percentile = [&_samples](double _p) {
+    size_t rank = size_t(std::ceil(_p * _samples.size()));
+    return _samples[std::min(std::max<size_t>(rank, 1), _samples.size()) - 1];
+  };
+
+  double sum = 0.0;
+  for (double sample : _samples) {
+    sum += sample;
+  }
+
+  stats.count = _samples.size();
+  stats.mean = sum / _samples.size();
+  stats.min = _samples.front();
+  stats.p50 = percentile(0.50);
+  stats.p90 = percentile(0.90);
+  stats.p99 = percentile(0.99);
+  stats.max = _samples.back();
+  return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Print one line of milliseconds
+/// @param _os Output stream
+/// @param _label Name of what was measured
+void FrameStats::report(std::ostream& _os, const std::string& _label) const {
+  std::ios::fmtflags flags = _os.flags();
+  _os << std::fixed << std::setprecision(3)
+      << _label << " ms over " << count << " frames:"
+      << "  mean " << mean * 1000.0
+      << "  min " << min * 1000.0
+      << "  p50 " << p50 * 1000.0
+      << "  p90 " << p90 * 1000.0
+      << "  p99 " << p99 * 1000.0
+      << "  max " << max * 1000.0 << std::endl;
+  _os.flags(flags);
+}
+
+#endif
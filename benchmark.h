@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Scripted camera paths, frame readback and frame time statistics
+///        for reproducible benchmark runs
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+// STL
+#include <deque>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "camera.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Camera keyframes interpolated over time
+///
+/// A path file holds one keyframe per line,
+///
+///   time x y z horizontalAngle verticalAngle
+///
+/// with times in seconds, increasing, and angles in radians; lines starting
+/// with # are comments. Before the first and after the last key the camera
+/// holds still.
+////////////////////////////////////////////////////////////////////////////////
+class CameraPath {
+
+  public:
+
+    struct Key {
+      float time;
+      glm::vec3 position;
+      float horizontalAngle;
+      float verticalAngle;
+    };
+
+    bool load(const std::string& _filename);
+    void turn(const Camera& _camera, float _duration);
+
+    void apply(float _time, Camera& _camera) const;
+
+    bool empty() const { return m_keys.empty(); }
+
+  private:
+
+    std::vector<Key> m_keys;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Reads rendered frames back without stalling the pipeline
+///
+/// capture() starts a copy of the framebuffer into a pixel buffer object and
+/// returns immediately; collect() maps a buffer only once its fence shows
+/// the copy finished, a few frames later. The latest frame read is kept so
+/// it can be written out for image comparisons.
+////////////////////////////////////////////////////////////////////////////////
+class FrameReadback {
+
+  public:
+
+    FrameReadback() = default;
+    ~FrameReadback();
+
+    FrameReadback(const FrameReadback&) = delete;
+    FrameReadback& operator=(const FrameReadback&) = delete;
+
+    void initialize(int _width, int _height, size_t _depth = 3);
+
+    void capture();
+    void collect(bool _wait);
+
+    size_t framesRead() const { return m_framesRead; }
+    bool writePPM(const std::string& _filename) const;
+
+  private:
+
+    struct Slot {
+      GLuint buffer;
+      GLsync fence;
+    };
+
+    int m_width{0};
+    int m_height{0};
+    std::vector<GLuint> m_buffers;
+    size_t m_next{0};          ///< Buffer the next capture writes
+    std::deque<Slot> m_pending;  ///< Copies in flight, oldest first
+    std::vector<unsigned char> m_pixels;  ///< Latest frame, RGBA, bottom row first
+    size_t m_framesRead{0};
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Measures the GPU time of whole frames with elapsed time queries
+///
+/// Results are read a few frames late, when they are available, so timing
+/// never waits on the GPU.
+////////////////////////////////////////////////////////////////////////////////
+class GpuFrameTimer {
+
+  public:
+
+    GpuFrameTimer() = default;
+    ~GpuFrameTimer();
+
+    GpuFrameTimer(const GpuFrameTimer&) = delete;
+    GpuFrameTimer& operator=(const GpuFrameTimer&) = delete;
+
+    void begin();
+    void end();
+    void collect(bool _wait, std::vector<double>& _times);
+
+  private:
+
+    std::deque<GLuint> m_pending;  ///< Ended, results not yet read
+    std::vector<GLuint> m_free;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Percentile summary of a set of samples
+////////////////////////////////////////////////////////////////////////////////
+struct FrameStats {
+
+  size_t count{0};
+  double mean{0.0};
+  double min{0.0};
+  double p50{0.0};
+  double p90{0.0};
+  double p99{0.0};
+  double max{0.0};
+
+  static FrameStats compute(std::vector<double> _samples);
+
+  void report(std::ostream& _os, const std::string& _label) const;
+};
+
+#endif
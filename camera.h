@@ -33,6 +33,8 @@ public:
   float horizontalAngle = M_PI;
   glm::vec3 dir;
   glm::mat4 projectionMatrix;
+  float nearPlane = 0.1f;    ///< Clip planes of projectionMatrix
+  float farPlane = 1000.0f;
 
   glm::vec3 direction();
   glm::vec3 up();
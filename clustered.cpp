@@ -0,0 +1,296 @@
+#ifndef __CLUSTERED_CPP__
+#define __CLUSTERED_CPP__
+
+#include "clustered.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "frustum.h"
+#include "scene.h"
+#include "threadpool.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CLUSTERS_SSE
+#endif
+
+namespace {
+
+enum Unit : GLint { LIGHTS_UNIT = 6, GRID_UNIT, INDICES_UNIT };
+
+const int CLUSTERS_PER_SLICE =
+  LightClusters::TILES_X * LightClusters::TILES_Y;
+
+/// Replace the contents of a texture buffer's storage, never leaving it empty
+template<typename T>
+void upload(GLuint _buffer, const std::vector<T>& _data) {
+  static const T empty{};
+  glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+  glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(_data.size(), 1) * sizeof(T),
+    nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0,
+    std::max<size_t>(_data.size(), 1) * sizeof(T),
+    _data.empty() ? &empty : _data.data());
+}
+
+}
+
+LightClusters::LightClusters(ThreadPool& _pool) : m_pool(_pool) {
+}
+
+LightClusters::~LightClusters() {
+  glDeleteTextures(3, m_textures);
+  glDeleteBuffers(3, m_buffers);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Assign the cluster samplers of experimental.frag their texture units
+/// @param _program Scene program
+///
+/// Also needed with clustering off: samplers of different types left on the
+/// same unit make every draw fail.
+void LightClusters::setSamplers(GLuint _program) {
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "clusterLights"),
+    LIGHTS_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "clusterGrid"),
+    GRID_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "clusterIndices"),
+    INDICES_UNIT);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Create the texture buffers the shader reads the clusters from
+void LightClusters::initialize() {
+
+  m_minX.resize(COUNT);
+  m_minY.resize(COUNT);
+  m_minZ.resize(COUNT);
+  m_maxX.resize(COUNT);
+  m_maxY.resize(COUNT);
+  m_maxZ.resize(COUNT);
+  m_clusterLights.resize(COUNT);
+  m_grid.resize(2 * COUNT);
+
+  glGenBuffers(3, m_buffers);
+  glGenTextures(3, m_textures);
+
+  const GLenum formats[] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+  for (int i = 0; i < 3; ++i) {
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief View space bounds of every cluster
+/// @param _projection Projection matrix, perspective or orthographic
+///
+/// Each tile's corners are unprojected onto the near and far planes, and the
+/// rays between them cut at the depths where the slices begin and end.
+void LightClusters::computeBounds(const glm::mat4& _projection) {
+
+  glm::mat4 inverse = glm::inverse(_projection);
+  auto unproject = [&inverse](float _x, float _y, float _z) {
+    glm::vec4 p = inverse * glm::vec4(_x, _y, _z, 1.0f);
+    return glm::vec3(p) / p.w;
+  };
+
+  for (int y = 0; y < TILES_Y; ++y) {
+    for (int x = 0; x < TILES_X; ++x) {
+
+      glm::vec3 nearCorners[4], farCorners[4];
+      for (int c = 0; c < 4; ++c) {
+        float ndcX = -1.0f + 2.0f * (x + (c & 1)) / TILES_X;
+        float ndcY = -1.0f + 2.0f * (y + (c >> 1)) / TILES_Y;
+        nearCorners[c] = unproject(ndcX, ndcY, -1.0f);
+        farCorners[c] = unproject(ndcX, ndcY, 1.0f);
+      }
+
+      for (int s = 0; s < SLICES; ++s) {
+        float depths[2] = {
+          m_near * std::pow(m_far / m_near, float(s) / SLICES),
+          m_near * std::pow(m_far / m_near, float(s + 1) / SLICES)};
+
+        glm::vec3 lo(std::numeric_limits<float>::max());
+        glm::vec3 hi(-std::numeric_limits<float>::max());
+        for (int c = 0; c < 4; ++c) {
+          for (float depth : depths) {
+            const glm::vec3& n = nearCorners[c];
+            const glm::vec3& f = farCorners[c];
+            float t = (-depth - n.z) / (f.z - n.z);
+            glm::vec3 p = n + (f - n) * t;
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+          }
+        }
+
+        int cluster = (s * TILES_Y + y) * TILES_X + x;
+        m_minX[cluster] = lo.x;
+        m_minY[cluster] = lo.y;
+        m_minZ[cluster] = lo.z;
+        m_maxX[cluster] = hi.x;
+        m_maxY[cluster] = hi.y;
+        m_maxZ[cluster] = hi.z;
+      }
+    }
+  }
+
+  m_projection = _projection;
+}
+
+/// @brief Slice holding a view depth, clamped to the grid
+int LightClusters::slice(float _depth) const {
+  if (_depth <= m_near) {
+    return 0;
+  }
+  int s = int(std::log(_depth / m_near) * m_sliceScale);
+  return std::min(s, SLICES - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Rebuild the light lists of one slice's clusters
+///
+/// Only touches that slice's lists, so slices can be binned concurrently.
+void LightClusters::binSlice(int _slice) {
+
+  const int first = _slice * CLUSTERS_PER_SLICE;
+  for (int c = first; c < first + CLUSTERS_PER_SLICE; ++c) {
+    m_clusterLights[c].clear();
+  }
+
+  for (size_t i = 0; i < m_lights.size(); ++i) {
+    if (_slice < m_firstSlice[i] || _slice > m_lastSlice[i]) {
+      continue;
+    }
+
+    const glm::vec4& sphere = m_lights[i].positionRadius;
+
+#if defined(CLUSTERS_SSE)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 cx = _mm_set1_ps(sphere.x);
+    const __m128 cy = _mm_set1_ps(sphere.y);
+    const __m128 cz = _mm_set1_ps(sphere.z);
+    const __m128 r2 = _mm_set1_ps(sphere.w * sphere.w);
+
+    // Sphere against four boxes: squared distance to the closest point
+    for (int c = first; c < first + CLUSTERS_PER_SLICE; c += 4) {
+      __m128 dx = _mm_add_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minX[c]), cx), zero),
+        _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&m_maxX[c])), zero));
+      __m128 dy = _mm_add_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minY[c]), cy), zero),
+        _mm_max_ps(_mm_sub_ps(cy, _mm_loadu_ps(&m_maxY[c])), zero));
+      __m128 dz = _mm_add_ps(
+        _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minZ[c]), cz), zero),
+        _mm_max_ps(_mm_sub_ps(cz, _mm_loadu_ps(&m_maxZ[c])), zero));
+      __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                             _mm_mul_ps(dz, dz));
+
+      int hits = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+      for (int lane = 0; hits; ++lane, hits >>= 1) {
+        if (hits & 1) {
+          m_clusterLights[c + lane].push_back(i);
+        }
+      }
+    }
+#else
+    for (int c = first; c < first + CLUSTERS_PER_SLICE; ++c) {
+      float dx = std::max(m_minX[c] - sphere.x, 0.0f) +
+                 std::max(sphere.x - m_maxX[c], 0.0f);
+      float dy = std::max(m_minY[c] - sphere.y, 0.0f) +
+                 std::max(sphere.y - m_maxY[c], 0.0f);
+      float dz = std::max(m_minZ[c] - sphere.z, 0.0f) +
+                 std::max(sphere.z - m_maxZ[c], 0.0f);
+      if (dx * dx + dy * dy + dz * dz <= sphere.w * sphere.w) {
+        m_clusterLights[c].push_back(i);
+      }
+    }
+#endif
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bin the frame's lights and upload the result
+/// @param _scene Lights, camera and view matrix of the frame
+/// @param _frustum View frustum; lights whose range lies outside are skipped
+void LightClusters::update(const Scene& _scene, const Frustum& _frustum) {
+
+  const glm::mat4& view = _scene.viewMatrix;
+  const glm::vec4& ambient = _scene.globalAmbient.ambientIntensity;
+  const Camera& camera = _scene.camera;
+
+  if (camera.nearPlane != m_near || camera.farPlane != m_far ||
+      camera.projectionMatrix != m_projection) {
+    m_near = camera.nearPlane;
+    m_far = camera.farPlane;
+    m_sliceScale = SLICES / std::log(m_far / m_near);
+    computeBounds(camera.projectionMatrix);
+  }
+
+  m_lights.clear();
+  addVisibleLightVolumes(_scene.pointLights, view, ambient, m_far, _frustum,
+                         m_lights);
+  addVisibleLightVolumes(_scene.spotLights, view, ambient, m_far, _frustum,
+                         m_lights);
+
+  m_firstSlice.resize(m_lights.size());
+  m_lastSlice.resize(m_lights.size());
+  for (size_t i = 0; i < m_lights.size(); ++i) {
+    float depth = -m_lights[i].positionRadius.z;
+    float radius = m_lights[i].positionRadius.w;
+    m_firstSlice[i] = slice(depth - radius);
+    m_lastSlice[i] = slice(depth + radius);
+  }
+
+  m_pool.parallelFor(SLICES, 1, [this](size_t _begin, size_t _end) {
+    for (size_t s = _begin; s < _end; ++s) {
+      binSlice(s);
+    }
+  });
+
+  m_indices.clear();
+  for (int c = 0; c < COUNT; ++c) {
+    m_grid[2 * c] = m_indices.size();
+    m_grid[2 * c + 1] = m_clusterLights[c].size();
+    m_indices.insert(m_indices.end(), m_clusterLights[c].begin(),
+      m_clusterLights[c].end());
+  }
+
+  upload(m_buffers[0], m_lights);
+  upload(m_buffers[1], m_grid);
+  upload(m_buffers[2], m_indices);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bind the clusters for a program using experimental.frag
+/// @param _program Scene program
+/// @param _width Viewport width
+/// @param _height Viewport height
+void LightClusters::bind(GLuint _program, int _width, int _height) const {
+
+  for (int i = 0; i < 3; ++i) {
+    glActiveTexture(GL_TEXTURE0 + LIGHTS_UNIT + i);
+    glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "clustered"), 1);
+  glProgramUniform3i(_program, glGetUniformLocation(_program, "clusterCount"),
+    TILES_X, TILES_Y, SLICES);
+  glProgramUniform2f(_program, glGetUniformLocation(_program, "clusterScale"),
+    float(TILES_X) / _width, float(TILES_Y) / _height);
+  glProgramUniform1f(_program, glGetUniformLocation(_program, "clusterNear"),
+    m_near);
+  glProgramUniform1f(_program, glGetUniformLocation(_program, "clusterSliceScale"),
+    m_sliceScale);
+}
+
+#endif
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Clustered forward shading: local lights binned into view clusters
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __CLUSTERED_H__
+#define __CLUSTERED_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "light.h"
+
+class Frustum;
+class Scene;
+class ThreadPool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Point and spot lights sorted into a 3D grid over the view frustum
+///
+/// The grid has TILES_X by TILES_Y screen tiles and SLICES depth slices,
+/// spaced exponentially between the near and far planes. Every frame the
+/// lights in view are tested against the view-space bounds of every cluster
+/// their depth range overlaps, four clusters at a time with SSE, one slice
+/// per pool task. The result is a compact list of light indices per cluster.
+///
+/// Three texture buffers carry it to experimental.frag: the packed lights,
+/// an offset and count per cluster, and the index lists. Each fragment then
+/// only shades the lights of its own cluster, so many small lights cost
+/// little more than a few.
+////////////////////////////////////////////////////////////////////////////////
+class LightClusters {
+
+  public:
+
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+    static const int COUNT = TILES_X * TILES_Y * SLICES;
+
+    explicit LightClusters(ThreadPool& _pool);
+    ~LightClusters();
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    static void setSamplers(GLuint _program);
+
+    void initialize();
+
+    void update(const Scene& _scene, const Frustum& _frustum);
+    void bind(GLuint _program, int _width, int _height) const;
+
+    size_t lights() const { return m_lights.size(); }
+    size_t references() const { return m_indices.size(); }
+
+  private:
+
+    void computeBounds(const glm::mat4& _projection);
+    void binSlice(int _slice);
+    int slice(float _depth) const;
+
+    ThreadPool& m_pool;
+
+    glm::mat4 m_projection{0.0f};  ///< Projection the bounds were built for
+    float m_near{0.0f};
+    float m_far{0.0f};
+    float m_sliceScale{0.0f};      ///< SLICES / log(far / near)
+
+    // View space bounds of each cluster, as structure of arrays
+    std::vector<float> m_minX, m_minY, m_minZ;
+    std::vector<float> m_maxX, m_maxY, m_maxZ;
+
+    std::vector<LightVolume> m_lights;      ///< In view, points then spots
+    std::vector<int> m_firstSlice;          ///< Per light
+    std::vector<int> m_lastSlice;
+
+    std::vector<std::vector<uint32_t>> m_clusterLights; ///< Per cluster
+    std::vector<uint32_t> m_grid;           ///< Offset and count per cluster
+    std::vector<uint32_t> m_indices;        ///< All clusters' lists, in order
+
+    GLuint m_buffers[3]{0, 0, 0};   ///< Lights, grid, indices
+    GLuint m_textures[3]{0, 0, 0};
+};
+
+#endif
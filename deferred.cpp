@@ -0,0 +1,384 @@
+#ifndef __DEFERRED_CPP__
+#define __DEFERRED_CPP__
+
+#include "deferred.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "CompileShaders.h"
+#include "frustum.h"
+#include "scene.h"
+
+namespace {
+
+enum Unit : GLint {
+  NORMAL_UNIT, ALBEDO_UNIT, SPECULAR_UNIT, DEPTH_UNIT, EMISSION_UNIT, LIGHT_UNIT
+};
+
+GLuint makeTexture(GLenum _internalFormat, GLenum _format, GLenum _type,
+                   int _width, int _height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, _internalFormat, _width, _height, 0, _format,
+    _type, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+void setSamplers(GLuint _program) {
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "gNormal"), NORMAL_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "gAlbedo"), ALBEDO_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "gSpecular"), SPECULAR_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "gDepth"), DEPTH_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "gEmission"), EMISSION_UNIT);
+  glProgramUniform1i(_program, glGetUniformLocation(_program, "lightBuffer"), LIGHT_UNIT);
+}
+
+}
+
+DeferredRenderer::~DeferredRenderer() {
+  release();
+  glDeleteProgram(m_directionalProgram);
+  glDeleteProgram(m_volumeProgram);
+  glDeleteProgram(m_compositeProgram);
+  glDeleteVertexArrays(1, &m_emptyVao);
+  glDeleteVertexArrays(1, &m_volumeVao);
+  glDeleteBuffers(1, &m_volumeVbo);
+  glDeleteBuffers(1, &m_volumeEbo);
+  glDeleteBuffers(1, &m_instanceVbo);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Compile the lighting programs and build the light volume mesh
+void DeferredRenderer::initialize() {
+
+  m_directionalProgram = compileProgram("Shaders/deferred.vert",
+    "Shaders/deferred_directional.frag");
+  m_volumeProgram = compileProgram("Shaders/deferred_lightvolume.vert",
+    "Shaders/deferred_lightvolume.frag");
+  m_compositeProgram = compileProgram("Shaders/deferred.vert",
+    "Shaders/deferred_composite.frag");
+
+  setSamplers(m_directionalProgram);
+  setSamplers(m_volumeProgram);
+  setSamplers(m_compositeProgram);
+
+  glGenVertexArrays(1, &m_emptyVao);
+  buildVolumeMesh();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sphere mesh for point and spot lights, with its instance buffer
+///
+/// An octahedron subdivided twice and projected onto the unit sphere, then
+/// scaled so that its flat faces, not only its vertices, enclose the sphere.
+void DeferredRenderer::buildVolumeMesh() {
+
+  std::vector<glm::vec3> vertices = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  std::vector<GLuint> indices = {
+    0, 2, 4,  2, 1, 4,  1, 3, 4,  3, 0, 4,
+    2, 0, 5,  1, 2, 5,  3, 1, 5,  0, 3, 5};
+
+  for (int level = 0; level < 2; ++level) {
+    std::vector<GLuint> subdivided;
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      GLuint a = indices[t], b = indices[t+1], c = indices[t+2];
+      GLuint ab = vertices.size();
+      vertices.push_back(glm::normalize(vertices[a] + vertices[b]));
+      GLuint bc = vertices.size();
+      vertices.push_back(glm::normalize(vertices[b] + vertices[c]));
+      GLuint ca = vertices.size();
+      vertices.push_back(glm::normalize(vertices[c] + vertices[a]));
+      subdivided.insert(subdivided.end(),
+        {a, ab, ca,  ab, b, bc,  ca, bc, c,  ab, bc, ca});
+    }
+    indices.swap(subdivided);
+  }
+
+  float inner = 1.0f;
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    const glm::vec3& a = vertices[indices[t]];
+    glm::vec3 normal = glm::normalize(glm::cross(vertices[indices[t+1]] - a,
+      vertices[indices[t+2]] - a));
+    inner = std::min(inner, std::abs(glm::dot(normal, a)));
+  }
+  for (glm::vec3& v : vertices) {
+    v /= inner;
+  }
+
+  m_volumeIndexCount = indices.size();
+
+  glGenVertexArrays(1, &m_volumeVao);
+  glBindVertexArray(m_volumeVao);
+
+  glGenBuffers(1, &m_volumeVbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_volumeVbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3),
+    vertices.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+
+  glGenBuffers(1, &m_volumeEbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_volumeEbo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+    indices.data(), GL_STATIC_DRAW);
+
+  glGenBuffers(1, &m_instanceVbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_instanceVbo);
+  for (GLuint i = 0; i < 7; ++i) {
+    glEnableVertexAttribArray(1 + i);
+    glVertexAttribPointer(1 + i, 4, GL_FLOAT, GL_FALSE, sizeof(LightVolume),
+      (void*)(i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(1 + i, 1);
+  }
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Create the G-buffer and light buffer at the given size
+void DeferredRenderer::allocate(int _width, int _height) {
+
+  release();
+  m_width = _width;
+  m_height = _height;
+
+  m_normal = makeTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, _width, _height);
+  m_albedo = makeTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, _width, _height);
+  m_specular = makeTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, _width, _height);
+  m_emission = makeTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, _width, _height);
+  m_depth = makeTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT,
+    _width, _height);
+  m_light = makeTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, _width, _height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &m_gbuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_gbuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_normal, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_albedo, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, m_specular, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, m_emission, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+  const GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+    GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+  glDrawBuffers(4, buffers);
+
+  // The volumes are depth tested against a copy, because sampling a texture
+  // attached to the bound framebuffer is undefined
+  glGenRenderbuffers(1, &m_lightDepth);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_lightDepth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _width, _height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &m_lightFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_lightFramebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_light, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+    m_lightDepth);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_target);
+}
+
+void DeferredRenderer::release() {
+  if (!m_gbuffer) {
+    return;
+  }
+  glDeleteFramebuffers(1, &m_gbuffer);
+  glDeleteFramebuffers(1, &m_lightFramebuffer);
+  glDeleteRenderbuffers(1, &m_lightDepth);
+  const GLuint textures[] = {m_normal, m_albedo, m_specular, m_emission,
+    m_depth, m_light};
+  glDeleteTextures(6, textures);
+  m_gbuffer = m_lightFramebuffer = m_lightDepth = 0;
+  m_normal = m_albedo = m_specular = m_emission = m_depth = m_light = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Redirect drawing into the cleared G-buffer
+/// @param _width Viewport width; the buffers are resized to follow it
+/// @param _height Viewport height
+///
+/// The framebuffer bound now is where shade() writes the result.
+void DeferredRenderer::beginGeometry(int _width, int _height) {
+
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_target);
+
+  if (_width != m_width || _height != m_height || !m_gbuffer) {
+    allocate(_width, _height);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_gbuffer);
+
+  const GLfloat zero[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  const GLfloat one = 1.0f;
+  for (GLint i = 0; i < 4; ++i) {
+    glClearBufferfv(GL_COLOR, i, zero);
+  }
+  glClearBufferfv(GL_DEPTH, 0, &one);
+
+  // Attributes must be written as they are, not blended
+  m_blend = glIsEnabled(GL_BLEND);
+  glDisable(GL_BLEND);
+}
+
+void DeferredRenderer::bindGBuffer(GLuint _program) const {
+  glUseProgram(_program);
+  const GLuint textures[] = {m_normal, m_albedo, m_specular, m_depth,
+    m_emission, m_light};
+  for (GLint unit = 0; unit < 6; ++unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, textures[unit]);
+  }
+}
+
+void DeferredRenderer::drawVolumes(const std::vector<LightVolume>& _volumes,
+                                   bool _spot) {
+  if (_volumes.empty()) {
+    return;
+  }
+
+  glProgramUniform1i(m_volumeProgram,
+    glGetUniformLocation(m_volumeProgram, "spot"), _spot);
+
+  glBindBuffer(GL_ARRAY_BUFFER, m_instanceVbo);
+  glBufferData(GL_ARRAY_BUFFER, _volumes.size() * sizeof(LightVolume),
+    _volumes.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glDrawElementsInstanced(GL_TRIANGLES, m_volumeIndexCount, GL_UNSIGNED_INT,
+    nullptr, _volumes.size());
+  m_lightsDrawn += _volumes.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Light the G-buffer and write the result to the target framebuffer
+/// @param _scene Lights, camera and view matrix of the frame
+/// @param _frustum View frustum; lights whose range lies outside are skipped
+/// @param _fog Whether lit surfaces fade into the fog color
+///
+/// Leaves the target bound with depth testing at GL_LEQUAL and the blend
+/// state as it was before beginGeometry().
+void DeferredRenderer::shade(const Scene& _scene, const Frustum& _frustum,
+                             bool _fog) {
+
+  m_lightsDrawn = 0;
+
+  const glm::mat4& view = _scene.viewMatrix;
+  const glm::mat4& projection = _scene.camera.projectionMatrix;
+  glm::mat4 inverseProjection = glm::inverse(projection);
+  const glm::vec4& ambient = _scene.globalAmbient.ambientIntensity;
+
+  // Light buffer starts black, with the scene depth for testing volumes
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_gbuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_lightFramebuffer);
+  glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height,
+    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_lightFramebuffer);
+  const GLfloat zero[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  glClearBufferfv(GL_COLOR, 0, zero);
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glDepthMask(GL_FALSE);
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Directional lights reach every pixel
+  glDisable(GL_DEPTH_TEST);
+  bindGBuffer(m_directionalProgram);
+  glBindVertexArray(m_emptyVao);
+
+  GLuint program = m_directionalProgram;
+  glUniformMatrix4fv(glGetUniformLocation(program, "inverse_proj_matrix"), 1,
+    GL_FALSE, glm::value_ptr(inverseProjection));
+  glUniform4fv(glGetUniformLocation(program, "ambientIntensity"), 1,
+    glm::value_ptr(ambient));
+  GLint position = glGetUniformLocation(program, "light.position");
+  GLint diffuse = glGetUniformLocation(program, "light.diffuseIntensity");
+  GLint specular = glGetUniformLocation(program, "light.specularIntensity");
+  GLint color = glGetUniformLocation(program, "light.color");
+
+  for (const std::shared_ptr<DirectionalLight>& light : _scene.directionalLights) {
+    glUniform3fv(position, 1,
+      glm::value_ptr(glm::vec3(view * glm::vec4(light->position, 1.0))));
+    glUniform4fv(diffuse, 1, glm::value_ptr(light->diffuseIntensity));
+    glUniform4fv(specular, 1, glm::value_ptr(light->specularIntensity));
+    glUniform4fv(color, 1, glm::value_ptr(light->color));
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    m_lightsDrawn++;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Point and spot lights only reach pixels inside their volume
+  const float farPlane = _scene.camera.farPlane;
+  m_points.clear();
+  addVisibleLightVolumes(_scene.pointLights, view, ambient, farPlane, _frustum,
+                         m_points);
+  m_spots.clear();
+  addVisibleLightVolumes(_scene.spotLights, view, ambient, farPlane, _frustum,
+                         m_spots);
+
+  if (!m_points.empty() || !m_spots.empty()) {
+
+    // Back faces behind the surface: each covered pixel is lit once per light,
+    // also with the camera inside a volume; clamping keeps volumes reaching
+    // past the far plane
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GEQUAL);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEnable(GL_DEPTH_CLAMP);
+
+    bindGBuffer(m_volumeProgram);
+    program = m_volumeProgram;
+    glUniformMatrix4fv(glGetUniformLocation(program, "proj_matrix"), 1,
+      GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(glGetUniformLocation(program, "inverse_proj_matrix"), 1,
+      GL_FALSE, glm::value_ptr(inverseProjection));
+    glUniform4fv(glGetUniformLocation(program, "ambientIntensity"), 1,
+      glm::value_ptr(ambient));
+
+    glBindVertexArray(m_volumeVao);
+    drawVolumes(m_points, false);
+    drawVolumes(m_spots, true);
+
+    glDisable(GL_DEPTH_CLAMP);
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Composite into the target, with depth for the passes drawn after
+  glBindFramebuffer(GL_FRAMEBUFFER, m_target);
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_ALWAYS);
+  glDepthMask(GL_TRUE);
+
+  bindGBuffer(m_compositeProgram);
+  program = m_compositeProgram;
+  glUniformMatrix4fv(glGetUniformLocation(program, "inverse_proj_matrix"), 1,
+    GL_FALSE, glm::value_ptr(inverseProjection));
+  glUniform1i(glGetUniformLocation(program, "scene.fog"), _fog);
+
+  glBindVertexArray(m_emptyVao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
+  glDepthFunc(GL_LEQUAL);
+  if (m_blend) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+}
+
+#endif
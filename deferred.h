@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Deferred shading with a G-buffer and light volumes
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __DEFERRED_H__
+#define __DEFERRED_H__
+
+// STL
+#include <cstddef>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "light.h"
+
+class Frustum;
+class Scene;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Renders lighting after the geometry instead of per fragment drawn
+///
+/// The scene is drawn once into a G-buffer holding normal and shininess,
+/// diffuse color, specular color, emission and depth. Each directional light
+/// is then one full-screen pass, and all point lights, then all spot lights,
+/// are one instanced draw of sphere volumes sized to their range, so a light
+/// only shades the pixels it can reach and overdraw is never lit. Results add
+/// up in a floating point light buffer, which the composite pass combines
+/// with emission and fog and writes, with depth, to the target framebuffer.
+///
+/// Shading matches experimental.frag, and there is no limit on the number of
+/// lights.
+////////////////////////////////////////////////////////////////////////////////
+class DeferredRenderer {
+
+  public:
+
+    DeferredRenderer() = default;
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    void initialize();
+
+    void beginGeometry(int _width, int _height);
+    void shade(const Scene& _scene, const Frustum& _frustum, bool _fog);
+
+    size_t lightsDrawn() const { return m_lightsDrawn; }
+
+  private:
+
+    void allocate(int _width, int _height);
+    void release();
+    void buildVolumeMesh();
+    void drawVolumes(const std::vector<LightVolume>& _volumes, bool _spot);
+    void bindGBuffer(GLuint _program) const;
+
+    int m_width{0};
+    int m_height{0};
+    GLint m_target{0};  ///< Framebuffer bound when the frame began
+    bool m_blend{false}; ///< Blending was enabled when the frame began
+
+    GLuint m_gbuffer{0};
+    GLuint m_normal{0};    ///< RGBA16F, view space normal and shininess
+    GLuint m_albedo{0};    ///< RGBA8, diffuse color
+    GLuint m_specular{0};  ///< RGBA8, specular color
+    GLuint m_emission{0};  ///< RGBA16F, emission and fog flag
+    GLuint m_depth{0};     ///< Depth texture, read by every pass
+
+    GLuint m_lightFramebuffer{0};
+    GLuint m_light{0};        ///< RGBA16F, accumulated light
+    GLuint m_lightDepth{0};   ///< Copy of m_depth, for testing volumes
+
+    GLuint m_directionalProgram{0};
+    GLuint m_volumeProgram{0};
+    GLuint m_compositeProgram{0};
+
+    GLuint m_emptyVao{0};      ///< For the full-screen triangle
+    GLuint m_volumeVao{0};
+    GLuint m_volumeVbo{0};
+    GLuint m_volumeEbo{0};
+    GLuint m_instanceVbo{0};
+    GLsizei m_volumeIndexCount{0};
+
+    std::vector<LightVolume> m_points;
+    std::vector<LightVolume> m_spots;
+    size_t m_lightsDrawn{0};
+};
+
+#endif
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Triangle setup and edge function scanning shared by the CPU
+///        rasterizers
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __EDGERASTER_H__
+#define __EDGERASTER_H__
+
+// STL
+#include <algorithm>
+#include <cmath>
+
+// GL
+#include "GLInclude.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define EDGERASTER_SSE
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Screen space triangle: edge functions and depth as planes
+///        a*x + b*y + c over pixel centers
+///
+/// Used by OcclusionCuller and SoftwareRasterizer, which differ only in what
+/// they do with the depth of the covered pixels.
+////////////////////////////////////////////////////////////////////////////////
+struct EdgeTriangle {
+
+  float edgeA[3], edgeB[3], edgeC[3];
+  float depthA, depthB, depthC;
+  float invArea;
+  int minX, maxX, minY, maxY;
+
+  /// @brief Pixel coordinates and [0, 1] depth of a clip space position
+  static glm::vec3 toScreen(const glm::vec4& _clip, int _width, int _height) {
+    return glm::vec3((_clip.x / _clip.w * 0.5f + 0.5f) * _width,
+                     (_clip.y / _clip.w * 0.5f + 0.5f) * _height,
+                     _clip.z / _clip.w * 0.5f + 0.5f);
+  }
+
+  /// @brief Set up the edge and depth planes of a triangle
+  /// @param _v      Screen space vertices; swapped to counterclockwise
+  /// @param _width  Viewport the bounds are clamped to
+  /// @param _height
+  /// @param _order  Indices of the vertices, swapped along with them, if given
+  /// @return False for triangles off screen or seen edge-on
+  ///
+  /// Both windings are accepted.
+  bool setup(glm::vec3* _v, int _width, int _height, int* _order = nullptr) {
+
+    float area = (_v[1].x - _v[0].x) * (_v[2].y - _v[0].y) -
+                 (_v[1].y - _v[0].y) * (_v[2].x - _v[0].x);
+    if (std::fabs(area) < 1e-8f) {
+      return false;
+    }
+    if (area < 0.0f) {
+      std::swap(_v[1], _v[2]);
+      if (_order) {
+        std::swap(_order[1], _order[2]);
+      }
+      area = -area;
+    }
+
+    minX = std::max(0, int(std::floor(std::min(_v[0].x, std::min(_v[1].x, _v[2].x)))));
+    maxX = std::min(_width - 1, int(std::ceil(std::max(_v[0].x, std::max(_v[1].x, _v[2].x)))));
+    minY = std::max(0, int(std::floor(std::min(_v[0].y, std::min(_v[1].y, _v[2].y)))));
+    maxY = std::min(_height - 1, int(std::ceil(std::max(_v[0].y, std::max(_v[1].y, _v[2].y)))));
+    if (minX > maxX || minY > maxY) {
+      return false;
+    }
+
+    // Edge k is opposite vertex k and positive on the triangle's side; the
+    // edge values at a point, over the area, are its barycentric weights
+    invArea = 1.0f / area;
+    depthA = depthB = depthC = 0.0f;
+    for (int k = 0; k < 3; ++k) {
+      const glm::vec3& a = _v[(k + 1) % 3];
+      const glm::vec3& b = _v[(k + 2) % 3];
+      edgeA[k] = a.y - b.y;
+      edgeB[k] = b.x - a.x;
+      edgeC[k] = -(edgeA[k] * a.x + edgeB[k] * a.y);
+      depthA += edgeA[k] * _v[k].z * invArea;
+      depthB += edgeB[k] * _v[k].z * invArea;
+      depthC += edgeC[k] * _v[k].z * invArea;
+    }
+    return true;
+  }
+
+  /// @brief Value of edge k at a point
+  float edge(int _k, float _px, float _py) const {
+    return edgeA[_k] * _px + edgeB[_k] * _py + edgeC[_k];
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Visit the pixels of one row that a triangle covers
+/// @param _t       Triangle
+/// @param _y       Row, in the triangle's screen space
+/// @param _x0      First column, relative to _originX
+/// @param _x1      Last column, likewise
+/// @param _originX Screen column of the caller's buffer's first pixel
+/// @param _visit   With SSE, called as _visit(x, inside, z) for every group
+///                 of four pixels from a multiple of four that has a pixel
+///                 inside, with the lane masks and depths; otherwise called
+///                 as _visit(x, z) for every pixel inside
+template <typename Visit>
+inline void scanRow(const EdgeTriangle& _t, int _y, int _x0, int _x1,
+                    int _originX, Visit _visit) {
+
+  const float py = _y + 0.5f;
+
+#if defined(EDGERASTER_SSE)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+  __m128 e0a = _mm_set1_ps(_t.edgeA[0]);
+  __m128 e1a = _mm_set1_ps(_t.edgeA[1]);
+  __m128 e2a = _mm_set1_ps(_t.edgeA[2]);
+  __m128 za = _mm_set1_ps(_t.depthA);
+  __m128 e0 = _mm_set1_ps(_t.edgeB[0] * py + _t.edgeC[0]);
+  __m128 e1 = _mm_set1_ps(_t.edgeB[1] * py + _t.edgeC[1]);
+  __m128 e2 = _mm_set1_ps(_t.edgeB[2] * py + _t.edgeC[2]);
+  __m128 z0 = _mm_set1_ps(_t.depthB * py + _t.depthC);
+
+  // Four pixels at a time from a 16 byte boundary; pixels of the group
+  // outside the triangle fail the edge tests
+  for (int x = _x0 & ~3; x <= _x1; x += 4) {
+    __m128 px = _mm_add_ps(_mm_set1_ps(float(_originX + x)), offsets);
+    __m128 inside = _mm_and_ps(
+      _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e0a, px), e0), zero),
+                 _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e1a, px), e1), zero)),
+      _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e2a, px), e2), zero));
+    if (_mm_movemask_ps(inside) == 0) {
+      continue;
+    }
+    _visit(x, inside, _mm_add_ps(_mm_mul_ps(za, px), z0));
+  }
+#else
+  for (int x = _x0; x <= _x1; ++x) {
+    float px = _originX + x + 0.5f;
+    if (_t.edge(0, px, py) >= 0.0f && _t.edge(1, px, py) >= 0.0f &&
+        _t.edge(2, px, py) >= 0.0f) {
+      _visit(x, _t.depthA * px + _t.depthB * py + _t.depthC);
+    }
+  }
+#endif
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef __FRUSTUM_CPP__
+#define __FRUSTUM_CPP__
+
+#include "frustum.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+AABB AABB::transformed(const glm::mat4& _m) const {
+
+  // Transform the center, and project the extents onto the new axes
+  glm::vec3 c = glm::vec3(_m * glm::vec4(center(), 1.0f));
+  glm::vec3 e = extent();
+  glm::vec3 r(0.0f);
+  for (int i = 0; i < 3; ++i) {
+    r[i] = std::fabs(_m[0][i]) * e.x + std::fabs(_m[1][i]) * e.y +
+           std::fabs(_m[2][i]) * e.z;
+  }
+
+  AABB box;
+  box.min = c - r;
+  box.max = c + r;
+  return box;
+}
+
+BoundingSphere BoundingSphere::transformed(const glm::mat4& _m) const {
+
+  float sx = glm::length(glm::vec3(_m[0]));
+  float sy = glm::length(glm::vec3(_m[1]));
+  float sz = glm::length(glm::vec3(_m[2]));
+
+  BoundingSphere sphere;
+  sphere.center = glm::vec3(_m * glm::vec4(center, 1.0f));
+  sphere.radius = radius * std::max(sx, std::max(sy, sz));
+  return sphere;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Compute the local-space bounds of a mesh
+/// @param _mesh Mesh
+/// @param _box Receives the box around every vertex
+/// @param _sphere Receives a sphere centered on the box
+void computeBounds(const mesh& _mesh, AABB& _box, BoundingSphere& _sphere) {
+
+  _box = AABB();
+  _sphere = BoundingSphere();
+
+  const vertex* vertices = _mesh.vertexData();
+  const size_t count = _mesh.vertexCount();
+
+  if (count == 0) {
+    return;
+  }
+
+  _box.min = _box.max = vertices[0].m_p;
+  for (size_t i = 0; i < count; ++i) {
+    _box.min = glm::min(_box.min, vertices[i].m_p);
+    _box.max = glm::max(_box.max, vertices[i].m_p);
+  }
+
+  // Tighter than half the diagonal for most models
+  _sphere.center = _box.center();
+  float r2 = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec3 d = vertices[i].m_p - _sphere.center;
+    r2 = std::max(r2, glm::dot(d, d));
+  }
+  _sphere.radius = std::sqrt(r2);
+}
+
+Frustum::Frustum() {
+  std::fill(m_nx, m_nx + 8, 0.0f);
+  std::fill(m_ny, m_ny + 8, 0.0f);
+  std::fill(m_nz, m_nz + 8, 0.0f);
+  std::fill(m_d, m_d + 8, 1.0f);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Extract the clip planes from a view-projection matrix
+/// @param _viewProjection Projection matrix times view matrix
+///
+/// Gribb and Hartmann: each plane is the fourth row of the matrix plus or
+/// minus one of the other rows. glm matrices are column-major, so row i is
+/// (m[0][i], m[1][i], m[2][i], m[3][i]).
+void Frustum::extract(const glm::mat4& _viewProjection) {
+
+  const glm::mat4& m = _viewProjection;
+  glm::vec4 row[4];
+  for (int i = 0; i < 4; ++i) {
+    row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+  }
+
+  glm::vec4 planes[6] = {
+    row[3] + row[0], // left
+    row[3] - row[0], // right
+    row[3] + row[1], // bottom
+    row[3] - row[1], // top
+    row[3] + row[2], // near
+    row[3] - row[2]  // far
+  };
+
+  for (int i = 0; i < 6; ++i) {
+    float length = glm::length(glm::vec3(planes[i]));
+    m_nx[i] = planes[i].x / length;
+    m_ny[i] = planes[i].y / length;
+    m_nz[i] = planes[i].z / length;
+    m_d[i] = planes[i].w / length;
+  }
+
+  // Padding planes that everything is in front of
+  for (int i = 6; i < 8; ++i) {
+    m_nx[i] = m_ny[i] = m_nz[i] = 0.0f;
+    m_d[i] = 1.0f;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Test a sphere against all planes
+/// @return False only if the sphere lies entirely behind some plane
+bool Frustum::intersects(const BoundingSphere& _sphere) const {
+
+#if defined(FRUSTUM_SSE)
+  __m128 cx = _mm_set1_ps(_sphere.center.x);
+  __m128 cy = _mm_set1_ps(_sphere.center.y);
+  __m128 cz = _mm_set1_ps(_sphere.center.z);
+  __m128 r = _mm_set1_ps(-_sphere.radius);
+
+  int outside = 0;
+  for (int i = 0; i < 8; i += 4) {
+    __m128 d = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_load_ps(m_nx + i), cx),
+                 _mm_mul_ps(_mm_load_ps(m_ny + i), cy)),
+      _mm_add_ps(_mm_mul_ps(_mm_load_ps(m_nz + i), cz),
+                 _mm_load_ps(m_d + i)));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(d, r));
+  }
+  return outside == 0;
+#else
+  for (int i = 0; i < 6; ++i) {
+    float d = m_nx[i] * _sphere.center.x + m_ny[i] * _sphere.center.y +
+              m_nz[i] * _sphere.center.z + m_d[i];
+    if (d < -_sphere.radius) {
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Test a box against all planes
+/// @return False only if the box lies entirely behind some plane
+///
+/// For each plane only the corner furthest along the normal matters; max(n*min,
+/// n*max) per axis selects it without branching.
+bool Frustum::intersects(const AABB& _box) const {
+
+#if defined(FRUSTUM_SSE)
+  __m128 minx = _mm_set1_ps(_box.min.x), maxx = _mm_set1_ps(_box.max.x);
+  __m128 miny = _mm_set1_ps(_box.min.y), maxy = _mm_set1_ps(_box.max.y);
+  __m128 minz = _mm_set1_ps(_box.min.z), maxz = _mm_set1_ps(_box.max.z);
+  __m128 zero = _mm_setzero_ps();
+
+  int outside = 0;
+  for (int i = 0; i < 8; i += 4) {
+    __m128 nx = _mm_load_ps(m_nx + i);
+    __m128 ny = _mm_load_ps(m_ny + i);
+    __m128 nz = _mm_load_ps(m_nz + i);
+    __m128 d = _mm_add_ps(
+      _mm_add_ps(_mm_max_ps(_mm_mul_ps(nx, minx), _mm_mul_ps(nx, maxx)),
+                 _mm_max_ps(_mm_mul_ps(ny, miny), _mm_mul_ps(ny, maxy))),
+      _mm_add_ps(_mm_max_ps(_mm_mul_ps(nz, minz), _mm_mul_ps(nz, maxz)),
+                 _mm_load_ps(m_d + i)));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(d, zero));
+  }
+  return outside == 0;
+#else
+  for (int i = 0; i < 6; ++i) {
+    float d = std::max(m_nx[i] * _box.min.x, m_nx[i] * _box.max.x) +
+              std::max(m_ny[i] * _box.min.y, m_ny[i] * _box.max.y) +
+              std::max(m_nz[i] * _box.min.z, m_nz[i] * _box.max.z) + m_d[i];
+    if (d < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Cheap sphere rejection first, then the tighter box test
+bool Frustum::intersects(const BoundingSphere& _sphere, const AABB& _box) const {
+  return intersects(_sphere) && intersects(_box);
+}
+
+#endif
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Bounding volumes and view-frustum culling
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+
+// STL
+#include <cstddef>
+
+// GL
+#include "GLInclude.h"
+
+#include "objParser.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Axis-aligned bounding box
+////////////////////////////////////////////////////////////////////////////////
+struct AABB {
+  glm::vec3 min{0.0f};
+  glm::vec3 max{0.0f};
+
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+  AABB transformed(const glm::mat4& _m) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bounding sphere
+////////////////////////////////////////////////////////////////////////////////
+struct BoundingSphere {
+  glm::vec3 center{0.0f};
+  float radius{0.0f};
+
+  BoundingSphere transformed(const glm::mat4& _m) const;
+};
+
+void computeBounds(const mesh& _mesh, AABB& _box, BoundingSphere& _sphere);
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Number of objects accepted and rejected by culling in one frame
+////////////////////////////////////////////////////////////////////////////////
+struct CullStats {
+  size_t drawn{0};
+  size_t culled{0};
+  size_t occluded{0}; ///< In view but hidden behind occluders
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief The six clip planes of a view-projection matrix
+///
+/// Planes are stored as structure of arrays, padded to eight so that two SSE
+/// registers test all of them at once. Normals point into the frustum, so a
+/// point is inside when its signed distance to every plane is positive.
+////////////////////////////////////////////////////////////////////////////////
+class Frustum {
+
+  public:
+
+    Frustum();
+
+    void extract(const glm::mat4& _viewProjection);
+
+    bool intersects(const BoundingSphere& _sphere) const;
+    bool intersects(const AABB& _box) const;
+    bool intersects(const BoundingSphere& _sphere, const AABB& _box) const;
+
+  private:
+
+    alignas(16) float m_nx[8];
+    alignas(16) float m_ny[8];
+    alignas(16) float m_nz[8];
+    alignas(16) float m_d[8];
+};
+
+#endif
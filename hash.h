@@ -0,0 +1,25 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Content hash shared by the asset caches
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __HASH_H__
+#define __HASH_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief 64-bit FNV-1a hash of some bytes
+///
+/// Stored in mesh binaries, so changing it invalidates every one of them.
+inline uint64_t hashBytes(const unsigned char* _data, size_t _size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < _size; ++i) {
+    hash ^= _data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+#endif
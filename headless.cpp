@@ -0,0 +1,191 @@
+#ifndef __HEADLESS_CPP__
+#define __HEADLESS_CPP__
+
+#include "headless.h"
+
+// STL
+#include <iostream>
+
+#if defined(HEADLESS)
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief First EGL display that needs no window system
+///
+/// Prefers a device display (a real GPU, or llvmpipe's software device),
+/// then Mesa's surfaceless platform, then whatever the default display is.
+EGLDisplay openDisplay() {
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  PFNEGLQUERYDEVICESEXTPROC queryDevices =
+    (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+
+  if (getPlatformDisplay && queryDevices) {
+    EGLDeviceEXT devices[8];
+    EGLint count = 0;
+    if (queryDevices(8, devices, &count)) {
+      for (EGLint i = 0; i < count; ++i) {
+        EGLDisplay display =
+          getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+          return display;
+        }
+      }
+    }
+  }
+
+  if (getPlatformDisplay) {
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+      EGL_DEFAULT_DISPLAY, nullptr);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+      return display;
+    }
+  }
+
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+    return display;
+  }
+  return EGL_NO_DISPLAY;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Create the context and make it current on the calling thread
+/// @param _width Framebuffer width in pixels
+/// @param _height Framebuffer height in pixels
+/// @return False, after printing why, if no suitable context could be made
+bool HeadlessContext::create(int _width, int _height) {
+
+  EGLDisplay display = openDisplay();
+  if (display == EGL_NO_DISPLAY) {
+    std::cout << "Headless: no EGL display available" << std::endl;
+    return false;
+  }
+  m_display = display;
+
+  const EGLint configAttributes[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint configs = 0;
+  if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) ||
+      configs == 0) {
+    std::cout << "Headless: no EGL config for desktop OpenGL" << std::endl;
+    destroy();
+    return false;
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cout << "Headless: EGL does not support desktop OpenGL" << std::endl;
+    destroy();
+    return false;
+  }
+
+  const EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+    contextAttributes);
+  if (context == EGL_NO_CONTEXT) {
+    std::cout << "Headless: could not create an OpenGL 3.3 core context"
+      << std::endl;
+    destroy();
+    return false;
+  }
+  m_context = context;
+
+  // Surfaceless: the framebuffer object below is the only render target
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    std::cout << "Headless: could not make the context current" << std::endl;
+    destroy();
+    return false;
+  }
+
+  m_width = _width;
+  m_height = _height;
+
+  glGenRenderbuffers(1, &m_color);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+
+  glGenRenderbuffers(1, &m_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, _width, _height);
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+    GL_RENDERBUFFER, m_color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+    GL_RENDERBUFFER, m_depth);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "Headless: framebuffer incomplete" << std::endl;
+    destroy();
+    return false;
+  }
+
+  glViewport(0, 0, _width, _height);
+
+  std::cout << "Headless: " << glGetString(GL_RENDERER) << ", OpenGL "
+    << glGetString(GL_VERSION) << ", " << _width << "x" << _height
+    << std::endl;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Release the framebuffer and the context
+void HeadlessContext::destroy() {
+
+  EGLDisplay display = m_display;
+  if (display == EGL_NO_DISPLAY) {
+    return;
+  }
+
+  if (m_context) {
+    if (m_framebuffer) {
+      glDeleteFramebuffers(1, &m_framebuffer);
+      glDeleteRenderbuffers(1, &m_color);
+      glDeleteRenderbuffers(1, &m_depth);
+      m_framebuffer = m_color = m_depth = 0;
+    }
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, m_context);
+    m_context = nullptr;
+  }
+
+  eglTerminate(display);
+  m_display = nullptr;
+}
+
+#else
+
+bool HeadlessContext::create(int _width, int _height) {
+  std::cout << "Headless: not supported by this build, rebuild with "
+    "make HEADLESS=1" << std::endl;
+  return false;
+}
+
+void HeadlessContext::destroy() {}
+
+#endif
+
+HeadlessContext::~HeadlessContext() {
+  destroy();
+}
+
+#endif
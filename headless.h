@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Offscreen GL context for running without a window
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __HEADLESS_H__
+#define __HEADLESS_H__
+
+// GL
+#include "GLInclude.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief OpenGL 3.3 core context rendering into its own framebuffer
+///
+/// The context is created through EGL with no surface, so it needs neither a
+/// display server nor a GPU; Mesa's llvmpipe is enough. Rendering goes to a
+/// framebuffer object with a color and a depth renderbuffer, which stays
+/// bound as the draw target.
+///
+/// Only available when built with -DHEADLESS (make HEADLESS=1), which links
+/// libEGL; otherwise create() reports the missing support and fails.
+////////////////////////////////////////////////////////////////////////////////
+class HeadlessContext {
+
+  public:
+
+    HeadlessContext() = default;
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    bool create(int _width, int _height);
+    void destroy();
+
+    GLuint framebuffer() const { return m_framebuffer; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+  private:
+
+    void* m_display{nullptr};  ///< EGLDisplay
+    void* m_context{nullptr};  ///< EGLContext
+    GLuint m_framebuffer{0};
+    GLuint m_color{0};
+    GLuint m_depth{0};
+    int m_width{0};
+    int m_height{0};
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef __LIGHT_CPP__
 #define __LIGHT_CPP__
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -14,6 +16,7 @@
 #include <glm/ext.hpp>
 
 #include "light.h"
+#include "frustum.h"
 
 Light::Light() {}
 
@@ -103,4 +106,122 @@ SpotLight::SpotLight(glm::vec3 pos, glm::vec3 dir, glm::vec4 col, float innerAng
 //   float angularAtt =
 // }
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Distance beyond which a light adds nothing visible
+/// @param _exponent Exponent the shaders raise the light's result to
+/// @param _maxRange Range of lights that reach further, the camera's far plane
+/// @return Zero if the light is invisible everywhere
+///
+/// Bounds the light's brightest channel at full diffuse and specular, then
+/// solves the attenuation for the distance where it drops below one step of
+/// an 8-bit channel. Lights without distance attenuation reach the far plane.
+float lightRange(const glm::vec4& _color, const glm::vec4& _diffuse,
+                 const glm::vec4& _specular, const glm::vec4& _ambient,
+                 float _ac, float _al, float _aq, float _exponent,
+                 float _maxRange) {
+
+  float peak = 0.0f;
+  for (int c = 0; c < 3; ++c) {
+    peak = std::max(peak, (_ambient[c] + _diffuse[c] + _specular[c]) * _color[c]);
+  }
+
+  float threshold = std::pow(1.0f / 256.0f, 1.0f / _exponent);
+  float k = peak / threshold; // attenuation denominator to exceed
+  if (k <= _ac) {
+    return 0.0f;
+  }
+
+  float range = _maxRange;
+  if (_aq > 0.0f) {
+    range = (-_al + std::sqrt(_al * _al - 4.0f * _aq * (_ac - k))) / (2.0f * _aq);
+  } else if (_al > 0.0f) {
+    range = (k - _ac) / _al;
+  }
+  return std::min(range, _maxRange);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pack a point light for the GPU
+/// @param _light Light
+/// @param _view View matrix of the frame
+/// @param _ambient Global ambient intensity, which every light adds to
+/// @param _far Far plane of the camera, the furthest a light reaches
+LightVolume makeLightVolume(const PointLight& _light, const glm::mat4& _view,
+                            const glm::vec4& _ambient, float _far) {
+  LightVolume volume;
+  volume.positionRadius = glm::vec4(glm::vec3(_view * glm::vec4(_light.position, 1.0)),
+    lightRange(_light.color, _light.diffuseIntensity, _light.specularIntensity,
+      _ambient, _light.ac, _light.al, _light.aq, 1.2f, _far));
+  volume.color = _light.color;
+  volume.diffuse = _light.diffuseIntensity;
+  volume.specular = _light.specularIntensity;
+  volume.attenuation = glm::vec4(_light.ac, _light.al, _light.aq, 0.0f);
+  volume.direction = glm::vec4(0.0f);
+  volume.outer = glm::vec4(0.0f);
+  return volume;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pack a spot light for the GPU
+/// @param _light Light
+/// @param _view View matrix of the frame
+/// @param _ambient Global ambient intensity, which every light adds to
+/// @param _far Far plane of the camera, the furthest a light reaches
+LightVolume makeLightVolume(const SpotLight& _light, const glm::mat4& _view,
+                            const glm::vec4& _ambient, float _far) {
+  LightVolume volume;
+  volume.positionRadius = glm::vec4(glm::vec3(_view * glm::vec4(_light.position, 1.0)),
+    lightRange(_light.color, _light.diffuseIntensity, _light.specularIntensity,
+      _ambient, _light.ac, _light.al, _light.aq, 0.8f, _far));
+  volume.color = _light.color;
+  volume.diffuse = _light.diffuseIntensity;
+  volume.specular = _light.specularIntensity;
+  volume.attenuation = glm::vec4(_light.ac, _light.al, _light.aq, 1.0f);
+  volume.direction = glm::vec4(glm::vec3(_view *
+    glm::vec4(glm::normalize(_light.direction), 0.0)), glm::cos(_light.cutOffAngle));
+  volume.outer = glm::vec4(glm::cos(_light.outerCutOffAngle), 0.0f, 0.0f, 0.0f);
+  return volume;
+}
+
+namespace {
+
+template <typename L>
+void addVisible(const std::vector<std::shared_ptr<L>>& _lights,
+                const glm::mat4& _view, const glm::vec4& _ambient, float _far,
+                const Frustum& _frustum, std::vector<LightVolume>& _volumes) {
+  for (const std::shared_ptr<L>& light : _lights) {
+    LightVolume volume = makeLightVolume(*light, _view, _ambient, _far);
+    if (volume.positionRadius.w > 0.0f &&
+        _frustum.intersects(BoundingSphere{light->position, volume.positionRadius.w})) {
+      _volumes.push_back(volume);
+    }
+  }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pack the point lights that can light something on screen
+/// @param _lights Lights
+/// @param _view View matrix of the frame
+/// @param _ambient Global ambient intensity, which every light adds to
+/// @param _far Far plane of the camera
+/// @param _frustum View frustum; lights whose range lies outside are skipped
+/// @param _volumes Volumes to append to
+void addVisibleLightVolumes(
+  const std::vector<std::shared_ptr<PointLight>>& _lights,
+  const glm::mat4& _view, const glm::vec4& _ambient, float _far,
+  const Frustum& _frustum, std::vector<LightVolume>& _volumes) {
+  addVisible(_lights, _view, _ambient, _far, _frustum, _volumes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pack the spot lights that can light something on screen
+void addVisibleLightVolumes(
+  const std::vector<std::shared_ptr<SpotLight>>& _lights,
+  const glm::mat4& _view, const glm::vec4& _ambient, float _far,
+  const Frustum& _frustum, std::vector<LightVolume>& _volumes) {
+  addVisible(_lights, _view, _ambient, _far, _frustum, _volumes);
+}
+
 #endif
@@ -6,6 +6,12 @@
 #include "ray.h"
 #include "material.h"
 
+// STL
+#include <memory>
+#include <vector>
+
+class Frustum;
+
 class Light {
 
   public:
@@ -87,4 +93,39 @@ class SpotLight : public Light {
 
 };
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief A point or spot light packed for the GPU, in view space
+///
+/// Seven vec4s: one instance of a deferred light volume (attributes 1-7), or
+/// one light of the clustered light buffer (seven texels).
+////////////////////////////////////////////////////////////////////////////////
+struct LightVolume {
+  glm::vec4 positionRadius; ///< View space center, range; no range if invisible
+  glm::vec4 color;
+  glm::vec4 diffuse;
+  glm::vec4 specular;
+  glm::vec4 attenuation;    ///< Constant, linear, quadratic, 1 for spot lights
+  glm::vec4 direction;      ///< View space spot direction, cosine of cutoff
+  glm::vec4 outer;          ///< Cosine of the outer cutoff
+};
+
+float lightRange(const glm::vec4& _color, const glm::vec4& _diffuse,
+                 const glm::vec4& _specular, const glm::vec4& _ambient,
+                 float _ac, float _al, float _aq, float _exponent,
+                 float _maxRange);
+
+LightVolume makeLightVolume(const PointLight& _light, const glm::mat4& _view,
+                            const glm::vec4& _ambient, float _far);
+LightVolume makeLightVolume(const SpotLight& _light, const glm::mat4& _view,
+                            const glm::vec4& _ambient, float _far);
+
+void addVisibleLightVolumes(
+  const std::vector<std::shared_ptr<PointLight>>& _lights,
+  const glm::mat4& _view, const glm::vec4& _ambient, float _far,
+  const Frustum& _frustum, std::vector<LightVolume>& _volumes);
+void addVisibleLightVolumes(
+  const std::vector<std::shared_ptr<SpotLight>>& _lights,
+  const glm::mat4& _view, const glm::vec4& _ambient, float _far,
+  const Frustum& _frustum, std::vector<LightVolume>& _volumes);
+
 #endif
@@ -16,11 +16,28 @@
 #include "light.h"
 #include "material.h"
 #include "scene.h"
+#include "texturemanager.h"
+#include "meshcache.h"
+#include "frustum.h"
+#include "renderqueue.h"
+#include "threadpool.h"
+#include "assetloader.h"
+#include "scheduler.h"
+#include "profiler.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "deferred.h"
+#include "clustered.h"
+#include "occlusion.h"
+#include "softrasterizer.h"
 
 #include "particlesystem.h"
+#include "particlegrid.h"
+#include "scenebvh.h"
 #include "random.h"
 
 // STL
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
@@ -31,6 +48,7 @@
 #include <array>
 #include <math.h>
 #include <vector>
+#include <thread>
 
 #include "GLInclude.h"
 
@@ -39,8 +57,9 @@ Scene sky = Scene();
 
 State particle;
 std::vector<std::shared_ptr<ParticleSystem>> pSystems;
+ParticleGrid g_particleGrid; ///< Collisions between the systems' particles
+SceneBVH g_sceneBVH; ///< Ready objects' triangles, which particles bounce off
 int iterator = -1;
-float startFrame = 0.0f;
 bool animation = false;
 
 
@@ -59,153 +78,42 @@ int g_window{0};
 GLuint g_program{0};
 GLuint skybox_program{0};
 //GLuint animation_program{0};
-GLuint g_vao{0}; ///< Vertex Array Object
-GLuint g_vbo[3]; ///< Vertex Buffer Object
-GLuint s_vao{0};
-GLuint s_vbo[3];
 std::unique_ptr<glm::vec4[]> g_frame{nullptr}; ///< Framebuffer
+TextureManager g_textures; ///< Textures shared by every object
+MeshCache g_meshes; ///< Meshes shared by every object
+std::unique_ptr<AssetLoader> g_loader{nullptr}; ///< Loads meshes and textures
+std::vector<std::shared_ptr<Object>> g_readyObjects; ///< Objects fully loaded
+std::vector<InstanceBatch> g_batches; ///< Ready objects grouped for instancing
+Frustum g_frustum; ///< View frustum of the current frame
+CullStats g_cullStats; ///< Objects drawn and culled in the current frame
+RenderQueue g_renderQueue; ///< Visible objects sorted by state
+std::vector<CommandBuffer> g_commandBuffers; ///< One per draw recording task
+std::vector<size_t> g_batchOffsets; ///< First object of each batch, in a flat count
+GLStateCache g_stateCache; ///< Last program and textures sent to GL
+size_t g_materialChanges{0}; ///< Material uploads in the current frame
+std::unique_ptr<DeferredRenderer> g_deferred{nullptr}; ///< Set by "Deferred: enable"
+std::unique_ptr<LightClusters> g_clusters{nullptr}; ///< Set by "Clustered: enable"
+std::unique_ptr<OcclusionCuller> g_occlusion{nullptr}; ///< Objects marked "occluder"
 
 // Frame rate
 const unsigned int FPS = 60;
+const double UPLOAD_BUDGET = 0.004; ///< Seconds per frame for asset uploads
+const double MAX_FPS = 35.0; ///< Frame cap of the GLFW renderer
+const double SIM_TICK = 1.0 / 60.0; ///< Fixed simulation timestep in seconds
+const char* TRACE_FILE = "trace.json"; ///< Written by the profiler on P
+FrameScheduler g_scheduler{SIM_TICK, 1.0 / MAX_FPS, 8};
 float g_frameRate{0.f};
 std::chrono::high_resolution_clock::time_point g_frameTime{
     std::chrono::high_resolution_clock::now()};
 float g_delay{0.f};
 float g_framesPerSecond{0.f};
+double g_time{0.0}; ///< Seconds of animation shown by the current frame
 
 ////////////////////////////////////////////////////////////////////////////////
 // Functions
 
-void
-setupMaterialProperties(const std::string& _filename, std::shared_ptr<Object> object) {
-
-  std::ifstream ifs;
-  ifs.open(_filename);
-
-  if (!ifs) {
-        std::cout << "Unable to open the material file";
-  }
-
-  std::string line;
-
-  while(ifs) {
-
-    getline(ifs, line);
-    std::istringstream iss(line);
-
-    std::string tag;
-    iss >> tag;
-
-    if (tag.compare("Ka") == 0) {
-
-      iss >> object->material.ambient_coefficient[0] >>
-      object->material.ambient_coefficient[1] >>
-      object->material.ambient_coefficient[2];
-
-    } else if (tag.compare("Kd") == 0) {
-
-      iss >> object->material.diffuse_coefficient[0] >>
-      object->material.diffuse_coefficient[1] >>
-      object->material.diffuse_coefficient[2];
-
-    } else if (tag.compare("Ks") == 0) {
-
-      iss >> object->material.specular_coefficient[0] >>
-      object->material.specular_coefficient[1] >>
-      object->material.specular_coefficient[2];
-
-    } else if (tag.compare("Ns") == 0) {
-
-      iss >> object->material.shininess;
-
-    } else if (tag.compare("map_Kd") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.diffuseTexture = "Objects/" + textureFile;
-      object->material.hasDiffuseTexture = true;
-
-    } else if (tag.compare("map_Ks") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.specularTexture = "Objects/" + textureFile;
-      object->material.hasSpecularTexture = true;
-
-    } else if (tag.compare("map_Ke") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.emissionTexture = "Objects/" + textureFile;
-      object->material.hasEmissionTexture = true;
-
-    } else if (tag.compare("map_Bump") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.bumpTexture = "Objects/" + textureFile;
-      object->material.hasBumpTexture = true;
-
-    } else if (tag.compare("map_Depth") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.depthTexture = "Objects/" + textureFile;
-      object->material.hasDepthTexture = true;
-
-    } else if (tag.compare("map_Disp") == 0) {
-
-      std::string textureFile;
-
-      iss >> textureFile;
-
-      object->material.displacementTexture = "Objects/" + textureFile;
-      object->material.hasDisplacementTexture = true;
-
-    } else {}
-
-  }
-
-  ifs.close();
-}
-
 GLuint loadTexture(const char *texImagePath) {
-  GLuint textureID;
-
-  textureID = SOIL_load_OGL_texture(texImagePath,
-    SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y);
-
-  if (textureID == 0) {
-    std::cout << "could not find texture file" << texImagePath << std::endl;
-  }
-
-  glBindTexture(GL_TEXTURE_2D, textureID);
-  glGenerateMipmap(GL_TEXTURE_2D);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-#if defined(OSX)
-  if (glewIsSupported("GL_EXT_texture_filter_anisotropic")) {
-    GLfloat anisoSetting = 0.0f;
-    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &anisoSetting);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisoSetting);
-  }
-#endif
-
-  return textureID;
+  return g_textures.acquire(texImagePath);
 }
 
 GLuint loadCubeMap(const char *mapDir) {
@@ -236,43 +144,21 @@ GLuint loadCubeMap(const char *mapDir) {
   return textureRef;
 }
 
-void setupVertices(mesh& mesh, std::shared_ptr<Object> object) {
-
-  object->verticesCount = mesh.m_vertices.size();
-
-  if (object->isSkyBox) {
-
-    for (int i = 0; i < mesh.m_vertices.size(); i++) {
-
-      sky.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.x);
-      sky.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.y);
-      sky.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.z);
-
-      sky.normalPositions.emplace_back(mesh.m_vertices[i].m_n.x);
-      sky.normalPositions.emplace_back(mesh.m_vertices[i].m_n.y);
-      sky.normalPositions.emplace_back(mesh.m_vertices[i].m_n.z);
-
-      sky.texturePositions.emplace_back(mesh.m_vertices[i].m_t.x);
-      sky.texturePositions.emplace_back(mesh.m_vertices[i].m_t.y);
-    }
-
-  } else {
-
-    for (int i = 0; i < mesh.m_vertices.size(); i++) {
-
-      scene.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.x);
-      scene.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.y);
-      scene.vertexPositions.emplace_back(mesh.m_vertices[i].m_p.z);
-
-      scene.normalPositions.emplace_back(mesh.m_vertices[i].m_n.x);
-      scene.normalPositions.emplace_back(mesh.m_vertices[i].m_n.y);
-      scene.normalPositions.emplace_back(mesh.m_vertices[i].m_n.z);
-
-      scene.texturePositions.emplace_back(mesh.m_vertices[i].m_t.x);
-      scene.texturePositions.emplace_back(mesh.m_vertices[i].m_t.y);
-    }
-  }
-
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Attach the mesh of an OBJ file to an object
+/// @param _fileName OBJ filename inside Objects/
+/// @param object Object to receive the mesh
+/// @param _withMaterial Also give the object the mesh's material and textures
+/// @param _textures Further images to load, with the id each is stored to
+///
+/// Each file is parsed the first time it is referenced; later objects share
+/// the cached mesh. Loading happens in the background, and the object is
+/// drawn from the frame after updateLoading() reports it ready.
+void setupVertices(const std::string& _fileName, std::shared_ptr<Object> object,
+  bool _withMaterial = false,
+  const std::vector<std::pair<std::string, GLuint*>>& _textures = {}) {
+
+  g_loader->request(object, _fileName, _withMaterial, _textures);
 }
 
 void setupSphereVertices(std::shared_ptr<Sphere> sphere) {
@@ -306,30 +192,220 @@ void setupSphereVertices(std::shared_ptr<Sphere> sphere) {
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Uniform locations of the material, looked up once per program
+struct MaterialUniforms {
+  GLint ambient;
+  GLint shininess;
+  GLint hasDiffuse;
+  GLint hasSpecular;
+  GLint hasEmission;
+  GLint hasBump;
+  GLint hasDepth;
+  GLint hasDisplacement;
+  GLint isLocalLightSource;
+} g_materialUniforms;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Look up material uniform locations and assign the fixed texture
+///        unit of each material sampler
+void setupMaterialUniforms() {
+
+  g_materialUniforms.ambient = glGetUniformLocation(g_program, "material.ambient");
+  g_materialUniforms.shininess = glGetUniformLocation(g_program, "material.shininess");
+  g_materialUniforms.hasDiffuse = glGetUniformLocation(g_program, "material.hasDiffuse");
+  g_materialUniforms.hasSpecular = glGetUniformLocation(g_program, "material.hasSpecular");
+  g_materialUniforms.hasEmission = glGetUniformLocation(g_program, "material.hasEmission");
+  g_materialUniforms.hasBump = glGetUniformLocation(g_program, "material.hasBump");
+  g_materialUniforms.hasDepth = glGetUniformLocation(g_program, "material.hasDepth");
+  g_materialUniforms.hasDisplacement = glGetUniformLocation(g_program, "material.hasDisplacement");
+  g_materialUniforms.isLocalLightSource = glGetUniformLocation(g_program, "object.isLocalLightSource");
+
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.diffuse"), 0);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.specular"), 1);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.emission"), 2);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.bump"), 3);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.depth"), 4);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "material.displacement"), 5);
+
+  LightClusters::setSamplers(g_program);
+}
+
 void installMaterials(std::shared_ptr<Object> object) {
 
-  glProgramUniform4fv(g_program, glGetUniformLocation(g_program, "material.ambient"), 1,
+  const MaterialUniforms& u = g_materialUniforms;
+
+  glProgramUniform4fv(g_program, u.ambient, 1,
     glm::value_ptr(object->material.ambient_coefficient));
 
-  glUniform1i(glGetUniformLocation(g_program, "material.diffuse"), 0);
-  glUniform1i(glGetUniformLocation(g_program, "material.specular"), 1);
-  glUniform1i(glGetUniformLocation(g_program, "material.emission"), 2);
-  glUniform1i(glGetUniformLocation(g_program, "material.bump"), 3);
-  glUniform1i(glGetUniformLocation(g_program, "material.depth"), 4);
-  glUniform1i(glGetUniformLocation(g_program, "material.displacement"), 5);
-
-  glProgramUniform1f(g_program, glGetUniformLocation(g_program, "material.shininess"),
-  object->material.shininess);
-
-  glUniform1i(glGetUniformLocation(g_program, "material.hasDiffuse"), object->material.hasDiffuseTexture);
-  glUniform1i(glGetUniformLocation(g_program, "material.hasSpecular"), object->material.hasSpecularTexture);
-  glUniform1i(glGetUniformLocation(g_program, "material.hasEmission"), object->material.hasEmissionTexture);
-  glUniform1i(glGetUniformLocation(g_program, "material.hasBump"), object->material.hasBumpTexture);
-  glUniform1i(glGetUniformLocation(g_program, "material.hasDepth"), object->material.hasDepthTexture);
-  glUniform1i(glGetUniformLocation(g_program, "material.hasDisplacement"), object->material.hasDisplacementTexture);
-  glUniform1i(glGetUniformLocation(g_program, "object.isLocalLightSource"), object->isLocalLightSource);
-  glProgramUniform4fv(g_program, glGetUniformLocation(g_program,
-    "lightSource_color"), 1, glm::value_ptr(object->color));
+  glProgramUniform1f(g_program, u.shininess, object->material.shininess);
+
+  glProgramUniform1i(g_program, u.hasDiffuse, object->material.hasDiffuseTexture);
+  glProgramUniform1i(g_program, u.hasSpecular, object->material.hasSpecularTexture);
+  glProgramUniform1i(g_program, u.hasEmission, object->material.hasEmissionTexture);
+  glProgramUniform1i(g_program, u.hasBump, object->material.hasBumpTexture);
+  glProgramUniform1i(g_program, u.hasDepth, object->material.hasDepthTexture);
+  glProgramUniform1i(g_program, u.hasDisplacement, object->material.hasDisplacementTexture);
+  glProgramUniform1i(g_program, u.isLocalLightSource, object->isLocalLightSource);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Assign each instance batch its texture set and sort key prefix
+///
+/// Texture sets and materials are interned to small ids so that batches with
+/// identical state get identical key fields and sort next to each other.
+void setupSortKeys() {
+
+  InternTable<TextureSet> textureSets;
+  InternTable<MaterialState> materials;
+
+  for (uint32_t i = 0; i < g_batches.size(); ++i) {
+    InstanceBatch& batch = g_batches[i];
+    const std::shared_ptr<Object>& object = batch.objects.front();
+    const Material& m = object->material;
+
+    batch.textures = {{object->diffuseTextureID, object->specularTextureID,
+      object->emissionTextureID, object->bumpTextureID,
+      object->depthTextureID, object->displacementTextureID}};
+
+    MaterialState state;
+    state.values[0] = m.ambient_coefficient[0];
+    state.values[1] = m.ambient_coefficient[1];
+    state.values[2] = m.ambient_coefficient[2];
+    state.values[3] = m.ambient_coefficient[3];
+    state.values[4] = m.shininess;
+    state.flags = m.hasDiffuseTexture | m.hasSpecularTexture << 1 |
+      m.hasEmissionTexture << 2 | m.hasBumpTexture << 3 |
+      m.hasDepthTexture << 4 | m.hasDisplacementTexture << 5 |
+      object->isLocalLightSource << 6;
+
+    // The mesh field holds the batch index, which also tells the mesh apart
+    batch.textureSet = textureSets.intern(batch.textures);
+    batch.material = materials.intern(state);
+    batch.sortKey = SortKey::make(0, batch.textureSet, batch.material, i);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Cull every ready object and queue draw packets for the visible ones
+/// @param _scene Scene whose view matrix orders the draws by depth
+///
+/// The objects of all batches, counted as one flat range, are split between
+/// the command buffers. Pool threads cull their part and record its packets
+/// in their own buffer; the buffers are then appended to the render queue in
+/// order, so the result does not depend on the thread timing.
+void recordDrawCommands(const Scene& _scene) {
+
+  const size_t MinObjectsPerTask = 256;
+
+  g_batchOffsets.resize(g_batches.size() + 1);
+  g_batchOffsets[0] = 0;
+  for (size_t b = 0; b < g_batches.size(); ++b) {
+    g_batchOffsets[b + 1] = g_batchOffsets[b] + g_batches[b].objects.size();
+  }
+  const size_t total = g_batchOffsets.back();
+
+  ThreadPool& pool = ThreadPool::shared();
+  size_t tasks = std::min(pool.size() + 1,
+    std::max<size_t>((total + MinObjectsPerTask - 1) / MinObjectsPerTask, 1));
+  g_commandBuffers.resize(std::max(g_commandBuffers.size(), tasks));
+
+  const bool occlusion = !g_occlusion->empty();
+  const float nearPlane = _scene.camera.nearPlane;
+  const float farPlane = _scene.camera.farPlane;
+
+  pool.parallelFor(tasks, 1, [&](size_t _begin, size_t _end) {
+    for (size_t task = _begin; task < _end; ++task) {
+
+      CommandBuffer& commands = g_commandBuffers[task];
+      commands.clear();
+
+      size_t first = total * task / tasks;
+      size_t last = total * (task + 1) / tasks;
+
+      // Batch holding the first object of the range
+      uint32_t b = std::upper_bound(g_batchOffsets.begin(), g_batchOffsets.end(),
+        first) - g_batchOffsets.begin() - 1;
+
+      for (size_t index = first; index < last; ++index) {
+
+        while (index >= g_batchOffsets[b + 1]) {
+          b++;
+        }
+        const InstanceBatch& batch = g_batches[b];
+        const Object& object = *batch.objects[index - g_batchOffsets[b]];
+
+        // Off-screen and hidden objects never reach the queue, so they cost
+        // no uniform, texture or draw traffic
+        if (!g_frustum.intersects(object.worldSphere, object.worldBounds)) {
+          commands.stats.culled++;
+          continue;
+        }
+        if (occlusion && !g_occlusion->visible(object.worldBounds)) {
+          commands.stats.occluded++;
+          continue;
+        }
+        commands.stats.drawn++;
+
+        float depth = -(_scene.viewMatrix * glm::vec4(object.worldSphere.center, 1.0f)).z;
+        commands.push(batch.sortKey | SortKey::depth(depth, nearPlane, farPlane), b,
+          {object.modelMatrix, object.color});
+      }
+    }
+  });
+
+  for (size_t task = 0; task < tasks; ++task) {
+    const CommandBuffer& commands = g_commandBuffers[task];
+    g_renderQueue.append(commands);
+    g_cullStats.drawn += commands.stats.drawn;
+    g_cullStats.culled += commands.stats.culled;
+    g_cullStats.occluded += commands.stats.occluded;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Issue the sorted draws, changing state only where keys differ
+///
+/// Consecutive items of the same batch form one run and become a single
+/// instanced draw. The GL thread only replays the recorded packets.
+void submitRenderQueue() {
+
+  const std::vector<RenderItem>& items = g_renderQueue.items();
+  const std::vector<InstanceData>& instances = g_renderQueue.instances();
+
+  g_stateCache.useProgram(g_program);
+  glDepthFunc(GL_LEQUAL);
+
+  // Compared on the batches' own ids: the key fields are masked and may
+  // coincide for different state
+  const InstanceBatch* previous = nullptr;
+
+  size_t i = 0;
+  while (i < items.size()) {
+
+    InstanceBatch& batch = g_batches[items[i].batch];
+
+    if (!previous || batch.textureSet != previous->textureSet) {
+      for (GLuint unit = 0; unit < 6; ++unit) {
+        g_stateCache.bindTexture(unit, batch.textures.units[unit]);
+      }
+    }
+
+    if (!previous || batch.material != previous->material) {
+      installMaterials(batch.objects.front());
+      g_materialChanges++;
+    }
+    previous = &batch;
+
+    batch.visible.clear();
+    uint32_t run = items[i].batch;
+    for (; i < items.size() && items[i].batch == run; ++i) {
+      batch.visible.push_back(instances[items[i].instance]);
+    }
+
+    batch.stream();
+    batch.draw();
+  }
 }
 
 void installDirectionalLights(glm::mat4 vMatrix,
@@ -416,14 +492,46 @@ void installSpotLights(glm::mat4 vMatrix,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// @brief Initialize GL settings
-void initializeGLFW(GLFWwindow *window, const std::string& _filename)
+/// @brief Read the optional settings at the end of a generator entry
+/// @param _iss    Rest of the entry
+/// @param _system System the generator belongs to
+///
+/// Settings are keywords followed by values, in any order:
+/// `capacity: <particles>`, `rate: <particles per second>`,
+/// `burst: <particles> <seconds between bursts, 0 for once>`,
+/// `bounce: <restitution> <friction>` and `collide: off` to let the particles
+/// pass through the scene's objects.
+void parseGeneratorOptions(std::istringstream& _iss, ParticleSystem& _system)
 {
-  glClearColor(0.1f, 0.0f, 0.2f, 0.f);
-  //glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-  glEnable(GL_COLOR_MATERIAL);
-  glEnable(GL_DEPTH_TEST);
+  std::string option;
+  while (_iss >> option) {
+    if (option.compare("capacity:") == 0) {
+      size_t capacity;
+      if (_iss >> capacity) {
+        _system.m_ParticlePool.Resize(capacity);
+      }
+    } else if (option.compare("rate:") == 0) {
+      _iss >> _system.emissionRate;
+    } else if (option.compare("burst:") == 0) {
+      _iss >> _system.burstCount >> _system.burstInterval;
+    } else if (option.compare("bounce:") == 0) {
+      _iss >> _system.bounce >> _system.friction;
+    } else if (option.compare("collide:") == 0) {
+      std::string collide;
+      _iss >> collide;
+      _system.collidesWithScene = collide.compare("off") != 0;
+    }
+  }
+}
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Read a rasterizer scene file and request the assets it names
+/// @param _filename Scene file
+///
+/// Touches no GL state, so the software renderer shares it; g_loader must
+/// exist.
+void parseSceneGLFW(const std::string& _filename)
+{
   std::string line;
   std::ifstream ifs;
   ifs.open(_filename);
@@ -447,10 +555,11 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
       Camera camera = Camera(cameraView, position, focal_length, M_PI/3, g_width, g_height);
 
       if (cameraView.compare("perspective") == 0) {
-        camera.projectionMatrix = glm::perspective(1.0472f, camera.aspectRatio, 0.1f, 1000.0f);
+        camera.projectionMatrix = glm::perspective(1.0472f, camera.aspectRatio,
+          camera.nearPlane, camera.farPlane);
       } else {
         camera.projectionMatrix = glm::ortho(camera.l, camera.r, camera.b, camera.t,
-        0.1f, 1000.0f);
+          camera.nearPlane, camera.farPlane);
       }
 
       scene.addCamera(camera);
@@ -501,11 +610,7 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
         iss >> ptr_object->scale[0] >> ptr_object->scale[1] >> ptr_object->scale[2];
       }
 
-      ptr_object->meshes = objParser("Objects/" + fileName);
-      g_program = compileProgram("Shaders/experimental.vert",
-                            "Shaders/experimental.frag",
-                            "Shaders/experimental.geom");
-      setupVertices(ptr_object->meshes, ptr_object);
+      setupVertices(fileName, ptr_object);
 
       scene.addObject(ptr_object);
       scene.addPointLight(ptr_light);
@@ -539,11 +644,7 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
         iss >> ptr_object->scale[0] >> ptr_object->scale[1] >> ptr_object->scale[2];
       }
 
-      ptr_object->meshes = objParser("Objects/" + fileName);
-      g_program = compileProgram("Shaders/experimental.vert",
-                            "Shaders/experimental.frag",
-                            "Shaders/experimental.geom");
-      setupVertices(ptr_object->meshes, ptr_object);
+      setupVertices(fileName, ptr_object);
 
       scene.addObject(ptr_object);
       scene.addSpotLight(ptr_light);
@@ -576,20 +677,12 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
         ptr_object->rotationAroundZ;
       }
 
-      ptr_object->meshes = objParser("Objects/" + fileName);
+      // Large objects that hide others can be marked for occlusion culling
+      std::string occluder;
+      iss >> occluder;
+      ptr_object->isOccluder = occluder.compare("occluder") == 0;
 
-      setupVertices(ptr_object->meshes, ptr_object);
-      setupMaterialProperties("Objects/" + ptr_object->meshes.mtlFile, ptr_object);
-
-      if (ptr_object->material.hasDisplacementTexture) {
-          g_program = compileProgram("Shaders/experimental.vert",
-                                "Shaders/experimental.frag",
-                                "Shaders/experimental.geom");
-      } else {
-        g_program = compileProgram("Shaders/experimental.vert",
-                              "Shaders/experimental.frag",
-                              "Shaders/experimental.geom");
-      }
+      setupVertices(fileName, ptr_object, true);
 
       scene.addObject(ptr_object);
 
@@ -605,18 +698,8 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
 
       ptr_object->material.skyboxTexture = textureFile;
       ptr_object->isSkyBox = true;
-      ptr_object->meshes = objParser("Objects/" + fileName);
-
-      setupVertices(ptr_object->meshes, ptr_object);
-
-      const char *temp = &ptr_object->material.skyboxTexture[0];
-      ptr_object->skyboxTextureID = loadTexture(temp);
-
-      skybox_program = compileProgram("Shaders/skybox.vert",
-                            "Shaders/skybox.frag");
-
-      sky.addObject(ptr_object);
-
+      setupVertices(fileName, ptr_object, false,
+        {{textureFile, &ptr_object->skyboxTextureID}});
 
     } else if (tag.compare("Fog:") == 0) {
 
@@ -629,6 +712,26 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
         sky.hasSky = false;
       }
 
+    } else if (tag.compare("Deferred:") == 0) {
+
+      std::string deferred;
+
+      iss >> deferred;
+
+      if (deferred.compare("enable") == 0) {
+        g_deferred.reset(new DeferredRenderer());
+      }
+
+    } else if (tag.compare("Clustered:") == 0) {
+
+      std::string clustered;
+
+      iss >> clustered;
+
+      if (clustered.compare("enable") == 0) {
+        g_clusters.reset(new LightClusters(ThreadPool::shared()));
+      }
+
     } else if (tag.compare("Dissection:") == 0) {
 
       std::string dissect;
@@ -643,9 +746,6 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
 
       animation = true;
 
-    	glEnable(GL_BLEND);
-    	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     } else if (tag.compare("ParticleProperties:") == 0) {
 
       iss >> particle.ColorBegin[0] >> particle.ColorBegin[1] >> particle.ColorBegin[2]
@@ -665,6 +765,8 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
       iss >> particleSystem->pGen.position[0] >> particleSystem->pGen.position[1]
       >> particleSystem->pGen.position[2];
 
+      parseGeneratorOptions(iss, *particleSystem);
+
     } else if (tag.compare("DirectedGenerator:") == 0) {
 
       std::shared_ptr<ParticleSystem> particleSystem(new ParticleSystem());
@@ -677,6 +779,8 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
       >> particleSystem->dirGen.position[2] >> particleSystem->dirGen.direction[0]
       >> particleSystem->dirGen.direction[1] >> particleSystem->dirGen.direction[2];
 
+      parseGeneratorOptions(iss, *particleSystem);
+
     } else if (tag.compare("DiscGenerator:") == 0) {
 
       std::shared_ptr<ParticleSystem> particleSystem(new ParticleSystem());
@@ -690,6 +794,8 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
       >> particleSystem->discGen.normal[0] >> particleSystem->discGen.normal[1]
       >> particleSystem->discGen.normal[2];
 
+      parseGeneratorOptions(iss, *particleSystem);
+
     } else if (tag.compare("Rotator:") == 0) {
 
       struct ParticleSystem::Rotator r;
@@ -726,6 +832,13 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
 
       pSystems[iterator]->windSet.push_back(w);
 
+    } else if (tag.compare("NBody:") == 0) {
+
+      std::shared_ptr<ParticleSystem> system = pSystems[iterator];
+
+      iss >> system->nBodyStrength >> system->openingAngle
+      >> system->softening;
+
     } else if (tag.compare("Gravity:") == 0) {
 
       std::string g;
@@ -741,21 +854,9 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
 
   }
 
-  // std::shared_ptr<Sphere> ptr_sphere(new Sphere(48));
-  // ptr_sphere->color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
-  // ptr_sphere->position = glm::vec3(0.0f, 10.0f, -20.0f);
-  // ptr_sphere->translate = glm::vec3(0.0f, 0.0f, 0.0f);
-  // ptr_sphere->scale = glm::vec3(10.0f, 10.0f, 10.0f);
-  // ptr_sphere->rotationAroundX = 0.0f;
-  // ptr_sphere->rotationAroundY = 0.0f;
-  // ptr_sphere->rotationAroundZ = 0.0f;
-  // g_program = compileProgram("Shaders/passthrough.vert",
-  //                          "Shaders/passthrough.frag");
-  // setupSphereVertices(ptr_sphere);
-  // scene.addObject(ptr_sphere);
-
-  glUniform1i(glGetUniformLocation(g_program, "scene.fog"), scene.fog);
-  glUniform1i(glGetUniformLocation(g_program, "scene.dissection"), scene.dissection);
+  for (std::shared_ptr<ParticleSystem> particleSystem : pSystems) {
+    particleSystem->CompileForces();
+  }
 
   for(std::shared_ptr<Object> object : scene.objects) {
 
@@ -770,83 +871,128 @@ void initializeGLFW(GLFWwindow *window, const std::string& _filename)
     glm::mat4 rz = glm::rotate(glm::radians(object->rotationAroundZ), glm::vec3(0,0,1));
 
     object->modelMatrix = t * s * rx * ry * rz;
+  }
+}
 
-    if (object->material.hasDiffuseTexture) {
-      const char *temp = &object->material.diffuseTexture[0];
-      object->diffuseTextureID = loadTexture(temp);
-    }
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Initialize GL settings
+void initializeGLFW(const std::string& _filename)
+{
+  PROFILE_SCOPE("Parse scene");
 
-    if (object->material.hasSpecularTexture) {
-      const char *temp2 = &object->material.specularTexture[0];
-      object->specularTextureID = loadTexture(temp2);
-    }
+  glClearColor(0.1f, 0.0f, 0.2f, 0.f);
+  //glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  glEnable(GL_COLOR_MATERIAL);
+  glEnable(GL_DEPTH_TEST);
 
-    if (object->material.hasEmissionTexture) {
-      const char *temp3 = &object->material.emissionTexture[0];
-      object->emissionTextureID = loadTexture(temp3);
-    }
+  g_program = compileProgram("Shaders/experimental.vert",
+                        "Shaders/experimental.frag",
+                        "Shaders/experimental.geom");
+  setupMaterialUniforms();
 
-    if (object->material.hasBumpTexture) {
-      const char *temp4 = &object->material.bumpTexture[0];
-      object->bumpTextureID = loadTexture(temp4);
-    }
+  g_loader.reset(new AssetLoader(ThreadPool::shared(), g_meshes, g_textures,
+    "Objects/"));
+  g_occlusion.reset(new OcclusionCuller(ThreadPool::shared()));
 
-    if (object->material.hasDepthTexture) {
-      const char *temp5 = &object->material.depthTexture[0];
-      object->depthTextureID = loadTexture(temp5);
-    }
+  parseSceneGLFW(_filename);
 
-    if (object->material.hasDisplacementTexture) {
-      const char *temp6 = &object->material.displacementTexture[0];
-      object->displacementTextureID = loadTexture(temp6);
-    }
+  if (sky.hasSky) {
+    skybox_program = compileProgram("Shaders/skybox.vert",
+                          "Shaders/skybox.frag");
+  }
 
+  if (animation) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
 
 
-  //skyboxTexture = loadTexture("Objects/left.jpg");
+  // std::shared_ptr<Sphere> ptr_sphere(new Sphere(48));
+  // ptr_sphere->color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+  // ptr_sphere->position = glm::vec3(0.0f, 10.0f, -20.0f);
+  // ptr_sphere->translate = glm::vec3(0.0f, 0.0f, 0.0f);
+  // ptr_sphere->scale = glm::vec3(10.0f, 10.0f, 10.0f);
+  // ptr_sphere->rotationAroundX = 0.0f;
+  // ptr_sphere->rotationAroundY = 0.0f;
+  // ptr_sphere->rotationAroundZ = 0.0f;
+  // g_program = compileProgram("Shaders/passthrough.vert",
+  //                          "Shaders/passthrough.frag");
+  // setupSphereVertices(ptr_sphere);
+  // scene.addObject(ptr_sphere);
 
+  // Deferred shading: the scene program only fills the G-buffer
+  if (g_deferred) {
+    glDeleteProgram(g_program);
+    g_program = compileProgram("Shaders/experimental.vert",
+                          "Shaders/gbuffer.frag",
+                          "Shaders/experimental.geom");
+    setupMaterialUniforms();
+    g_deferred->initialize();
+  }
 
-  // Generate vertex array
-  glGenVertexArrays(1, &g_vao);
-  glBindVertexArray(g_vao);
+  // Clustered shading: experimental.frag reads local lights from the clusters
+  if (g_clusters && g_deferred) {
+    std::cout << "Clustered shading is ignored, deferred shading lights the scene"
+              << std::endl;
+    g_clusters.reset();
+  } else if (g_clusters) {
+    g_clusters->initialize();
+  }
 
-  // Generate/specify vertex buffer
-  glGenBuffers(3, g_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, g_vbo[0]);
-  glBufferData(GL_ARRAY_BUFFER, scene.vertexPositions.size() * sizeof(float),
-  &scene.vertexPositions[0], GL_STATIC_DRAW);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "scene.fog"),
+    scene.fog);
+  glProgramUniform1i(g_program, glGetUniformLocation(g_program, "scene.dissection"),
+    scene.dissection);
 
-  glBindBuffer(GL_ARRAY_BUFFER, g_vbo[1]);
-  glBufferData(GL_ARRAY_BUFFER, scene.normalPositions.size() * sizeof(float),
-  &scene.normalPositions[0], GL_STATIC_DRAW);
+  //skyboxTexture = loadTexture("Objects/left.jpg");
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, g_vbo[2]);
-  glBufferData(GL_ARRAY_BUFFER, scene.texturePositions.size() * sizeof(float),
-  &scene.texturePositions[0], GL_STATIC_DRAW);
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Make objects whose assets finished loading drawable
+///
+/// Called every frame. Uploads spend at most UPLOAD_BUDGET seconds, and the
+/// instance batches are rebuilt only on frames where some object became ready.
+void updateLoading()
+{
+  if (g_loader->idle()) {
+    return;
+  }
 
-  if (sky.hasSky) {
-    // Generate vertex array
-    glGenVertexArrays(1, &s_vao);
-    glBindVertexArray(s_vao);
+  PROFILE_SCOPE("Upload assets");
 
-    // Generate/specify vertex buffer
-    glGenBuffers(3, s_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, s_vbo[0]);
-    glBufferData(GL_ARRAY_BUFFER, sky.vertexPositions.size() * sizeof(float),
-    &sky.vertexPositions[0], GL_STATIC_DRAW);
+  std::vector<std::shared_ptr<Object>> ready;
+  if (!g_loader->pump(UPLOAD_BUDGET, ready)) {
+    return;
+  }
 
-    glBindBuffer(GL_ARRAY_BUFFER, s_vbo[1]);
-    glBufferData(GL_ARRAY_BUFFER, sky.normalPositions.size() * sizeof(float),
-    &sky.normalPositions[0], GL_STATIC_DRAW);
+  for (std::shared_ptr<Object> object : ready) {
 
-    glBindBuffer(GL_ARRAY_BUFFER, s_vbo[2]);
-    glBufferData(GL_ARRAY_BUFFER, sky.texturePositions.size() * sizeof(float),
-    &sky.texturePositions[0], GL_STATIC_DRAW);
-  }
+    if (object->isSkyBox) {
+      sky.addObject(object);
+      continue;
+    }
 
+    object->worldBounds = object->asset->bounds.transformed(object->modelMatrix);
+    object->worldSphere = object->asset->sphere.transformed(object->modelMatrix);
+    g_readyObjects.push_back(object);
+  }
 
+  for (InstanceBatch& batch : g_batches) {
+    batch.release();
+  }
+  g_batches = buildInstanceBatches(g_readyObjects);
+  setupSortKeys();
+  g_occlusion->setOccluders(g_readyObjects);
+  if (!pSystems.empty()) {
+    g_sceneBVH.build(g_readyObjects);
+  }
 
+  if (g_loader->idle()) {
+    g_textures.report(std::cout);
+    std::cout << "Meshes: " << g_meshes.size() << " unique, "
+      << g_readyObjects.size() << " objects in " << g_batches.size()
+      << " instanced batches" << std::endl;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -882,19 +1028,9 @@ void timerGLFW(int _v)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// @brief Draw function for single frame
-void drawGLFW(GLFWwindow *window, double currentFrame)
+/// @brief Move the camera with the arrow and WASD keys
+void processInputGLFW(GLFWwindow *window)
 {
-  using namespace std::chrono;
-  //////////////////////////////////////////////////////////////////////////////
-  // Clear
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(g_program);
-
-  float deltaTime = (currentFrame - startFrame);
-  startFrame = currentFrame;
-
   if (glfwGetKey(window, GLFW_KEY_UP ) == GLFW_PRESS){
     scene.camera.verticalAngle += 0.01;
   }
@@ -924,6 +1060,23 @@ void drawGLFW(GLFWwindow *window, double currentFrame)
   if (glfwGetKey(window, GLFW_KEY_A ) == GLFW_PRESS){
       scene.camera.position -= scene.camera.right() * speed;
   }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Draw function for single frame
+/// @param alpha Fraction of a simulation tick elapsed since the last one, for
+///        interpolating simulated positions
+void drawGLFW(float alpha)
+{
+  //////////////////////////////////////////////////////////////////////////////
+  // Clear
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  if (g_deferred) {
+    g_deferred->beginGeometry(g_width, g_height);
+  }
+
+  glUseProgram(g_program);
 
   // build view matrix, model matrix, and model-view matrix
   scene.viewMatrix = glm::lookAt(
@@ -947,105 +1100,85 @@ void drawGLFW(GLFWwindow *window, double currentFrame)
   glProgramUniform1f(g_program, glGetUniformLocation(g_program, "spotCount"),
   scene.spotLights.size());
 
-  int index = 0.0f;
-  for (std::shared_ptr<DirectionalLight> light : scene.directionalLights) {
-    installDirectionalLights(scene.viewMatrix, light, index);
-    index++;
-  }
+  // Deferred shading lights the G-buffer afterwards instead
+  if (!g_deferred) {
+    PROFILE_SCOPE("Install lights");
 
-  index = 0.0f;
-  for (std::shared_ptr<PointLight> light : scene.pointLights) {
-    installPointLights(scene.viewMatrix, light, index);
-    index++;
-  }
+    int index = 0.0f;
+    for (std::shared_ptr<DirectionalLight> light : scene.directionalLights) {
+      installDirectionalLights(scene.viewMatrix, light, index);
+      index++;
+    }
+
+    // Clustered shading bins them after the frustum is known
+    if (!g_clusters) {
+      index = 0.0f;
+      for (std::shared_ptr<PointLight> light : scene.pointLights) {
+        installPointLights(scene.viewMatrix, light, index);
+        index++;
+      }
 
-  index = 0.0f;
-  for (std::shared_ptr<SpotLight> light : scene.spotLights) {
-    installSpotLights(scene.viewMatrix, light, index);
-    index++;
+      index = 0.0f;
+      for (std::shared_ptr<SpotLight> light : scene.spotLights) {
+        installSpotLights(scene.viewMatrix, light, index);
+        index++;
+      }
+    }
   }
 
   if (scene.dissection) {
     glProgramUniform1f(g_program, glGetUniformLocation(g_program, "time"),
-    glfwGetTime());
+    g_time);
   }
 
-  float offset = 0.0f;
-
-  for(std::shared_ptr<Object> object : scene.objects) {
-
-    glUniform4fv(glGetUniformLocation(g_program, "obj_color"), 1, glm::value_ptr(object->color));
-
-    glm::mat4 mvMat = scene.viewMatrix * object->modelMatrix;
+  // copy view and perspective matrices to corresponding uniform variables;
+  // model matrices and colors come from each batch's instance buffer
+  glUniformMatrix4fv(glGetUniformLocation(g_program, "view_matrix"),
+  1, GL_FALSE, glm::value_ptr(scene.viewMatrix));
+  glUniformMatrix4fv(glGetUniformLocation(g_program, "proj_matrix"),
+  1, GL_FALSE, glm::value_ptr(scene.camera.projectionMatrix));
 
-    // build the inverse-transpose of the MV matrix, for transforming normal vectors
-    glm::mat4 invTrMat = glm::transpose(glm::inverse(mvMat));
+  g_frustum.extract(scene.camera.projectionMatrix * scene.viewMatrix);
 
-    installMaterials(object);
-
-    // copy perspective and MV matrices to corresponding uniform variables
-    // put the MV, PROJ, and Inverse-transpose(normal) matrices into the corresponding uniforms
-    glUniformMatrix4fv(glGetUniformLocation(g_program, "mv_matrix"),
-    1, GL_FALSE, glm::value_ptr(mvMat));
-    glUniformMatrix4fv(glGetUniformLocation(g_program, "proj_matrix"),
-    1, GL_FALSE, glm::value_ptr(scene.camera.projectionMatrix));
-    glUniformMatrix4fv(glGetUniformLocation(g_program, "norm_matrix"),
-    1, GL_FALSE, glm::value_ptr(invTrMat));
-
-    // associate VBO with the corresponding vertex attribute in the vertex shader
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[0]);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[1]);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[2]);
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // bind diffuse map
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, object->diffuseTextureID);
-
-    // bind specular map
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, object->specularTextureID);
-
-    // bind emission map
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, object->emissionTextureID);
-
-    // bind bump map
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, object->bumpTextureID);
+  if (g_clusters) {
+    PROFILE_SCOPE("Bin lights");
+    g_clusters->update(scene, g_frustum);
+    g_clusters->bind(g_program, g_width, g_height);
+  }
 
-    // bind depth map
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, object->depthTextureID);
+  g_cullStats = CullStats();
+  g_stateCache.reset();
+  g_materialChanges = 0;
+  g_renderQueue.clear();
 
-    // bind depth map
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, object->displacementTextureID);
+  if (!g_occlusion->empty()) {
+    PROFILE_SCOPE("Rasterize occluders");
+    g_occlusion->render(scene.camera.projectionMatrix * scene.viewMatrix);
+  }
 
-    // Draw
-    //glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
-    glDrawArrays(GL_TRIANGLES, offset, object->verticesCount);
+  {
+    PROFILE_SCOPE("Cull and sort");
+    recordDrawCommands(scene);
+    g_renderQueue.sort();
+  }
 
-    offset += object->verticesCount;
+  {
+    PROFILE_SCOPE("Submit draws");
+    PROFILE_GPU_SCOPE("Scene");
+    submitRenderQueue();
+  }
 
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[0]);
-    glDisableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[1]);
-    glDisableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo[2]);
+  if (g_deferred) {
+    PROFILE_SCOPE("Deferred lighting");
+    PROFILE_GPU_SCOPE("Lighting");
+    g_deferred->shade(scene, g_frustum, scene.fog);
   }
 
   if (sky.hasSky) {
 
+    PROFILE_SCOPE("Sky");
+    PROFILE_GPU_SCOPE("Sky");
+
     glUseProgram(skybox_program);
 
     glUniform1i(glGetUniformLocation(skybox_program, "skybox"), 0);
@@ -1057,171 +1190,391 @@ void drawGLFW(GLFWwindow *window, double currentFrame)
 
     for(std::shared_ptr<Object> object : sky.objects) {
 
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[0]);
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[1]);
-      glEnableVertexAttribArray(1);
-      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[2]);
-      glEnableVertexAttribArray(2);
-      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
       glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, object->skyboxTextureID);
 
-      glDrawArrays(GL_TRIANGLES, 0, object->verticesCount);
+      object->asset->draw();
       glDepthFunc(GL_LESS);
+    }
+  }
 
-      glDisableVertexAttribArray(0);
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[0]);
-      glDisableVertexAttribArray(1);
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[1]);
-      glDisableVertexAttribArray(2);
-      glBindBuffer(GL_ARRAY_BUFFER, s_vbo[2]);
+  if (animation) {
+    PROFILE_GPU_SCOPE("Particles");
+    for (std::shared_ptr<ParticleSystem> particleSystem : pSystems) {
+      particleSystem->OnRender(scene.camera, scene, alpha);
     }
   }
+}
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Record the frame rate and print the statistics of the last frame
+void reportFrameGLFW()
+{
+  using namespace std::chrono;
+  //////////////////////////////////////////////////////////////////////////////
+  // Record frame time
+  high_resolution_clock::time_point time = high_resolution_clock::now();
+  g_frameRate = duration_cast<duration<float>>(time - g_frameTime).count();
+  g_frameTime = time;
+  g_framesPerSecond = 1.f / (g_delay + g_frameRate);
+  printf("FPS: %6.2f  drawn: %zu  culled: %zu  occluded: %zu  binds: %zu (%zu skipped)  materials: %zu  overruns: %zu\n",
+    g_framesPerSecond, g_cullStats.drawn, g_cullStats.culled, g_cullStats.occluded,
+    g_stateCache.textureBinds, g_stateCache.skippedBinds, g_materialChanges,
+    g_scheduler.overruns());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Advance the particle simulation by one fixed tick
+/// @param deltaTime Tick length in seconds
+void simulateGLFW(float deltaTime)
+{
   if (animation) {
 
+  // Emission draws from the shared random engine, so it stays on this thread
   for (std::shared_ptr<ParticleSystem> particleSystem : pSystems) {
-    if (particleSystem->hasDiscGenerator)
-    {
-        particleSystem->DiscGenerator(particle, particleSystem->discGen.center,
-          particleSystem->discGen.radius, particleSystem->discGen.normal);
+    particleSystem->Emit(particle, particleSystem->Emission(deltaTime));
+  }
+
+  // Systems update and bounce off the scene side by side, and each splits its
+  // pool into chunks on the same workers; the call returns once all of them
+  // are done
+  ThreadPool::shared().parallelFor(pSystems.size(), 1,
+    [deltaTime](size_t _begin, size_t _end) {
+      for (size_t i = _begin; i < _end; ++i) {
+        ParticleSystem& system = *pSystems[i];
+        system.OnUpdate(deltaTime);
+        if (system.collidesWithScene) {
+          g_sceneBVH.collide(ThreadPool::shared(), system.m_ParticlePool,
+            system.bounce, system.friction);
+        }
+      }
+    });
+
+  }
+
+  g_particleGrid.collide(pSystems);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Run frames until the window closes
+///
+/// Each frame runs the simulation ticks that are due, then renders with the
+/// remainder as interpolation factor. Between frames the thread sleeps in
+/// glfwWaitEventsTimeout until the next frame is due, waking early only to
+/// handle input.
+void appLoop(GLFWwindow *window)
+{
+  while (!glfwWindowShouldClose(window))
+  {
+    g_time = glfwGetTime();
+    int steps = g_scheduler.beginFrame(g_time);
+    for (int i = 0; i < steps; ++i) {
+      simulateGLFW(g_scheduler.tick());
     }
 
-    if (particleSystem->hasDirectedGenerator)
+    updateLoading();
+    processInputGLFW(window);
     {
-      particleSystem->DirectedGenerator(particle, particleSystem->dirGen.position,
-        particleSystem->dirGen.direction);
+      PROFILE_SCOPE("Frame");
+      drawGLFW(g_scheduler.alpha());
     }
-
-    if (particleSystem->hasPointGenerator) {
-      particleSystem->PointGenerator(particle, particleSystem->pGen.position);
+    glfwSwapBuffers(window);
+    g_scheduler.endFrame(glfwGetTime());
+    Profiler::collectGpu();
+    reportFrameGLFW();
+
+    glfwPollEvents();
+    double wait;
+    while ((wait = g_scheduler.waitTime(glfwGetTime())) > 0.0 &&
+           !glfwWindowShouldClose(window)) {
+      glfwWaitEventsTimeout(wait);
     }
+  }
+}
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Settings of a headless benchmark run
+struct HeadlessOptions {
+  std::string scene;       ///< Scene file
+  int frames{600};         ///< Frames measured
+  int warmup{30};          ///< Frames rendered first and not measured
+  int width{1360};
+  int height{768};
+  std::string path;        ///< Camera path file; a full turn if empty
+  std::string output;      ///< PPM file for the last frame, if set
+  bool trace{false};       ///< Record the profiler and write TRACE_FILE
+  bool software{false};    ///< Rasterize on the CPU, without a GL context
+};
 
-    for (struct ParticleSystem::Rotator r : particleSystem->rotatorSet) {
-      particleSystem->Rotator(r.position, deltaTime);
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Read the headless options following the scene file
+/// @param _argc Count of command line arguments
+/// @param _argv Command line arguments
+/// @param _options Receives the options
+/// @return True if --headless or --software was given
+///
+/// --trace also applies to the interactive GLFW path, which then records from
+/// before the scene is parsed and writes TRACE_FILE on exit.
+bool parseHeadlessOptions(int _argc, char **_argv, HeadlessOptions& _options)
+{
+  bool headless = false;
+  _options.scene = _argv[1];
+
+  for (int i = 2; i < _argc; ++i) {
+    std::string arg = _argv[i];
+    bool hasValue = i + 1 < _argc;
+
+    if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--frames" && hasValue) {
+      _options.frames = std::max(1, std::atoi(_argv[++i]));
+    } else if (arg == "--warmup" && hasValue) {
+      _options.warmup = std::max(0, std::atoi(_argv[++i]));
+    } else if (arg == "--size" && hasValue) {
+      if (std::sscanf(_argv[++i], "%dx%d", &_options.width, &_options.height) != 2 ||
+          _options.width <= 0 || _options.height <= 0) {
+        std::cout << "Ignoring --size " << _argv[i] << ", expected WxH" << std::endl;
+        _options.width = 1360;
+        _options.height = 768;
+      }
+    } else if (arg == "--path" && hasValue) {
+      _options.path = _argv[++i];
+    } else if (arg == "--output" && hasValue) {
+      _options.output = _argv[++i];
+    } else if (arg == "--trace") {
+      _options.trace = true;
+    } else if (arg == "--software") {
+      headless = true;
+      _options.software = true;
+    } else {
+      std::cout << "Ignoring argument " << arg << std::endl;
     }
+  }
 
-    for (struct ParticleSystem::Attractor a : particleSystem->attractorSet) {
-      particleSystem->Attractor(a.position, a.mass, deltaTime);
-    }
+  return headless;
+}
 
-    for (struct ParticleSystem::Repulsor r : particleSystem->repulsorSet) {
-      particleSystem->Repulsor(r.position, r.mass, deltaTime);
-    }
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Render a scene offscreen along a camera path and report frame times
+/// @param _options Run settings
+/// @return Process exit status
+///
+/// Every frame advances the animation by exactly one frame period, whatever
+/// the time it took, so runs of the same scene simulate and render the same
+/// frames. Assets are fully loaded before the first frame. CPU time covers
+/// simulation and command submission; GPU time comes from elapsed time
+/// queries read back a few frames late. Warm-up frames are left out of both.
+int headlessLoop(const HeadlessOptions& _options)
+{
+  using namespace std::chrono;
+
+  // Declared first so it is destroyed after the GL objects below
+  HeadlessContext context;
+  if (!context.create(_options.width, _options.height)) {
+    return EXIT_FAILURE;
+  }
+  g_width = _options.width;
+  g_height = _options.height;
+
+  Profiler::setEnabled(_options.trace);
+
+  initializeGLFW(_options.scene);
+
+  while (!g_loader->idle()) {
+    updateLoading();
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+
+  const double period = 1.0 / MAX_FPS;
+  const int total = _options.warmup + _options.frames;
+
+  CameraPath path;
+  if (_options.path.empty()) {
+    path.turn(scene.camera, float(total * period));
+  } else if (!path.load(_options.path)) {
+    return EXIT_FAILURE;
+  }
+
+  FrameReadback readback;
+  readback.initialize(_options.width, _options.height);
+  GpuFrameTimer gpuTimer;
+  std::vector<double> cpuTimes;
+  std::vector<double> gpuTimes;
+
+  for (int frame = 0; frame < total; ++frame) {
+
+    steady_clock::time_point start = steady_clock::now();
 
-    for (struct ParticleSystem::Wind w : particleSystem->windSet) {
-      particleSystem->Wind(w.magnitude, deltaTime);
+    g_time = frame * period;
+    int steps = g_scheduler.beginFrame(g_time);
+    for (int i = 0; i < steps; ++i) {
+      simulateGLFW(g_scheduler.tick());
     }
 
-    if (particleSystem->hasGravity) {
-      particleSystem->Gravity(deltaTime);
+    path.apply(float(g_time), scene.camera);
+
+    gpuTimer.begin();
+    {
+      PROFILE_SCOPE("Frame");
+      drawGLFW(g_scheduler.alpha());
     }
-  }
+    gpuTimer.end();
+    readback.capture();
 
-    for (std::shared_ptr<ParticleSystem> particleSystem : pSystems) {
-       particleSystem->OnUpdate(deltaTime);
-	     particleSystem->OnRender(scene.camera, scene);
+    double cpu = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    if (frame >= _options.warmup) {
+      cpuTimes.push_back(cpu);
     }
 
+    Profiler::collectGpu();
+    readback.collect(false);
+    gpuTimer.collect(false, gpuTimes);
   }
 
-  //////////////////////////////////////////////////////////////////////////////
-  // Record frame time
-  high_resolution_clock::time_point time = high_resolution_clock::now();
-  g_frameRate = duration_cast<duration<float>>(time - g_frameTime).count();
-  g_frameTime = time;
-  g_framesPerSecond = 1.f / (g_delay + g_frameRate);
-  printf("FPS: %6.2f\n", g_framesPerSecond);
+  readback.collect(true);
+  gpuTimer.collect(true, gpuTimes);
+  gpuTimes.erase(gpuTimes.begin(), gpuTimes.begin() +
+    std::min<size_t>(_options.warmup, gpuTimes.size()));
+
+  std::cout << "Benchmark: " << _options.scene << ", " << total << " frames ("
+    << _options.warmup << " warm-up), " << readback.framesRead()
+    << " read back" << std::endl;
+  FrameStats::compute(cpuTimes).report(std::cout, "CPU");
+  FrameStats::compute(gpuTimes).report(std::cout, "GPU");
+
+  if (!_options.output.empty() && !readback.writePPM(_options.output)) {
+    std::cout << "Could not write " << _options.output << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (_options.trace) {
+    Profiler::dump(TRACE_FILE);
+  }
+  return EXIT_SUCCESS;
 }
 
-void CollisionDetection()
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Render a scene on the CPU along a camera path and report frame times
+/// @param _options Run settings, as for headlessLoop
+/// @return Process exit status
+///
+/// Needs no GL context: meshes and materials are loaded without upload and
+/// every frame is drawn by the software rasterizer into g_frame. The sky box,
+/// particles and simulation are left out, so CPU time covers culling and
+/// rasterization only.
+int softwareLoop(const HeadlessOptions& _options)
 {
-  if (pSystems.size() > 1) {
+  using namespace std::chrono;
 
-    for (int i = 0; i < pSystems.size()-1; i++) {
+  g_width = _options.width;
+  g_height = _options.height;
+  g_frame = std::make_unique<glm::vec4[]>(g_width*g_height);
 
-      for (auto& p1 : pSystems[i]->m_ParticlePool) {
-        for (auto& p2 : pSystems[i+1]->m_ParticlePool) {
-          if (pSystems[i]->CheckCollision(p1, p2)) {
+  Profiler::setEnabled(_options.trace);
 
-            glm::vec3 v1(0.0f);
-            glm::vec3 v2(0.0f);
+  std::vector<std::shared_ptr<Object>> objects;
+  {
+    PROFILE_SCOPE("Parse scene");
 
-            v1 = ((p1.SizeBegin - p2.SizeBegin) * p1.Velocity
-            / (p1.SizeBegin + p2.SizeBegin)) +
-            ((2 * p2.SizeBegin) * p2.Velocity /
-            (p1.SizeBegin + p2.SizeBegin));
+    g_loader.reset(new AssetLoader(ThreadPool::shared(), g_meshes, g_textures,
+      "Objects/", false));
+    g_occlusion.reset(new OcclusionCuller(ThreadPool::shared()));
 
-            v2 = (-(p1.SizeBegin - p2.SizeBegin) * p2.Velocity
-            / (p1.SizeBegin + p2.SizeBegin)) +
-            ((2 * p2.SizeBegin) * p1.Velocity /
-            (p1.SizeBegin + p2.SizeBegin));
+    parseSceneGLFW(_options.scene);
 
-            p1.Velocity = v1;
-            p2.Velocity = v2;
-          }
+    while (!g_loader->idle()) {
+      std::vector<std::shared_ptr<Object>> ready;
+      g_loader->pump(UPLOAD_BUDGET, ready);
+      for (std::shared_ptr<Object> object : ready) {
+        if (object->isSkyBox) {
+          continue;
         }
+        object->worldBounds = object->asset->bounds.transformed(object->modelMatrix);
+        object->worldSphere = object->asset->sphere.transformed(object->modelMatrix);
+        objects.push_back(object);
       }
-     }
-
-     for (auto& p1 : pSystems[0]->m_ParticlePool) {
-       for (auto& p2 : pSystems[pSystems.size()-1]->m_ParticlePool) {
-         if (pSystems[0]->CheckCollision(p1, p2)) {
-
-           glm::vec3 v1(0.0f);
-           glm::vec3 v2(0.0f);
-
-           v1 = ((p1.SizeBegin - p2.SizeBegin) * p1.Velocity
-           / (p1.SizeBegin + p2.SizeBegin)) +
-           ((2 * p2.SizeBegin) * p2.Velocity /
-           (p1.SizeBegin + p2.SizeBegin));
-
-           v2 = (-(p1.SizeBegin - p2.SizeBegin) * p2.Velocity
-           / (p1.SizeBegin + p2.SizeBegin)) +
-           ((2 * p2.SizeBegin) * p1.Velocity /
-           (p1.SizeBegin + p2.SizeBegin));
-
-           p1.Velocity = v1;
-           p2.Velocity = v2;
-         }
-       }
-     }
+      std::this_thread::sleep_for(milliseconds(1));
     }
-}
+    g_occlusion->setOccluders(objects);
+  }
 
-void appLoop(GLFWwindow *window)
-{
-  const double maxFPS = 35.0;
-  const double maxPeriod = 1.0 / maxFPS;
-  double lastTime = 0.0;
+  const double period = 1.0 / MAX_FPS;
+  const int total = _options.warmup + _options.frames;
 
-  while (!glfwWindowShouldClose(window))
-  {
-    double time = glfwGetTime();
-    double deltaTime = time - lastTime;
-
-    if( deltaTime >= maxPeriod ) {
-        lastTime = time;
-        drawGLFW(window, glfwGetTime());
-        CollisionDetection();
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+  CameraPath path;
+  if (_options.path.empty()) {
+    path.turn(scene.camera, float(total * period));
+  } else if (!path.load(_options.path)) {
+    return EXIT_FAILURE;
+  }
+
+  SoftwareRasterizer rasterizer(ThreadPool::shared());
+  std::vector<double> cpuTimes;
+
+  for (int frame = 0; frame < total; ++frame) {
+
+    steady_clock::time_point start = steady_clock::now();
+
+    g_time = frame * period;
+    path.apply(float(g_time), scene.camera);
+
+    {
+      PROFILE_SCOPE("Frame");
+
+      scene.viewMatrix = glm::lookAt(
+        scene.camera.position,
+        scene.camera.position + scene.camera.direction(),
+        scene.camera.up());
+
+      if (!g_occlusion->empty()) {
+        PROFILE_SCOPE("Rasterize occluders");
+        g_occlusion->render(scene.camera.projectionMatrix * scene.viewMatrix);
+      }
+
+      rasterizer.render(scene, objects, g_occlusion.get(), g_frame.get(),
+        g_width, g_height);
+    }
+
+    double cpu = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    if (frame >= _options.warmup) {
+      cpuTimes.push_back(cpu);
     }
   }
 
+  const CullStats& stats = rasterizer.stats();
+  std::cout << "Software: " << _options.scene << ", " << total << " frames ("
+    << _options.warmup << " warm-up), last drew " << stats.drawn
+    << " objects, " << rasterizer.triangles() << " triangles, culled "
+    << stats.culled << ", occluded " << stats.occluded << std::endl;
+  FrameStats::compute(cpuTimes).report(std::cout, "CPU");
+
+  if (!_options.output.empty() &&
+      !SoftwareRasterizer::writePPM(_options.output, g_frame.get(), g_width, g_height)) {
+    std::cout << "Could not write " << _options.output << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (_options.trace) {
+    Profiler::dump(TRACE_FILE);
+  }
+  return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start or stop recording profiler events
+void toggleProfiler()
+{
+  Profiler::setEnabled(!Profiler::enabled());
+  std::cout << "Profiler: " << (Profiler::enabled() ? "recording" : "stopped")
+    << ", press P to write " << TRACE_FILE << std::endl;
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, GLFW_TRUE);
+  if (key == GLFW_KEY_T && action == GLFW_PRESS)
+    toggleProfiler();
+  if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    Profiler::dump(TRACE_FILE);
 }
 
 void error_callback(int error, const char *description)
@@ -1234,6 +1587,8 @@ void error_callback(int error, const char *description)
 Scene
 rayTracerParser(const std::string& _filename) {
 
+  PROFILE_SCOPE("Parse scene");
+
   float theta = (float) M_PI / 4.0f;
   Material mat = Material("mat");
   Material shiny = Material("shiny");
@@ -1364,7 +1719,10 @@ draw() {
 
   //////////////////////////////////////////////////////////////////////////////
   // Draw
-  scene.rayTracer(g_frame, g_width, g_height);
+  {
+    PROFILE_SCOPE("Ray trace");
+    scene.rayTracer(g_frame, g_width, g_height);
+  }
   glDrawPixels(g_width, g_height, GL_RGBA, GL_FLOAT, g_frame.get());
 
   //////////////////////////////////////////////////////////////////////////////
@@ -1465,6 +1823,12 @@ normalKeyPressed(unsigned char key, int x, int y)
     case 'd':
     scene.camera.position += scene.camera.right() * 5;
     break;
+    case 't':
+    toggleProfiler();
+    break;
+    case 'p':
+    Profiler::dump(TRACE_FILE);
+    break;
     default:
       break;
   }
@@ -1501,6 +1865,8 @@ timer(int _v) {
 /// @return Application success status
 int main(int _argc, char **_argv)
 {
+  Profiler::setThreadName("Main");
+
   bool rayTraceFile = fileForRaytrace(_argv[1]);
 
   if (rayTraceFile) {
@@ -1537,6 +1903,16 @@ int main(int _argc, char **_argv)
 
   else {
 
+    HeadlessOptions options;
+    if (parseHeadlessOptions(_argc, _argv, options)) {
+      if (options.software) {
+        std::cout << "Running the software rasterizer\n" << std::endl;
+        return softwareLoop(options);
+      }
+      std::cout << "Running headless\n" << std::endl;
+      return headlessLoop(options);
+    }
+
     glfwSetErrorCallback(error_callback);
     std::cout << "Initializing GLFW\n" << std::endl;
     if (!glfwInit())
@@ -1572,7 +1948,11 @@ int main(int _argc, char **_argv)
 #endif
     glfwSwapInterval(1);
 
-    initializeGLFW(window, _argv[1]);
+    // --trace records from the start, so parsing and the first asset loads
+    // are in the trace too; T toggles recording later either way
+    Profiler::setEnabled(options.trace);
+
+    initializeGLFW(_argv[1]);
 
     //////////////////////////////////////////////////////////////////////////////
     // Assign callback functions
@@ -1580,10 +1960,13 @@ int main(int _argc, char **_argv)
     glfwSetKeyCallback(window, key_callback);
     glfwSetFramebufferSizeCallback(window, resizeGLFW);
 
-    // application loop, should be own method
-    // need to add frame limiting stuff like in slides
+    // application loop, paced by g_scheduler
     appLoop(window);
 
+    if (options.trace) {
+      Profiler::dump(TRACE_FILE);
+    }
+
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -0,0 +1,47 @@
+#ifndef __MAPPEDFILE_CPP__
+#define __MAPPEDFILE_CPP__
+
+#include "mappedfile.h"
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Map a file into memory
+/// @param _path Filename
+/// @return Mapping, or null if the file cannot be opened or is empty
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& _path) {
+
+  int fd = ::open(_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  file->m_data = static_cast<const unsigned char*>(data);
+  file->m_size = st.st_size;
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (m_data) {
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+  }
+}
+
+#endif
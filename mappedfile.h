@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Read-only memory-mapped files
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+// STL
+#include <cstddef>
+#include <memory>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Read-only memory mapping of a whole file
+////////////////////////////////////////////////////////////////////////////////
+class MappedFile {
+
+  public:
+
+    static std::shared_ptr<MappedFile> open(const std::string& _path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+
+    MappedFile() {}
+
+    const unsigned char* m_data{nullptr};
+    size_t m_size{0};
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <memory>
 #include <math.h>
 #include <fstream>
+#include <sstream>
 
 #include "material.h"
 
@@ -54,4 +55,111 @@ Material::Material() {
 
 Material::~Material() {}
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Parse an mtl file into a material
+/// @param _filename Filename
+/// @param material Material receiving coefficients and texture maps
+void
+setupMaterialProperties(const std::string& _filename, Material& material) {
+
+  std::ifstream ifs;
+  ifs.open(_filename);
+
+  if (!ifs) {
+        std::cout << "Unable to open the material file";
+  }
+
+  std::string line;
+
+  while(ifs) {
+
+    getline(ifs, line);
+    std::istringstream iss(line);
+
+    std::string tag;
+    iss >> tag;
+
+    if (tag.compare("Ka") == 0) {
+
+      iss >> material.ambient_coefficient[0] >>
+      material.ambient_coefficient[1] >>
+      material.ambient_coefficient[2];
+
+    } else if (tag.compare("Kd") == 0) {
+
+      iss >> material.diffuse_coefficient[0] >>
+      material.diffuse_coefficient[1] >>
+      material.diffuse_coefficient[2];
+
+    } else if (tag.compare("Ks") == 0) {
+
+      iss >> material.specular_coefficient[0] >>
+      material.specular_coefficient[1] >>
+      material.specular_coefficient[2];
+
+    } else if (tag.compare("Ns") == 0) {
+
+      iss >> material.shininess;
+
+    } else if (tag.compare("map_Kd") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.diffuseTexture = "Objects/" + textureFile;
+      material.hasDiffuseTexture = true;
+
+    } else if (tag.compare("map_Ks") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.specularTexture = "Objects/" + textureFile;
+      material.hasSpecularTexture = true;
+
+    } else if (tag.compare("map_Ke") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.emissionTexture = "Objects/" + textureFile;
+      material.hasEmissionTexture = true;
+
+    } else if (tag.compare("map_Bump") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.bumpTexture = "Objects/" + textureFile;
+      material.hasBumpTexture = true;
+
+    } else if (tag.compare("map_Depth") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.depthTexture = "Objects/" + textureFile;
+      material.hasDepthTexture = true;
+
+    } else if (tag.compare("map_Disp") == 0) {
+
+      std::string textureFile;
+
+      iss >> textureFile;
+
+      material.displacementTexture = "Objects/" + textureFile;
+      material.hasDisplacementTexture = true;
+
+    } else {}
+
+  }
+
+  ifs.close();
+}
+
 #endif
@@ -7,6 +7,7 @@
 #include <memory>
 #include <math.h>
 #include <fstream>
+#include <string>
 
 
 class Material {
@@ -39,4 +40,6 @@ class Material {
 
 };
 
+void setupMaterialProperties(const std::string& _filename, Material& material);
+
 #endif
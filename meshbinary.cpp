@@ -0,0 +1,256 @@
+#ifndef __MESHBINARY_CPP__
+#define __MESHBINARY_CPP__
+
+#include "meshbinary.h"
+#include "hash.h"
+
+// STL
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+// POSIX
+#include <sys/stat.h>
+
+namespace {
+
+const char MAGIC[4] = {'S', 'M', 'S', 'H'};
+const uint32_t VERSION = 1;
+
+// The vertex array is written and mapped as is
+static_assert(sizeof(vertex) == 8 * sizeof(float), "vertex must be unpadded");
+static_assert(sizeof(MeshBinaryHeader) % 8 == 0, "header must keep alignment");
+
+size_t padded(size_t _bytes) {
+  return (_bytes + 7) & ~size_t(7);
+}
+
+bool hashFile(const std::string& _path, uint64_t& _hash) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(_path);
+  if (!file) {
+    return false;
+  }
+  _hash = hashBytes(file->data(), file->size());
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Record a new OBJ modification time in a binary whose contents
+///        still match, so the OBJ is not hashed again on the next load
+///
+/// Only the time is overwritten, in place. A failure is harmless: the next
+/// load hashes again.
+void touchMeshBinary(const std::string& _objPath, int64_t _mtime) {
+  std::fstream fs(meshBinaryPath(_objPath),
+                  std::ios::binary | std::ios::in | std::ios::out);
+  if (fs) {
+    fs.seekp(offsetof(MeshBinaryHeader, sourceMtime));
+    fs.write(reinterpret_cast<const char*>(&_mtime), sizeof(_mtime));
+  }
+}
+
+struct VertexHash {
+  size_t operator()(const vertex& _v) const {
+    return hashBytes(reinterpret_cast<const unsigned char*>(&_v), sizeof(vertex));
+  }
+};
+
+struct VertexEqual {
+  bool operator()(const vertex& _a, const vertex& _b) const {
+    return std::memcmp(&_a, &_b, sizeof(vertex)) == 0;
+  }
+};
+
+}
+
+std::string meshBinaryPath(const std::string& _objPath) {
+  return _objPath + ".bin";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Merge identical vertices of a triangle list and index them
+/// @param _mesh Unindexed mesh, as parsed from OBJ
+/// @return Indexed mesh drawing the same triangles
+mesh indexMesh(const mesh& _mesh) {
+
+  mesh indexed;
+  indexed.mtlFile = _mesh.mtlFile;
+
+  const vertex* vertices = _mesh.vertexData();
+  const size_t count = _mesh.vertexCount();
+
+  std::unordered_map<vertex, uint32_t, VertexHash, VertexEqual> ids;
+  ids.reserve(count);
+  indexed.m_indices.reserve(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    auto it = ids.find(vertices[i]);
+    if (it == ids.end()) {
+      it = ids.emplace(vertices[i], uint32_t(indexed.m_vertices.size())).first;
+      indexed.m_vertices.push_back(vertices[i]);
+    }
+    indexed.m_indices.push_back(it->second);
+  }
+
+  return indexed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Load the binary compiled from an OBJ file, if it is up to date
+/// @param _objPath OBJ filename
+/// @param _mesh Receives arrays pointing into the mapped file
+/// @param _box Receives the stored bounding box
+/// @param _sphere Receives the stored bounding sphere
+/// @return False if there is no binary or the OBJ changed since it was written
+///
+/// A binary is current when the OBJ has the recorded size and modification
+/// time. If only the time differs, e.g. after a fresh checkout, the contents
+/// are hashed and compared instead, and on a match the new time is recorded.
+bool readMeshBinary(const std::string& _objPath, mesh& _mesh,
+                    AABB& _box, BoundingSphere& _sphere) {
+
+  struct stat source;
+  if (stat(_objPath.c_str(), &source) != 0) {
+    return false;
+  }
+
+  std::shared_ptr<MappedFile> file = MappedFile::open(meshBinaryPath(_objPath));
+  if (!file || file->size() < sizeof(MeshBinaryHeader)) {
+    return false;
+  }
+
+  const MeshBinaryHeader& header =
+    *reinterpret_cast<const MeshBinaryHeader*>(file->data());
+
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION ||
+      header.sourceSize != uint64_t(source.st_size)) {
+    return false;
+  }
+
+  size_t mtlOffset = sizeof(MeshBinaryHeader);
+  size_t vertexOffset = mtlOffset + padded(header.mtlLength);
+  size_t indexOffset = vertexOffset + size_t(header.vertexCount) * sizeof(vertex);
+  size_t end = indexOffset + size_t(header.indexCount) * sizeof(uint32_t);
+  if (file->size() < end) {
+    return false;
+  }
+
+  if (header.sourceMtime != int64_t(source.st_mtime)) {
+    uint64_t hash;
+    if (!hashFile(_objPath, hash) || hash != header.sourceHash) {
+      return false;
+    }
+    touchMeshBinary(_objPath, source.st_mtime);
+  }
+
+  _mesh = mesh();
+  _mesh.mtlFile.assign(reinterpret_cast<const char*>(file->data() + mtlOffset),
+    header.mtlLength);
+  _mesh.m_mappedVertices =
+    reinterpret_cast<const vertex*>(file->data() + vertexOffset);
+  _mesh.m_mappedVertexCount = header.vertexCount;
+  _mesh.m_mappedIndices =
+    reinterpret_cast<const uint32_t*>(file->data() + indexOffset);
+  _mesh.m_mappedIndexCount = header.indexCount;
+  _mesh.m_mapping = file;
+
+  _box.min = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+  _box.max = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+  _sphere.center = glm::vec3(header.sphereCenter[0], header.sphereCenter[1],
+    header.sphereCenter[2]);
+  _sphere.radius = header.sphereRadius;
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Write the binary for an OBJ file next to it
+/// @param _objPath OBJ filename the mesh was parsed from
+/// @param _mesh Mesh to store, normally indexed
+/// @param _box Bounding box to store
+/// @param _sphere Bounding sphere to store
+/// @return False if the OBJ or the output cannot be accessed
+///
+/// The file is written under a temporary name and renamed into place, so a
+/// reader never sees a partial file.
+bool writeMeshBinary(const std::string& _objPath, const mesh& _mesh,
+                     const AABB& _box, const BoundingSphere& _sphere) {
+
+  struct stat source;
+  MeshBinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+
+  if (stat(_objPath.c_str(), &source) != 0 ||
+      !hashFile(_objPath, header.sourceHash)) {
+    return false;
+  }
+
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.sourceSize = source.st_size;
+  header.sourceMtime = source.st_mtime;
+  header.vertexCount = _mesh.vertexCount();
+  header.indexCount = _mesh.indexCount();
+  for (int i = 0; i < 3; ++i) {
+    header.boundsMin[i] = _box.min[i];
+    header.boundsMax[i] = _box.max[i];
+    header.sphereCenter[i] = _sphere.center[i];
+  }
+  header.sphereRadius = _sphere.radius;
+  header.mtlLength = _mesh.mtlFile.size();
+
+  std::string path = meshBinaryPath(_objPath);
+  std::string temporary = path + ".tmp";
+
+  std::ofstream ofs(temporary, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    return false;
+  }
+
+  const char zeros[8] = {0};
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(_mesh.mtlFile.data(), _mesh.mtlFile.size());
+  ofs.write(zeros, padded(header.mtlLength) - header.mtlLength);
+  ofs.write(reinterpret_cast<const char*>(_mesh.vertexData()),
+    _mesh.vertexCount() * sizeof(vertex));
+  ofs.write(reinterpret_cast<const char*>(_mesh.indexData()),
+    _mesh.indexCount() * sizeof(uint32_t));
+  ofs.close();
+
+  if (!ofs || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Load a mesh through its binary, compiling the binary if needed
+/// @param _objPath OBJ filename
+/// @param _box Receives the mesh bounding box
+/// @param _sphere Receives the mesh bounding sphere
+/// @return Indexed mesh, mapped from the binary when one is current
+mesh loadMesh(const std::string& _objPath, AABB& _box, BoundingSphere& _sphere) {
+
+  mesh result;
+  if (readMeshBinary(_objPath, result, _box, _sphere)) {
+    return result;
+  }
+
+  result = indexMesh(objParser(_objPath));
+  computeBounds(result, _box, _sphere);
+
+  if (result.vertexCount() > 0 &&
+      !writeMeshBinary(_objPath, result, _box, _sphere)) {
+    std::cout << "Could not write mesh binary for " << _objPath << std::endl;
+  }
+
+  return result;
+}
+
+#endif
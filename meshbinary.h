@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Binary mesh files compiled from OBJ, loaded by memory mapping
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __MESHBINARY_H__
+#define __MESHBINARY_H__
+
+// STL
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "objParser.h"
+#include "frustum.h"
+#include "mappedfile.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Fixed-size start of a binary mesh file
+///
+/// The header is followed by the mtl filename (padded to 8 bytes), the
+/// interleaved vertices exactly as uploaded to GL, and 32-bit triangle
+/// indices. Numbers are stored in native byte order; a file written on a
+/// machine of the other endianness fails the version check and is rebuilt.
+////////////////////////////////////////////////////////////////////////////////
+struct MeshBinaryHeader {
+  char magic[4];          ///< "SMSH"
+  uint32_t version;
+  uint64_t sourceSize;    ///< Size of the OBJ in bytes
+  int64_t sourceMtime;    ///< Modification time of the OBJ, in seconds
+  uint64_t sourceHash;    ///< FNV-1a hash of the OBJ contents
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  float boundsMin[3];
+  float boundsMax[3];
+  float sphereCenter[3];
+  float sphereRadius;
+  uint32_t mtlLength;     ///< Bytes of mtl filename, without padding
+  uint32_t reserved;
+};
+
+std::string meshBinaryPath(const std::string& _objPath);
+
+mesh indexMesh(const mesh& _mesh);
+
+bool readMeshBinary(const std::string& _objPath, mesh& _mesh,
+                    AABB& _box, BoundingSphere& _sphere);
+
+bool writeMeshBinary(const std::string& _objPath, const mesh& _mesh,
+                     const AABB& _box, const BoundingSphere& _sphere);
+
+mesh loadMesh(const std::string& _objPath, AABB& _box, BoundingSphere& _sphere);
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef __MESHCACHE_CPP__
+#define __MESHCACHE_CPP__
+
+#include "meshcache.h"
+#include "meshbinary.h"
+#include "object.h"
+#include "profiler.h"
+
+// STL
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Parse the OBJ file and optionally its material
+/// @param _directory Directory holding filename and its mtl file
+/// @param _withMaterial Also parse the mtl file named by the OBJ
+///
+/// Touches no GL state, so it may run on a worker thread.
+void MeshAsset::load(const std::string& _directory, bool _withMaterial) {
+
+  PROFILE_SCOPE("Load mesh");
+
+  data = loadMesh(_directory + filename, bounds, sphere);
+
+  if (_withMaterial) {
+    setupMaterialProperties(_directory + data.mtlFile, material);
+    hasMaterial = true;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Copy the vertices and indices to buffer objects and describe them
+///        in a VAO
+///
+/// A mesh loaded from a binary file points into the mapping, so its bytes go
+/// to GL without any intermediate copy.
+void MeshAsset::upload() {
+
+  vertexCount = data.vertexCount();
+  indexCount = data.indexCount();
+
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vertex),
+    data.vertexData(), GL_STATIC_DRAW);
+
+  if (indexCount > 0) {
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint32_t),
+      data.indexData(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  }
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  bindVertexAttributes();
+  glBindVertexArray(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Point attributes 0 (position), 1 (normal) and 2 (texture) at the
+///        vertex buffer of the currently bound VAO, and attach the indices
+void MeshAsset::bindVertexAttributes() const {
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (ebo) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  }
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex),
+    (void*)offsetof(vertex, m_p));
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex),
+    (void*)offsetof(vertex, m_n));
+
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex),
+    (void*)offsetof(vertex, m_t));
+}
+
+void MeshAsset::draw() const {
+  glBindVertexArray(vao);
+  if (indexCount > 0) {
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
+  } else {
+    glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+  }
+  glBindVertexArray(0);
+}
+
+std::shared_ptr<MeshAsset> MeshCache::find(const std::string& _filename) const {
+  auto it = m_assets.find(_filename);
+  return it == m_assets.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<MeshAsset> MeshCache::add(const std::string& _filename,
+                                          const mesh& _mesh) {
+  std::shared_ptr<MeshAsset> asset(new MeshAsset());
+  asset->filename = _filename;
+  asset->data = _mesh;
+  computeBounds(asset->data, asset->bounds, asset->sphere);
+  m_assets[_filename] = asset;
+  return asset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Register a mesh that is still being loaded
+/// @param _filename OBJ filename
+/// @return Empty asset for the loader to fill in and upload
+std::shared_ptr<MeshAsset> MeshCache::add(const std::string& _filename) {
+  std::shared_ptr<MeshAsset> asset(new MeshAsset());
+  asset->filename = _filename;
+  m_assets[_filename] = asset;
+  return asset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Build the VAO combining the mesh vertices with an instance buffer
+///        large enough for every object of the batch
+void InstanceBatch::upload() {
+
+  visible.reserve(objects.size());
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
+  asset->bindVertexAttributes();
+
+  glGenBuffers(1, &instanceVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glBufferData(GL_ARRAY_BUFFER, objects.size() * sizeof(InstanceData),
+    nullptr, GL_STREAM_DRAW);
+
+  // A mat4 attribute takes four consecutive locations, one per column
+  for (GLuint i = 0; i < 4; ++i) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+      (void*)(offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(3 + i, 1);
+  }
+
+  glEnableVertexAttribArray(7);
+  glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+    (void*)offsetof(InstanceData, color));
+  glVertexAttribDivisor(7, 1);
+
+  glBindVertexArray(0);
+}
+
+void InstanceBatch::release() {
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &instanceVBO);
+  vao = 0;
+  instanceVBO = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Upload the visible instances, orphaning last frame's storage so the
+///        driver does not wait for draws still reading it
+void InstanceBatch::stream() const {
+
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glBufferData(GL_ARRAY_BUFFER, objects.size() * sizeof(InstanceData),
+    nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, visible.size() * sizeof(InstanceData),
+    visible.data());
+}
+
+void InstanceBatch::draw() const {
+  glBindVertexArray(vao);
+  if (asset->indexCount > 0) {
+    glDrawElementsInstanced(GL_TRIANGLES, asset->indexCount, GL_UNSIGNED_INT,
+      nullptr, visible.size());
+  } else {
+    glDrawArraysInstanced(GL_TRIANGLES, 0, asset->vertexCount, visible.size());
+  }
+  glBindVertexArray(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Group objects that can be drawn together
+/// @param _objects Scene objects, in scene file order
+/// @return One batch per distinct mesh and material, in order of first use
+///
+/// Objects loaded from the same OBJ file share its material, and light source
+/// geometry ignores materials entirely, so the mesh and the light source flag
+/// are enough to decide which objects render identically.
+std::vector<InstanceBatch>
+buildInstanceBatches(const std::vector<std::shared_ptr<Object>>& _objects) {
+
+  std::vector<InstanceBatch> batches;
+
+  for (const std::shared_ptr<Object>& object : _objects) {
+    if (!object->asset) {
+      continue;
+    }
+
+    InstanceBatch* batch = nullptr;
+    for (InstanceBatch& b : batches) {
+      if (b.asset == object->asset &&
+          b.objects.front()->isLocalLightSource == object->isLocalLightSource) {
+        batch = &b;
+        break;
+      }
+    }
+
+    if (!batch) {
+      batches.emplace_back();
+      batch = &batches.back();
+      batch->asset = object->asset;
+    }
+
+    batch->objects.push_back(object);
+  }
+
+  for (InstanceBatch& batch : batches) {
+    batch.upload();
+  }
+
+  return batches;
+}
+
+#endif
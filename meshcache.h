@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Cache of parsed and uploaded meshes, and instanced draw batches
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+// STL
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "objParser.h"
+#include "material.h"
+#include "frustum.h"
+#include "renderqueue.h"
+
+class Object;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief One OBJ file, parsed and uploaded once no matter how many objects
+///        reference it.
+////////////////////////////////////////////////////////////////////////////////
+struct MeshAsset {
+
+  std::string filename;
+  mesh data;
+
+  AABB bounds;           ///< Local-space bounds of data
+  BoundingSphere sphere;
+
+  Material material = Material(); ///< Parsed from data.mtlFile on first use
+  bool hasMaterial = false;
+
+  GLuint vao{0};     ///< Vertex attributes 0-2 only, for non-instanced draws
+  GLuint vbo{0};     ///< Interleaved vertex data
+  GLuint ebo{0};     ///< Triangle indices, if the mesh is indexed
+  GLsizei vertexCount{0};
+  GLsizei indexCount{0};
+
+  void load(const std::string& _directory, bool _withMaterial);
+  void upload();
+  bool uploaded() const { return vao != 0; }
+  void bindVertexAttributes() const;
+  void draw() const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Maps OBJ filenames to their loaded mesh
+////////////////////////////////////////////////////////////////////////////////
+class MeshCache {
+
+  public:
+
+    std::shared_ptr<MeshAsset> find(const std::string& _filename) const;
+    std::shared_ptr<MeshAsset> add(const std::string& _filename, const mesh& _mesh);
+    std::shared_ptr<MeshAsset> add(const std::string& _filename);
+
+    size_t size() const { return m_assets.size(); }
+
+  private:
+
+    std::map<std::string, std::shared_ptr<MeshAsset>> m_assets;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Objects that share a mesh and a material, drawn with one instanced
+///        draw call.
+///
+/// The instance buffer is refilled every frame with only the objects that
+/// survive culling, in the order the render queue sorted them.
+////////////////////////////////////////////////////////////////////////////////
+struct InstanceBatch {
+
+  std::shared_ptr<MeshAsset> asset;
+  std::vector<std::shared_ptr<Object>> objects;
+  std::vector<InstanceData> visible;
+
+  TextureSet textures;
+  uint64_t sortKey{0};  ///< Key of the batch's draws without the depth bits
+  uint32_t textureSet{0}; ///< Interned id of textures, not truncated to its
+                          ///< key field, for the replay to compare
+  uint32_t material{0};   ///< Interned id of the material state, likewise
+
+  GLuint vao{0};
+  GLuint instanceVBO{0};
+
+  void upload();
+  void release();
+  void stream() const;
+  void draw() const;
+};
+
+std::vector<InstanceBatch>
+buildInstanceBatches(const std::vector<std::shared_ptr<Object>>& _objects);
+
+#endif
@@ -1,4 +1,7 @@
 #include "objParser.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "profiler.h"
 
 // STL
 #include <string>
@@ -6,67 +9,454 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 
 // GLM
 #include <glm/glm.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/ext.hpp>
 
+namespace {
+
+/// Smallest chunk worth handing to another thread
+const size_t MIN_CHUNK_BYTES = 256 * 1024;
+
+/// Marks an absent texture or normal index in a face corner
+const int32_t MISSING = INT32_MIN;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief One corner of a face as written in the file
+///
+/// Positive OBJ indices are absolute and stored 0-based. Negative indices are
+/// relative to the vertices read so far; since a chunk does not know how many
+/// vertices earlier chunks read, they are stored relative to the start of the
+/// chunk and flagged, and resolved once all chunks are counted.
+////////////////////////////////////////////////////////////////////////////////
+struct Corner {
+  int32_t p, t, n;
+  uint8_t relative; ///< Bit 0, 1, 2 set when p, t, n are chunk-relative
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Everything parsed from one chunk of the file
+////////////////////////////////////////////////////////////////////////////////
+struct Chunk {
+  const char* begin;
+  const char* end;
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> textures;
+  std::vector<glm::vec3> normals;
+  std::vector<Corner> corners;     ///< Three per triangle, n-gons fanned
+  std::string mtlFile;
+
+  // Elements of each kind in all earlier chunks
+  size_t positionBase{0};
+  size_t textureBase{0};
+  size_t normalBase{0};
+
+  std::vector<vertex> vertices;    ///< Output triangles of this chunk
+  size_t vertexBase{0};
+};
+
+const double POW10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isBlank(char _c) {
+  return _c == ' ' || _c == '\t' || _c == '\r';
+}
+
+inline const char* skipBlanks(const char* _p, const char* _end) {
+  while (_p < _end && isBlank(*_p)) {
+    ++_p;
+  }
+  return _p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Parse a decimal floating point number, in the manner of from_chars
+/// @param _p Start of the number
+/// @param _end End of the line
+/// @param _value Receives the number; untouched if none is found
+/// @return Position after the number
+///
+/// Up to 19 significant digits are accumulated exactly in an integer and
+/// scaled by one power of ten, which is exact for the numbers exporters write.
+inline const char* parseFloat(const char* _p, const char* _end, float& _value) {
+
+  _p = skipBlanks(_p, _end);
+
+  bool negative = false;
+  if (_p < _end && (*_p == '-' || *_p == '+')) {
+    negative = *_p == '-';
+    ++_p;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+
+  for (; _p < _end && unsigned(*_p - '0') < 10; ++_p, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*_p - '0');
+      digits += mantissa != 0;
+    } else {
+      exponent++;
+    }
+  }
+
+  if (_p < _end && *_p == '.') {
+    for (++_p; _p < _end && unsigned(*_p - '0') < 10; ++_p, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*_p - '0');
+        digits += mantissa != 0;
+        exponent--;
+      }
+    }
+  }
+
+  if (!any) {
+    return _p;
+  }
+
+  if (_p < _end && (*_p == 'e' || *_p == 'E')) {
+    const char* q = _p + 1;
+    bool negativeExponent = false;
+    if (q < _end && (*q == '-' || *q == '+')) {
+      negativeExponent = *q == '-';
+      ++q;
+    }
+    if (q < _end && unsigned(*q - '0') < 10) {
+      int e = 0;
+      for (; q < _end && unsigned(*q - '0') < 10; ++q) {
+        e = std::min(e * 10 + (*q - '0'), 1000);
+      }
+      exponent += negativeExponent ? -e : e;
+      _p = q;
+    }
+  }
+
+  double value = double(mantissa);
+  while (exponent > 22) {
+    value *= 1e22;
+    exponent -= 22;
+  }
+  while (exponent < -22) {
+    value /= 1e22;
+    exponent += 22;
+  }
+  value = exponent < 0 ? value / POW10[-exponent] : value * POW10[exponent];
+
+  _value = float(negative ? -value : value);
+  return _p;
+}
+
+inline const char* parseInt(const char* _p, const char* _end, int32_t& _value,
+                            bool& _found) {
+  bool negative = false;
+  if (_p < _end && (*_p == '-' || *_p == '+')) {
+    negative = *_p == '-';
+    ++_p;
+  }
+  int64_t value = 0;
+  _found = false;
+  for (; _p < _end && unsigned(*_p - '0') < 10; ++_p) {
+    value = std::min<int64_t>(value * 10 + (*_p - '0'), INT32_MAX);
+    _found = true;
+  }
+  _value = int32_t(negative ? -value : value);
+  return _p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Convert an OBJ index to the corner encoding
+/// @param _index Index as written, 1-based or negative
+/// @param _count Elements of its kind read so far in the chunk
+/// @param _relative Set when the result is relative to the chunk start
+inline int32_t encodeIndex(int32_t _index, size_t _count, bool& _relative) {
+  _relative = _index < 0;
+  return _index < 0 ? int32_t(_count) + _index : _index - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Parse one face corner: v, v/t, v//n or v/t/n
+inline const char* parseCorner(const char* _p, const char* _end,
+                               const Chunk& _chunk, Corner& _corner) {
+
+  int32_t index;
+  bool found, relative;
+
+  _corner.t = _corner.n = MISSING;
+  _corner.relative = 0;
+
+  _p = parseInt(_p, _end, index, found);
+  if (!found) {
+    _corner.p = MISSING;
+    return _p;
+  }
+  _corner.p = encodeIndex(index, _chunk.positions.size(), relative);
+  _corner.relative |= relative;
+
+  if (_p < _end && *_p == '/') {
+    _p = parseInt(_p + 1, _end, index, found);
+    if (found) {
+      _corner.t = encodeIndex(index, _chunk.textures.size(), relative);
+      _corner.relative |= relative << 1;
+    }
+    if (_p < _end && *_p == '/') {
+      _p = parseInt(_p + 1, _end, index, found);
+      if (found) {
+        _corner.n = encodeIndex(index, _chunk.normals.size(), relative);
+        _corner.relative |= relative << 2;
+      }
+    }
+  }
+
+  // Skip anything unexpected up to the next corner
+  while (_p < _end && !isBlank(*_p)) {
+    ++_p;
+  }
+  return _p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Parse the lines of one chunk into its local arrays
+void parseChunk(Chunk& _chunk) {
+
+  PROFILE_SCOPE("Parse OBJ chunk");
+
+  std::vector<Corner> face;
+
+  const char* p = _chunk.begin;
+  while (p < _chunk.end) {
+
+    const char* eol = static_cast<const char*>(
+      std::memchr(p, '\n', _chunk.end - p));
+    if (!eol) {
+      eol = _chunk.end;
+    }
+
+    const char* q = skipBlanks(p, eol);
+    size_t length = eol - q;
+
+    if (length > 2 && q[0] == 'v' && isBlank(q[1])) {
+      glm::vec3 v(0.0f);
+      q = parseFloat(q + 2, eol, v.x);
+      q = parseFloat(q, eol, v.y);
+      parseFloat(q, eol, v.z);
+      _chunk.positions.push_back(v);
+    }
+    else if (length > 3 && q[0] == 'v' && q[1] == 't' && isBlank(q[2])) {
+      glm::vec2 t(0.0f);
+      q = parseFloat(q + 3, eol, t.x);
+      parseFloat(q, eol, t.y);
+      _chunk.textures.push_back(t);
+    }
+    else if (length > 3 && q[0] == 'v' && q[1] == 'n' && isBlank(q[2])) {
+      glm::vec3 n(0.0f);
+      q = parseFloat(q + 3, eol, n.x);
+      q = parseFloat(q, eol, n.y);
+      parseFloat(q, eol, n.z);
+      _chunk.normals.push_back(n);
+    }
+    else if (length > 2 && q[0] == 'f' && isBlank(q[1])) {
+      face.clear();
+      q = skipBlanks(q + 2, eol);
+      while (q < eol) {
+        Corner corner;
+        q = parseCorner(q, eol, _chunk, corner);
+        if (corner.p != MISSING) {
+          face.push_back(corner);
+        }
+        q = skipBlanks(q, eol);
+      }
+      // Triangulate quads and larger polygons as a fan around the first corner
+      for (size_t i = 2; i < face.size(); ++i) {
+        _chunk.corners.push_back(face[0]);
+        _chunk.corners.push_back(face[i-1]);
+        _chunk.corners.push_back(face[i]);
+      }
+    }
+    else if (length > 7 && std::strncmp(q, "mtllib", 6) == 0 &&
+             isBlank(q[6]) && _chunk.mtlFile.empty()) {
+      q = skipBlanks(q + 7, eol);
+      const char* e = q;
+      while (e < eol && !isBlank(*e)) {
+        ++e;
+      }
+      _chunk.mtlFile.assign(q, e);
+    }
+
+    p = eol + 1;
+  }
+}
+
+inline int64_t resolve(int32_t _index, bool _relative, size_t _base) {
+  return _relative ? int64_t(_base) + _index : int64_t(_index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Build the triangles of one chunk from the merged attribute arrays
+///
+/// Triangles referencing a position out of range are dropped. A missing
+/// texture coordinate becomes (0, 0) and a missing normal the face normal.
+void emitChunk(Chunk& _chunk, const std::vector<glm::vec3>& _positions,
+               const std::vector<glm::vec2>& _textures,
+               const std::vector<glm::vec3>& _normals) {
+
+  _chunk.vertices.reserve(_chunk.corners.size());
+
+  for (size_t i = 0; i + 2 < _chunk.corners.size(); i += 3) {
+
+    int64_t p[3];
+    bool valid = true;
+    for (int c = 0; c < 3; ++c) {
+      const Corner& corner = _chunk.corners[i + c];
+      p[c] = resolve(corner.p, corner.relative & 1, _chunk.positionBase);
+      valid = valid && p[c] >= 0 && p[c] < int64_t(_positions.size());
+    }
+    if (!valid) {
+      continue;
+    }
+
+    glm::vec3 faceNormal = glm::cross(_positions[p[1]] - _positions[p[0]],
+                                      _positions[p[2]] - _positions[p[0]]);
+    float length = glm::length(faceNormal);
+    faceNormal = length > 0.0f ? faceNormal / length : glm::vec3(0, 0, 1);
+
+    for (int c = 0; c < 3; ++c) {
+      const Corner& corner = _chunk.corners[i + c];
+
+      glm::vec2 t(0.0f);
+      if (corner.t != MISSING) {
+        int64_t ti = resolve(corner.t, corner.relative & 2, _chunk.textureBase);
+        if (ti >= 0 && ti < int64_t(_textures.size())) {
+          t = _textures[ti];
+        }
+      }
+
+      glm::vec3 n = faceNormal;
+      if (corner.n != MISSING) {
+        int64_t ni = resolve(corner.n, corner.relative & 4, _chunk.normalBase);
+        if (ni >= 0 && ni < int64_t(_normals.size())) {
+          n = _normals[ni];
+        }
+      }
+
+      _chunk.vertices.emplace_back(_positions[p[c]], n, t);
+    }
+  }
+}
+
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// @brief Parse an obj file into a mesh
 /// @param _filename Filename
 /// @return Loaded mesh
+///
+/// The file is mapped and cut into chunks at line boundaries, which are parsed
+/// in parallel into chunk-local arrays. Prefix sums over the chunk counts give
+/// each chunk its offset in the merged arrays, so copying the arrays and
+/// resolving face indices into triangles is parallel too.
 mesh objParser(const std::string& _filename) {
 
-  std::ifstream ifs(_filename);
-  if(!ifs) {
+  std::shared_ptr<MappedFile> file = MappedFile::open(_filename);
+  if(!file) {
     return mesh();
   }
   std::cout << "Parsing: " << _filename << std::endl;
+  PROFILE_SCOPE("Parse OBJ");
 
-  std::vector<glm::vec3> positions;
-  std::vector<glm::vec2> textures;
-  std::vector<glm::vec3> normals;
-  std::vector<vertex> vertices;
+  ThreadPool& pool = ThreadPool::shared();
+
+  const char* data = reinterpret_cast<const char*>(file->data());
+  const char* end = data + file->size();
 
+  size_t count = std::max<size_t>(1, std::min(pool.size() + 1,
+    file->size() / MIN_CHUNK_BYTES));
+  std::vector<Chunk> chunks(count);
+
+  // Move each cut forward to just past a newline
+  const char* begin = data;
+  for (size_t i = 0; i < count; ++i) {
+    const char* cut = i + 1 == count ? end : data + file->size() * (i + 1) / count;
+    cut = std::max(cut, begin);
+    if (cut < end) {
+      const char* eol = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+      cut = eol ? eol + 1 : end;
+    }
+    chunks[i].begin = begin;
+    chunks[i].end = cut;
+    begin = cut;
+  }
+
+  pool.parallelFor(count, 1, [&chunks](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      parseChunk(chunks[i]);
+    }
+  });
+
+  size_t positions = 0, textures = 0, normals = 0;
   std::string mtlFilename;
+  for (Chunk& chunk : chunks) {
+    chunk.positionBase = positions;
+    chunk.textureBase = textures;
+    chunk.normalBase = normals;
+    positions += chunk.positions.size();
+    textures += chunk.textures.size();
+    normals += chunk.normals.size();
+    if (mtlFilename.empty()) {
+      mtlFilename = chunk.mtlFile;
+    }
+  }
 
-  std::string line;
-  while(ifs) {
-    getline(ifs, line);
-
-    std::istringstream iss(line);
-    std::string tag;
-    iss >> tag;
-
-    if(tag.compare("v") == 0) {
-      glm::vec3 p;
-      iss >> p.x >> p.y >> p.z;
-      positions.emplace_back(p);
-    }
-    else if(tag.compare("vt") == 0) {
-      glm::vec2 t;
-      iss >> t.x >> t.y;
-      textures.emplace_back(t);
-    }
-    else if(tag.compare("vn") == 0) {
-      glm::vec3 n;
-      iss >> n.x >> n.y >> n.z;
-      normals.emplace_back(n);
-    }
-    else if(tag.compare("f") == 0) {
-      for(size_t i = 0; i < 3; ++i) {
-        std::string vert;
-        iss >> vert;
-        size_t p, t, n;
-        sscanf(vert.c_str(), "%zu/%zu/%zu", &p, &t, &n);
-        vertices.emplace_back(positions[p-1], normals[n-1], textures[t-1]);
-      }
+  std::vector<glm::vec3> allPositions(positions);
+  std::vector<glm::vec2> allTextures(textures);
+  std::vector<glm::vec3> allNormals(normals);
+
+  pool.parallelFor(count, 1, [&](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      Chunk& chunk = chunks[i];
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+                allPositions.begin() + chunk.positionBase);
+      std::copy(chunk.textures.begin(), chunk.textures.end(),
+                allTextures.begin() + chunk.textureBase);
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+                allNormals.begin() + chunk.normalBase);
     }
-    else if(tag.compare("mtllib") == 0) {
-      iss >> mtlFilename;
+  });
+
+  pool.parallelFor(count, 1, [&](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      emitChunk(chunks[i], allPositions, allTextures, allNormals);
     }
+  });
+
+  size_t total = 0;
+  for (Chunk& chunk : chunks) {
+    chunk.vertexBase = total;
+    total += chunk.vertices.size();
   }
 
-  return mesh(vertices, mtlFilename);
+  // vertex has no default constructor, so the storage is filled by copy
+  std::vector<vertex> vertices(total, vertex(glm::vec3(0.0f), glm::vec3(0.0f),
+                                             glm::vec2(0.0f)));
+
+  pool.parallelFor(count, 1, [&](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      std::copy(chunks[i].vertices.begin(), chunks[i].vertices.end(),
+                vertices.begin() + chunks[i].vertexBase);
+    }
+  });
+
+  mesh result;
+  result.m_vertices = std::move(vertices);
+  result.mtlFile = mtlFilename;
+  return result;
 }
@@ -2,6 +2,8 @@
 #define __OBJPARSER_H__
 
 // STL
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <fstream>
 #include <iostream>
@@ -27,17 +29,42 @@ struct vertex {
 ////////////////////////////////////////////////////////////////////////////////
 /// @brief One possible mesh data structure
 ///
-/// Vertices will be ordered such that every three form a triangle, e.g.,
-/// vertices at indices 0, 1, 2 form a triangle, and then vertices at indices
-/// 3, 4, 5 form a triangle, etc.
+/// Without indices, vertices will be ordered such that every three form a
+/// triangle, e.g., vertices at indices 0, 1, 2 form a triangle, and then
+/// vertices at indices 3, 4, 5 form a triangle, etc. With indices, every three
+/// indices form a triangle instead.
+///
+/// The arrays are either owned (m_vertices, m_indices) or point into a mapped
+/// binary mesh file kept alive by m_mapping; use the accessors to read either.
 ////////////////////////////////////////////////////////////////////////////////
 struct mesh {
   std::vector<vertex> m_vertices;
+  std::vector<uint32_t> m_indices;
   std::string mtlFile;
 
+  std::shared_ptr<const void> m_mapping; ///< Mapped file, if not owned
+  const vertex* m_mappedVertices{nullptr};
+  size_t m_mappedVertexCount{0};
+  const uint32_t* m_mappedIndices{nullptr};
+  size_t m_mappedIndexCount{0};
+
   mesh(const std::vector<vertex>& _vertices = std::vector<vertex>(),
   const std::string& _filename = "") :
     m_vertices(_vertices), mtlFile(_filename) {}
+
+  const vertex* vertexData() const {
+    return m_mapping ? m_mappedVertices : m_vertices.data();
+  }
+  size_t vertexCount() const {
+    return m_mapping ? m_mappedVertexCount : m_vertices.size();
+  }
+  const uint32_t* indexData() const {
+    return m_mapping ? m_mappedIndices : m_indices.data();
+  }
+  size_t indexCount() const {
+    return m_mapping ? m_mappedIndexCount : m_indices.size();
+  }
+  bool indexed() const { return indexCount() != 0; }
 };
 
 mesh objParser(const std::string& _filename);
@@ -6,6 +6,7 @@
 #include "ray.h"
 #include "material.h"
 #include "objParser.h"
+#include "meshcache.h"
 
 class Object {
 
@@ -15,20 +16,21 @@ class Object {
     glm::vec4 color;
     Material material = Material();
 
-    GLuint diffuseTextureID;
-    GLuint specularTextureID;
-    GLuint emissionTextureID;
-    GLuint bumpTextureID;
-    GLuint depthTextureID;
-    GLuint displacementTextureID;
-    GLuint skyboxTextureID;
+    GLuint diffuseTextureID{0};
+    GLuint specularTextureID{0};
+    GLuint emissionTextureID{0};
+    GLuint bumpTextureID{0};
+    GLuint depthTextureID{0};
+    GLuint displacementTextureID{0};
+    GLuint skyboxTextureID{0};
 
     bool isLocalLightSource = false;
     bool isSkyBox = false;
+    bool isOccluder = false; ///< Rasterized into the occlusion depth buffer
     
     std::vector<std::string> faces;
 
-    mesh meshes;
+    std::shared_ptr<MeshAsset> asset; ///< Shared with every object using the same OBJ
     float verticesCount = 0.0f;
 
     glm::vec3 scale;
@@ -39,6 +41,9 @@ class Object {
 
     glm::mat4 modelMatrix;
 
+    AABB worldBounds;            ///< Mesh bounds transformed by modelMatrix
+    BoundingSphere worldSphere;
+
     Object();
     Object(glm::vec3 pos);
     ~Object();
@@ -0,0 +1,239 @@
+#ifndef __OCCLUSION_CPP__
+#define __OCCLUSION_CPP__
+
+#include "occlusion.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "object.h"
+#include "threadpool.h"
+
+namespace {
+
+const int BAND_ROWS = 8; ///< Rows rasterized by one pool task
+
+}
+
+OcclusionCuller::OcclusionCuller(ThreadPool& _pool) : m_pool(_pool) {
+  for (int level = 0; level < LEVELS; ++level) {
+    m_levels[level].assign((WIDTH >> level) * (HEIGHT >> level), 1.0f);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pick the occluders among the drawable objects
+/// @param _objects Objects whose meshes are loaded; those with isOccluder set
+///                 are rasterized from now on
+void OcclusionCuller::setOccluders(
+    const std::vector<std::shared_ptr<Object>>& _objects) {
+
+  m_occluders.clear();
+  for (const std::shared_ptr<Object>& object : _objects) {
+    if (object->isOccluder && object->asset) {
+      m_occluders.push_back(object);
+    }
+  }
+  m_triangles.resize(m_occluders.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Transform and set up the triangles of one occluder
+///
+/// Triangles reaching in front of the near plane, off screen or seen edge-on
+/// are dropped. Both windings are kept, so open meshes occlude from either
+/// side.
+void OcclusionCuller::setup(size_t _occluder) {
+
+  const Object& object = *m_occluders[_occluder];
+  const mesh& data = object.asset->data;
+  std::vector<Triangle>& triangles = m_triangles[_occluder];
+  triangles.clear();
+
+  const glm::mat4 mvp = m_viewProjection * object.modelMatrix;
+  const vertex* vertices = data.vertexData();
+  const size_t vertexCount = data.vertexCount();
+
+  thread_local std::vector<glm::vec4> clip;
+  clip.resize(vertexCount);
+  for (size_t i = 0; i < vertexCount; ++i) {
+    clip[i] = mvp * glm::vec4(vertices[i].m_p, 1.0f);
+  }
+
+  const uint32_t* indices = data.indexData();
+  const size_t count = indices ? data.indexCount() : vertexCount;
+
+  for (size_t t = 0; t + 2 < count; t += 3) {
+
+    glm::vec3 v[3];
+    bool nearClipped = false;
+    for (int k = 0; k < 3; ++k) {
+      const glm::vec4& c = clip[indices ? indices[t + k] : t + k];
+      if (c.z < -c.w) {
+        nearClipped = true;
+        break;
+      }
+      v[k] = Triangle::toScreen(c, WIDTH, HEIGHT);
+    }
+    if (nearClipped) {
+      continue;
+    }
+
+    Triangle triangle;
+    if (!triangle.setup(v, WIDTH, HEIGHT)) {
+      continue;
+    }
+    triangles.push_back(triangle);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Rasterize every occluder triangle into some rows of the depth buffer
+/// @param _firstRow First row
+/// @param _lastRow One past the last row
+void OcclusionCuller::rasterize(int _firstRow, int _lastRow) {
+
+  float* depth = m_levels[0].data();
+
+  for (const std::vector<Triangle>& triangles : m_triangles) {
+    for (const Triangle& t : triangles) {
+
+      int y0 = std::max(t.minY, _firstRow);
+      int y1 = std::min(t.maxY, _lastRow - 1);
+
+      for (int y = y0; y <= y1; ++y) {
+
+        float* row = depth + y * WIDTH;
+
+#if defined(EDGERASTER_SSE)
+        scanRow(t, y, t.minX, t.maxX, 0,
+          [row](int _x, __m128 _inside, __m128 _z) {
+            __m128 old = _mm_loadu_ps(row + _x);
+            __m128 nearest = _mm_min_ps(old, _z);
+            _mm_storeu_ps(row + _x, _mm_or_ps(_mm_and_ps(_inside, nearest),
+                                              _mm_andnot_ps(_inside, old)));
+          });
+#else
+        scanRow(t, y, t.minX, t.maxX, 0, [row](int _x, float _z) {
+          row[_x] = std::min(row[_x], _z);
+        });
+#endif
+      }
+    }
+  }
+}
+
+/// @brief Fill each pyramid level with the farthest depth of four texels below
+void OcclusionCuller::buildPyramid() {
+
+  for (int level = 1; level < LEVELS; ++level) {
+    const int width = WIDTH >> level;
+    const int height = HEIGHT >> level;
+    const float* below = m_levels[level - 1].data();
+    float* texels = m_levels[level].data();
+
+    for (int y = 0; y < height; ++y) {
+      const float* row0 = below + (2 * y) * (2 * width);
+      const float* row1 = row0 + 2 * width;
+      for (int x = 0; x < width; ++x) {
+        texels[y * width + x] = std::max(
+          std::max(row0[2 * x], row0[2 * x + 1]),
+          std::max(row1[2 * x], row1[2 * x + 1]));
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Rasterize the occluders for a new view and rebuild the pyramid
+/// @param _viewProjection Projection matrix times view matrix
+void OcclusionCuller::render(const glm::mat4& _viewProjection) {
+
+  m_viewProjection = _viewProjection;
+  std::fill(m_levels[0].begin(), m_levels[0].end(), 1.0f);
+
+  if (m_occluders.empty()) {
+    buildPyramid();
+    return;
+  }
+
+  m_pool.parallelFor(m_occluders.size(), 1, [this](size_t _begin, size_t _end) {
+    for (size_t o = _begin; o < _end; ++o) {
+      setup(o);
+    }
+  });
+
+  m_triangleCount = 0;
+  for (const std::vector<Triangle>& triangles : m_triangles) {
+    m_triangleCount += triangles.size();
+  }
+
+  m_pool.parallelFor(HEIGHT / BAND_ROWS, 1, [this](size_t _begin, size_t _end) {
+    for (size_t band = _begin; band < _end; ++band) {
+      rasterize(band * BAND_ROWS, (band + 1) * BAND_ROWS);
+    }
+  });
+
+  buildPyramid();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Test a box against the occluders of the last render()
+/// @param _box World space bounds
+/// @return False if the occluders hide the whole box, up to the texel
+///         sampling described with the class
+bool OcclusionCuller::visible(const AABB& _box) const {
+
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(-std::numeric_limits<float>::max());
+
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 corner((i & 1) ? _box.max.x : _box.min.x,
+                     (i & 2) ? _box.max.y : _box.min.y,
+                     (i & 4) ? _box.max.z : _box.min.z);
+    glm::vec4 c = m_viewProjection * glm::vec4(corner, 1.0f);
+    if (c.z < -c.w) {
+      return true;
+    }
+    glm::vec3 ndc = glm::vec3(c) / c.w;
+    lo = glm::min(lo, ndc);
+    hi = glm::max(hi, ndc);
+  }
+
+  int x0 = int(std::floor((lo.x * 0.5f + 0.5f) * WIDTH));
+  int x1 = int(std::floor((hi.x * 0.5f + 0.5f) * WIDTH));
+  int y0 = int(std::floor((lo.y * 0.5f + 0.5f) * HEIGHT));
+  int y1 = int(std::floor((hi.y * 0.5f + 0.5f) * HEIGHT));
+  if (x1 < 0 || x0 >= WIDTH || y1 < 0 || y0 >= HEIGHT) {
+    return true;
+  }
+
+  // One texel more on each side, as occluders only cover texel centers
+  x0 = std::max(x0 - 1, 0);
+  y0 = std::max(y0 - 1, 0);
+  x1 = std::min(x1 + 1, WIDTH - 1);
+  y1 = std::min(y1 + 1, HEIGHT - 1);
+
+  // The level where the rectangle covers at most two texels each way
+  int size = std::max(x1 - x0, y1 - y0) + 1;
+  int level = 0;
+  while (level < LEVELS - 1 && (1 << level) < size) {
+    level++;
+  }
+
+  const int width = WIDTH >> level;
+  const float* texels = m_levels[level].data();
+  float farthest = 0.0f;
+  for (int y = y0 >> level; y <= y1 >> level; ++y) {
+    for (int x = x0 >> level; x <= x1 >> level; ++x) {
+      farthest = std::max(farthest, texels[y * width + x]);
+    }
+  }
+
+  float nearest = lo.z * 0.5f + 0.5f;
+  return nearest <= farthest;
+}
+
+#endif
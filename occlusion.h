@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Occlusion culling against a software depth buffer of occluders
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+
+// STL
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "edgeraster.h"
+#include "frustum.h"
+
+class Object;
+class ThreadPool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Hierarchical depth buffer of the scene's large occluders
+///
+/// Objects marked as occluders are rasterized on the CPU every frame into a
+/// WIDTH by HEIGHT depth buffer, four pixels at a time with SSE, in horizontal
+/// bands spread over the pool. Each level of the pyramid above it keeps the
+/// farthest depth of four texels of the level below, so an object's screen
+/// rectangle is tested against at most four texels of the level matching its
+/// size: the object is hidden if its nearest depth is behind all of them.
+///
+/// Occluders are sampled at texel centers, so a texel can hold the depth of
+/// an occluder that covers only part of it, taken at the center. An object's
+/// rectangle is therefore widened by one texel on each side: past an
+/// occluder's edge some texel within one of any uncovered point is
+/// uncovered, and on a sloped occluder the centers around a texel bound the
+/// depth across it. Occluder triangles that cross the near plane are left
+/// out, and objects that do are always visible.
+///
+/// The test is still approximate where occluders leave a gap narrower than a
+/// texel, or meet at a concave corner: an object seen only through such a gap
+/// can be culled.
+////////////////////////////////////////////////////////////////////////////////
+class OcclusionCuller {
+
+  public:
+
+    static const int WIDTH = 256;
+    static const int HEIGHT = 128;
+    static const int LEVELS = 8;  ///< Down to 2 by 1 texels
+
+    explicit OcclusionCuller(ThreadPool& _pool);
+
+    void setOccluders(const std::vector<std::shared_ptr<Object>>& _objects);
+
+    void render(const glm::mat4& _viewProjection);
+    bool visible(const AABB& _box) const;
+
+    bool empty() const { return m_occluders.empty(); }
+    size_t triangles() const { return m_triangleCount; }
+
+  private:
+
+    typedef EdgeTriangle Triangle;
+
+    void setup(size_t _occluder);
+    void rasterize(int _firstRow, int _lastRow);
+    void buildPyramid();
+
+    ThreadPool& m_pool;
+
+    std::vector<std::shared_ptr<Object>> m_occluders;
+    std::vector<std::vector<Triangle>> m_triangles; ///< Per occluder
+    size_t m_triangleCount{0};                      ///< Set up last frame
+
+    glm::mat4 m_viewProjection{1.0f};
+    std::vector<float> m_levels[LEVELS]; ///< Depth in [0, 1], rows bottom up
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef __PARTICLEGRID_CPP__
+#define __PARTICLEGRID_CPP__
+
+#include "particlegrid.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+
+#include "particlesystem.h"
+#include "profiler.h"
+
+namespace {
+
+/// The cell's own offset, then 13 offsets that, with their negations, make up
+/// the 26 neighbours; each cell tests itself and these, not the other half
+const int HALF[14][3] = {
+  { 0, 0, 0},
+  { 1, 0, 0}, {-1, 1, 0}, { 0, 1, 0}, { 1, 1, 0},
+  {-1,-1, 1}, { 0,-1, 1}, { 1,-1, 1},
+  {-1, 0, 1}, { 0, 0, 1}, { 1, 0, 1},
+  {-1, 1, 1}, { 0, 1, 1}, { 1, 1, 1}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Exchange momentum between two colliding particles, sized as mass
+void bounce(ParticlePool& _one, size_t _i, ParticlePool& _two, size_t _j) {
+
+  float m1 = _one.SizeBegin[_i];
+  float m2 = _two.SizeBegin[_j];
+  glm::vec3 u1 = _one.Velocity(_i);
+  glm::vec3 u2 = _two.Velocity(_j);
+
+  glm::vec3 v1 = ((m1 - m2) * u1 / (m1 + m2)) + ((2 * m2) * u2 / (m1 + m2));
+  glm::vec3 v2 = (-(m1 - m2) * u2 / (m1 + m2)) + ((2 * m1) * u1 / (m1 + m2));
+
+  _one.SetVelocity(_i, v1);
+  _two.SetVelocity(_j, v2);
+}
+
+}
+
+/// @brief Hash a cell into the table
+uint32_t ParticleGrid::bucket(int32_t _x, int32_t _y, int32_t _z) const {
+  uint32_t h = uint32_t(_x) * 73856093u ^ uint32_t(_y) * 19349663u ^
+               uint32_t(_z) * 83492791u;
+  // The products only carry low bits upwards, so take the top bits of a
+  // Fibonacci hash rather than masking the low ones
+  return uint32_t((uint64_t(h) * 2654435769u) >> m_shift) & m_mask;
+}
+
+/// @brief Look up an occupied cell
+/// @return Null if no particle is in the cell
+const ParticleGrid::Cell* ParticleGrid::find(int32_t _x, int32_t _y,
+                                             int32_t _z) const {
+  uint32_t b = bucket(_x, _y, _z);
+  for (uint32_t c = m_start[b]; c < m_start[b + 1]; ++c) {
+    const Cell& cell = m_cells[c];
+    if (cell.cell[0] == _x && cell.cell[1] == _y && cell.cell[2] == _z) {
+      return &cell;
+    }
+  }
+  return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bin the live particles of every system into the table
+void ParticleGrid::build(
+    const std::vector<std::shared_ptr<ParticleSystem>>& _systems) {
+
+  size_t count = 0;
+  float largest = 0.0f;
+  for (const std::shared_ptr<ParticleSystem>& system : _systems) {
+    const ParticlePool& pool = system->m_ParticlePool;
+    count += pool.Count();
+    for (size_t i = 0; i < pool.Count(); ++i) {
+      largest = std::max(largest, std::fabs(pool.SizeBegin[i]));
+    }
+  }
+  m_cellSize = std::max(largest, 1e-3f);
+
+  size_t buckets = 1;
+  int bits = 0;
+  while (buckets < 2 * count) {
+    buckets <<= 1;
+    bits++;
+  }
+  m_mask = uint32_t(buckets - 1);
+  m_shift = 32 - bits;
+
+  m_unsorted.clear();
+  m_unsorted.reserve(count);
+  m_buckets.clear();
+  m_buckets.reserve(count);
+  m_start.assign(buckets + 1, 0);
+
+  const float scale = 1.0f / m_cellSize;
+  for (size_t s = 0; s < _systems.size(); ++s) {
+    const ParticlePool& pool = _systems[s]->m_ParticlePool;
+    for (size_t i = 0; i < pool.Count(); ++i) {
+      Entry entry;
+      entry.x = pool.PositionX[i];
+      entry.y = pool.PositionY[i];
+      entry.z = pool.PositionZ[i];
+      entry.size = pool.SizeBegin[i];
+      entry.system = uint32_t(s);
+      entry.particle = uint32_t(i);
+      entry.cell[0] = int32_t(std::floor(entry.x * scale));
+      entry.cell[1] = int32_t(std::floor(entry.y * scale));
+      entry.cell[2] = int32_t(std::floor(entry.z * scale));
+
+      uint32_t b = bucket(entry.cell[0], entry.cell[1], entry.cell[2]);
+      m_unsorted.push_back(entry);
+      m_buckets.push_back(b);
+      m_start[b]++;
+    }
+  }
+
+  // Counting sort: the running sum makes m_start[b] the end of bucket b, and
+  // filling each bucket from its end leaves it at the bucket's start
+  for (size_t b = 1; b <= buckets; ++b) {
+    m_start[b] += m_start[b - 1];
+  }
+  m_entries.resize(count);
+  for (size_t k = count; k-- > 0; ) {
+    m_entries[--m_start[m_buckets[k]]] = m_unsorted[k];
+  }
+
+  // Order each bucket by cell, and turn the entry offsets into cell offsets
+  m_cells.clear();
+  for (size_t b = 0; b < buckets; ++b) {
+
+    const uint32_t begin = m_start[b];
+    const uint32_t end = m_start[b + 1];
+    m_start[b] = uint32_t(m_cells.size());
+
+    if (end - begin > 1) {
+      std::sort(m_entries.begin() + begin, m_entries.begin() + end,
+        [](const Entry& _a, const Entry& _b) {
+          return std::lexicographical_compare(_a.cell, _a.cell + 3,
+                                              _b.cell, _b.cell + 3);
+        });
+    }
+
+    for (uint32_t e = begin; e < end; ) {
+      const Entry& first = m_entries[e];
+      Cell cell = {{first.cell[0], first.cell[1], first.cell[2]}, e, e + 1};
+      while (cell.end < end &&
+             std::equal(first.cell, first.cell + 3, m_entries[cell.end].cell)) {
+        cell.end++;
+      }
+      m_cells.push_back(cell);
+      e = cell.end;
+    }
+  }
+  m_start[buckets] = uint32_t(m_cells.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bounce the particles of two cells, or of one cell, off each other
+void ParticleGrid::test(const Cell& _one, const Cell& _two,
+    const std::vector<std::shared_ptr<ParticleSystem>>& _systems) {
+
+  const bool same = &_one == &_two;
+
+  for (uint32_t a = _one.begin; a < _one.end; ++a) {
+    const Entry& one = m_entries[a];
+
+    for (uint32_t b = same ? a + 1 : _two.begin; b < _two.end; ++b) {
+      const Entry& two = m_entries[b];
+      if (two.system == one.system) {
+        continue;
+      }
+
+      // ParticleSystem::CheckCollision, on the copies in the table
+      m_tests++;
+      if (one.x + one.size >= two.x && two.x + two.size >= one.x &&
+          one.y + one.size >= two.y && two.y + two.size >= one.y &&
+          one.z + one.size >= two.z && two.z + two.size >= one.z) {
+        m_hits++;
+        bounce(_systems[one.system]->m_ParticlePool, one.particle,
+               _systems[two.system]->m_ParticlePool, two.particle);
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bounce the overlapping particles of different systems off each other
+/// @param _systems Every particle system of the scene
+void ParticleGrid::collide(
+    const std::vector<std::shared_ptr<ParticleSystem>>& _systems) {
+
+  PROFILE_SCOPE("CollisionDetection");
+
+  m_tests = 0;
+  m_hits = 0;
+
+  build(_systems);
+
+  for (const Cell& cell : m_cells) {
+    test(cell, cell, _systems);
+
+    for (int n = 1; n < 14; ++n) {
+      const Cell* neighbour = find(cell.cell[0] + HALF[n][0],
+                                   cell.cell[1] + HALF[n][1],
+                                   cell.cell[2] + HALF[n][2]);
+      if (neighbour) {
+        test(cell, *neighbour, _systems);
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,83 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Spatial hash broadphase for collisions between particle systems
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __PARTICLEGRID_H__
+#define __PARTICLEGRID_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ParticleSystem;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Finds colliding particles of different systems through a hashed
+///        uniform grid
+///
+/// Every tick the live particles of all systems are binned by the grid cell
+/// their position falls in. The cell edge is the largest particle size, so
+/// two particles whose boxes overlap are at most one cell apart on each axis,
+/// and only particles of neighbouring cells are tested against each other,
+/// with the AABB test of ParticleSystem::CheckCollision.
+///
+/// Cells are hashed into a table of twice the particle count buckets. The
+/// particles are counting sorted by bucket and then ordered by cell, so each
+/// occupied cell is a contiguous run of particles carrying their own position
+/// and size. Each cell looks up half of its 26 neighbours and tests its run
+/// against theirs and against itself, so every pair is seen once, and the
+/// cost is linear in the particle count for evenly spread particles.
+///
+/// Particles of the same system pass through each other, as they always have.
+////////////////////////////////////////////////////////////////////////////////
+class ParticleGrid {
+
+  public:
+
+    void collide(const std::vector<std::shared_ptr<ParticleSystem>>& _systems);
+
+    size_t tests() const { return m_tests; }
+    size_t hits() const { return m_hits; }
+
+  private:
+
+    /// A live particle in the table, with the position and size the AABB
+    /// test reads; collisions only change velocities
+    struct Entry {
+      float x, y, z;
+      float size;
+      uint32_t system;
+      uint32_t particle;
+      int32_t cell[3];
+    };
+
+    /// An occupied cell and its run of entries
+    struct Cell {
+      int32_t cell[3];
+      uint32_t begin, end;
+    };
+
+    void build(const std::vector<std::shared_ptr<ParticleSystem>>& _systems);
+    uint32_t bucket(int32_t _x, int32_t _y, int32_t _z) const;
+    const Cell* find(int32_t _x, int32_t _y, int32_t _z) const;
+    void test(const Cell& _one, const Cell& _two,
+              const std::vector<std::shared_ptr<ParticleSystem>>& _systems);
+
+    float m_cellSize{1.0f};
+    uint32_t m_mask{0};                ///< Bucket count minus one
+    int m_shift{32};                   ///< Hash bits dropped
+
+    std::vector<Entry> m_entries;      ///< Sorted by bucket, then by cell
+    std::vector<Cell> m_cells;         ///< Occupied cells, in bucket order
+    std::vector<uint32_t> m_start;     ///< First cell of each bucket, and end
+
+    std::vector<Entry> m_unsorted;     ///< Scratch space of build()
+    std::vector<uint32_t> m_buckets;   ///< Bucket of each unsorted entry
+
+    size_t m_tests{0};                 ///< Narrowphase tests last tick
+    size_t m_hits{0};                  ///< Of which collided
+};
+
+#endif
@@ -5,127 +5,344 @@
 #include "random.h"
 #include "GLInclude.h"
 #include "CompileShaders.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
 
 #include <glm/gtc/constants.hpp>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/compatibility.hpp>
 
-ParticleSystem::ParticleSystem()
-{
-	m_ParticlePool.resize(1000);
-}
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PARTICLES_AVX
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define PARTICLES_SSE
+#endif
 
-bool ParticleSystem::CheckCollision(Particle& one, Particle& two) // AABB - AABB collision
-{
-    // Collision x-axis?
-    bool collisionX = one.Position.x + one.SizeBegin >= two.Position.x &&
-        two.Position.x + two.SizeBegin >= one.Position.x;
-    // Collision y-axis?
-    bool collisionY = one.Position.y + one.SizeBegin >= two.Position.y &&
-        two.Position.y + two.SizeBegin >= one.Position.y;
-		// Collision z-axis?
-		bool collisionZ = one.Position.z + one.SizeBegin >= two.Position.z &&
-		    two.Position.z + two.SizeBegin >= one.Position.z;
+namespace {
+
+// One register's worth of a particle stream and the operations the kernels
+// need, so that each kernel is written once for AVX, SSE and plain floats.
+// Masks come from the comparisons and are only combined with And and AndNot.
+#if defined(PARTICLES_AVX)
+typedef __m256 Lanes;
+const size_t WIDTH = 8;
+inline Lanes Load(const float* p) { return _mm256_load_ps(p); }
+inline void Store(float* p, Lanes v) { _mm256_store_ps(p, v); }
+inline Lanes Splat(float f) { return _mm256_set1_ps(f); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+inline Lanes Sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+inline Lanes Less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Lanes LessEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm256_andnot_ps(a, b); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+#elif defined(PARTICLES_SSE)
+typedef __m128 Lanes;
+const size_t WIDTH = 4;
+inline Lanes Load(const float* p) { return _mm_load_ps(p); }
+inline void Store(float* p, Lanes v) { _mm_store_ps(p, v); }
+inline Lanes Splat(float f) { return _mm_set1_ps(f); }
+inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+inline Lanes AndNot(Lanes a, Lanes b) { return _mm_andnot_ps(a, b); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#else
+typedef float Lanes;
+const size_t WIDTH = 1;
+inline Lanes Load(const float* p) { return *p; }
+inline void Store(float* p, Lanes v) { *p = v; }
+inline Lanes Splat(float f) { return f; }
+inline Lanes Add(Lanes a, Lanes b) { return a + b; }
+inline Lanes Sub(Lanes a, Lanes b) { return a - b; }
+inline Lanes Mul(Lanes a, Lanes b) { return a * b; }
+inline Lanes Div(Lanes a, Lanes b) { return a / b; }
+inline Lanes Sqrt(Lanes a) { return std::sqrt(a); }
+inline Lanes Less(Lanes a, Lanes b) { return a < b ? 1.0f : 0.0f; }
+inline Lanes LessEqual(Lanes a, Lanes b) { return a <= b ? 1.0f : 0.0f; }
+inline Lanes And(Lanes a, Lanes b) { return a != 0.0f && b != 0.0f ? b : 0.0f; }
+inline Lanes AndNot(Lanes a, Lanes b) { return a == 0.0f ? b : 0.0f; }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return mask != 0.0f ? a : b; }
+#endif
+
+const size_t CHUNK = 16384; ///< Particles updated by one pool task
 
-    return collisionX && collisionY && collisionZ;
 }
 
-void ParticleSystem::Rotator(glm::vec3 position, float deltaTime) {
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Allocate every stream for a number of particles, all free
+void ParticlePool::Resize(size_t capacity)
+{
+	m_Count = 0;
+	m_Capacity = capacity;
+	size_t padded = (capacity + LANES - 1) / LANES * LANES;
 
-	for (auto& particle : m_ParticlePool)
+	for (AlignedFloats* stream : { &PositionX, &PositionY, &PositionZ,
+		&PreviousX, &PreviousY, &PreviousZ, &VelocityX, &VelocityY, &VelocityZ,
+		&Rotation, &LifeTime, &LifeRemaining })
 	{
-		glm::vec3 r = (particle.Position - position);
-		glm::vec3 direction = cross(r, glm::vec3(0.0,0.0,1.0));
-		glm::vec3 force = (-9.81) * particle.SizeBegin * direction
-		/ glm::length(r);
-		glm::vec3 acceleration = force / particle.SizeBegin;
-
-		particle.Velocity += acceleration * deltaTime;
-		particle.Rotation += 5.0f * deltaTime;
+		stream->assign(padded, 0.0f);
 	}
+	SizeBegin.assign(padded, 1.0f);
+	SizeEnd.assign(padded, 1.0f);
 
+	ColorBegin.assign(capacity, glm::vec4(0.0f));
+	ColorEnd.assign(capacity, glm::vec4(0.0f));
 }
 
-void ParticleSystem::Gravity(float deltaTime) {
-
-	for (auto& particle : m_ParticlePool)
-	{
-		glm::vec3 force = glm::vec3(0.0f, -1.0f, 0.0f) * (9.81) * particle.SizeBegin;
-
-		glm::vec3 acceleration = force / particle.SizeBegin;
-
-		particle.Velocity += acceleration * deltaTime;
-	}
-
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Take the first free slot
+/// @return Its index, or Capacity() if every particle is alive
+size_t ParticlePool::Add()
+{
+	if (m_Count == m_Capacity)
+		return m_Capacity;
+	return m_Count++;
 }
 
-void ParticleSystem::Wind(glm::vec3 magnitude, float deltaTime) {
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Free a live particle, moving the last live particle into its slot
+void ParticlePool::Kill(size_t i)
+{
+	size_t last = --m_Count;
+	if (i == last)
+		return;
 
-	for (auto& particle : m_ParticlePool)
+	for (AlignedFloats* stream : { &PositionX, &PositionY, &PositionZ,
+		&PreviousX, &PreviousY, &PreviousZ, &VelocityX, &VelocityY, &VelocityZ,
+		&Rotation, &SizeBegin, &SizeEnd, &LifeTime, &LifeRemaining })
 	{
-		glm::vec3 force = magnitude;
-
-		glm::vec3 acceleration = force / particle.SizeBegin;
-
-		particle.Velocity += acceleration * deltaTime;
+		(*stream)[i] = (*stream)[last];
 	}
-
+	ColorBegin[i] = ColorBegin[last];
+	ColorEnd[i] = ColorEnd[last];
 }
 
-void ParticleSystem::Repulsor(glm::vec3 position, float mass, float deltaTime) {
+void ParticlePool::SetVelocity(size_t i, const glm::vec3& velocity)
+{
+	VelocityX[i] = velocity.x;
+	VelocityY[i] = velocity.y;
+	VelocityZ[i] = velocity.z;
+}
 
-		for (auto& particle : m_ParticlePool)
-		{
-			glm::vec3 force = (9.81) * mass * particle.SizeBegin * (particle.Position - position)
-			/ pow(glm::length(position - particle.Position), 2);
+ParticleSystem::ParticleSystem()
+{
+	m_ParticlePool.Resize(1000);
+}
 
-			glm::vec3 acceleration = force / particle.SizeBegin;
+bool ParticleSystem::CheckCollision(const ParticlePool& one, size_t i,
+	const ParticlePool& two, size_t j) // AABB - AABB collision
+{
+    // Collision x-axis?
+    bool collisionX = one.PositionX[i] + one.SizeBegin[i] >= two.PositionX[j] &&
+        two.PositionX[j] + two.SizeBegin[j] >= one.PositionX[i];
+    // Collision y-axis?
+    bool collisionY = one.PositionY[i] + one.SizeBegin[i] >= two.PositionY[j] &&
+        two.PositionY[j] + two.SizeBegin[j] >= one.PositionY[i];
+		// Collision z-axis?
+		bool collisionZ = one.PositionZ[i] + one.SizeBegin[i] >= two.PositionZ[j] &&
+		    two.PositionZ[j] + two.SizeBegin[j] >= one.PositionZ[i];
 
-			particle.Velocity += acceleration * deltaTime;
+    return collisionX && collisionY && collisionZ;
+}
 
-			if(glm::length(position - particle.Position) < 3)
-				particle.Velocity *= 2;
-		}
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Resolve the registered forces into the list OnUpdate runs
+///
+/// Call once the scene file is read. Forces apply in the order the separate
+/// force passes used to: rotators, attractors, repulsors, winds, gravity.
+void ParticleSystem::CompileForces()
+{
+	m_Forces.clear();
+
+	for (const struct Rotator& r : rotatorSet)
+		m_Forces.push_back({ Force::ROTATOR, r.position, 0.0f });
+	for (const struct Attractor& a : attractorSet)
+		m_Forces.push_back({ Force::ATTRACTOR, a.position, a.mass });
+	for (const struct Repulsor& r : repulsorSet)
+		m_Forces.push_back({ Force::REPULSOR, r.position, r.mass });
+	for (const struct Wind& w : windSet)
+		m_Forces.push_back({ Force::WIND, w.magnitude, 0.0f });
+	if (hasGravity)
+		m_Forces.push_back({ Force::GRAVITY, glm::vec3(0.0f), 0.0f });
 }
 
-void ParticleSystem::Attractor(glm::vec3 position, float mass, float deltaTime) {
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Apply every force to the live particles and move them, in one pass
+/// @param deltaTime Tick length in seconds
+///
+/// Particles out of life are freed first. Each register of the live
+/// particles is then loaded once, goes through all the forces, ages and moves,
+/// with chunks of CHUNK particles spread over the shared thread pool.
+/// Forces turn into acceleration by dividing by the particle's size, its
+/// mass, so forces proportional to size are applied as accelerations.
+/// Gravitation between the particles needs all of them at once, so with
+/// nBodyStrength set it goes through the Barnes-Hut tree before the pass.
+void ParticleSystem::OnUpdate(float deltaTime)
+{
+	PROFILE_SCOPE("OnUpdate");
 
-		for (auto& particle : m_ParticlePool)
+	// Per tick constants of each force
+	struct Step
+	{
+		Force::Type type;
+		float x, y, z;
+		float strength;
+	};
+	std::vector<Step> steps;
+	steps.reserve(m_Forces.size());
+	for (const Force& force : m_Forces)
+	{
+		Step step = { force.type, force.vector.x, force.vector.y, force.vector.z, 0.0f };
+		switch (force.type)
 		{
-			glm::vec3 force = (-9.81) * mass * particle.SizeBegin * (particle.Position - position)
-			/ pow(glm::length(position - particle.Position), 2);
+		case Force::ROTATOR:   step.strength = -9.81f * deltaTime; break;
+		case Force::ATTRACTOR: step.strength = -9.81f * force.mass * deltaTime; break;
+		case Force::REPULSOR:  step.strength = 9.81f * force.mass * deltaTime; break;
+		case Force::WIND:
+			step.x *= deltaTime;
+			step.y *= deltaTime;
+			step.z *= deltaTime;
+			break;
+		case Force::GRAVITY:   step.strength = -9.81f * deltaTime; break;
+		}
+		steps.push_back(step);
+	}
 
-			glm::vec3 acceleration = force / particle.SizeBegin;
+	ParticlePool& pool = m_ParticlePool;
 
-			particle.Velocity += acceleration * deltaTime;
+	for (size_t i = 0; i < pool.Count(); )
+	{
+		if (pool.LifeRemaining[i] <= 0.0f)
+			pool.Kill(i);
+		else
+			++i;
+	}
 
-			if(glm::length(position - particle.Position) < 3)
-				particle.Velocity = glm::vec3(0.0f, 0.0f, 0.0f);
-		}
-}
+	if (nBodyStrength != 0.0f)
+		m_Gravitation.accelerate(ThreadPool::shared(), pool, nBodyStrength,
+			openingAngle, softening, deltaTime);
 
-void ParticleSystem::OnUpdate(float deltaTime)
-{
+	const Lanes two = Splat(2.0f);
+	const Lanes nearby = Splat(3.0f * 3.0f);
+	const Lanes dt = Splat(deltaTime);
 
-	for (auto& particle : m_ParticlePool)
+	// Registers are independent, so chunks of them go to the pool
+	size_t registers = (pool.Count() + WIDTH - 1) / WIDTH;
+	ThreadPool::shared().parallelFor(registers, CHUNK / WIDTH,
+		[&](size_t begin, size_t end)
 	{
-		if (!particle.Active)
-			continue;
-
-		if (particle.LifeRemaining <= 0.0f)
+		for (size_t i = begin * WIDTH; i < end * WIDTH; i += WIDTH)
 		{
-			particle.Active = false;
-			continue;
+			Lanes x = Load(&pool.PositionX[i]);
+			Lanes y = Load(&pool.PositionY[i]);
+			Lanes z = Load(&pool.PositionZ[i]);
+			Lanes vx = Load(&pool.VelocityX[i]);
+			Lanes vy = Load(&pool.VelocityY[i]);
+			Lanes vz = Load(&pool.VelocityZ[i]);
+			Lanes rotation = Load(&pool.Rotation[i]);
+
+			for (const Step& step : steps)
+			{
+				switch (step.type)
+				{
+				case Force::ROTATOR:
+				{
+					// Pushed along cross(r, z) = (r.y, -r.x, 0), scaled by 1 / |r|
+					Lanes rx = Sub(x, Splat(step.x));
+					Lanes ry = Sub(y, Splat(step.y));
+					Lanes rz = Sub(z, Splat(step.z));
+					Lanes k = Div(Splat(step.strength),
+						Sqrt(Add(Add(Mul(rx, rx), Mul(ry, ry)), Mul(rz, rz))));
+					vx = Add(vx, Mul(k, ry));
+					vy = Sub(vy, Mul(k, rx));
+					rotation = Add(rotation, Splat(5.0f * deltaTime));
+					break;
+				}
+				case Force::ATTRACTOR:
+				case Force::REPULSOR:
+				{
+					Lanes dx = Sub(x, Splat(step.x));
+					Lanes dy = Sub(y, Splat(step.y));
+					Lanes dz = Sub(z, Splat(step.z));
+					Lanes distance2 = Add(Add(Mul(dx, dx), Mul(dy, dy)), Mul(dz, dz));
+					Lanes k = Div(Splat(step.strength), distance2);
+					vx = Add(vx, Mul(k, dx));
+					vy = Add(vy, Mul(k, dy));
+					vz = Add(vz, Mul(k, dz));
+
+					// Within 3 units, attractors catch particles and stop them, and
+					// repulsors fling them out at twice their speed
+					Lanes close = Less(distance2, nearby);
+					if (step.type == Force::ATTRACTOR)
+					{
+						vx = AndNot(close, vx);
+						vy = AndNot(close, vy);
+						vz = AndNot(close, vz);
+					}
+					else
+					{
+						vx = Select(close, Mul(vx, two), vx);
+						vy = Select(close, Mul(vy, two), vy);
+						vz = Select(close, Mul(vz, two), vz);
+					}
+					break;
+				}
+				case Force::WIND:
+				{
+					Lanes size = Load(&pool.SizeBegin[i]);
+					vx = Add(vx, Div(Splat(step.x), size));
+					vy = Add(vy, Div(Splat(step.y), size));
+					vz = Add(vz, Div(Splat(step.z), size));
+					break;
+				}
+				case Force::GRAVITY:
+					vy = Add(vy, Splat(step.strength));
+					break;
+				}
+			}
+
+			// Age and move
+			Store(&pool.LifeRemaining[i], Sub(Load(&pool.LifeRemaining[i]), dt));
+
+			Store(&pool.VelocityX[i], vx);
+			Store(&pool.VelocityY[i], vy);
+			Store(&pool.VelocityZ[i], vz);
+
+			Store(&pool.PreviousX[i], x);
+			Store(&pool.PreviousY[i], y);
+			Store(&pool.PreviousZ[i], z);
+			Store(&pool.PositionX[i], Add(x, Mul(vx, dt)));
+			Store(&pool.PositionY[i], Add(y, Mul(vy, dt)));
+			Store(&pool.PositionZ[i], Add(z, Mul(vz, dt)));
+
+			Store(&pool.Rotation[i], Add(rotation, Splat(0.01f * deltaTime)));
 		}
-
-		particle.LifeRemaining -= deltaTime;
-		particle.Position += particle.Velocity * deltaTime;
-		particle.Rotation += 0.01f * deltaTime;
-	}
+	});
 }
 
-void ParticleSystem::OnRender(Camera& camera, Scene& scene)
+// alpha is how far rendering is between the previous and the current tick.
+// All live particles are drawn with one instanced draw of the cube, sorted
+// back to front for alpha blending.
+void ParticleSystem::OnRender(Camera& camera, Scene& scene, float alpha)
 {
+	PROFILE_SCOPE("OnRender");
+
 	if (!m_QuadVA)
 	{
 		float vertices[] = {
@@ -147,11 +364,10 @@ void ParticleSystem::OnRender(Camera& camera, Scene& scene)
 		glGenVertexArrays(1, &m_QuadVA);
 		glBindVertexArray(m_QuadVA);
 
-		GLuint quadVB[0];
-		GLuint quadIB[0];
+		GLuint quadVB, quadIB;
 
-		glGenBuffers(1, quadVB);
-		glBindBuffer(GL_ARRAY_BUFFER, quadVB[0]);
+		glGenBuffers(1, &quadVB);
+		glBindBuffer(GL_ARRAY_BUFFER, quadVB);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
 		glEnableVertexAttribArray(0);
@@ -174,118 +390,223 @@ void ParticleSystem::OnRender(Camera& camera, Scene& scene)
 			4, 0, 2
 		};
 
-		glGenBuffers(1, quadIB);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIB[0]);
+		glGenBuffers(1, &quadIB);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIB);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
+		// One Instance per particle, advancing once per cube
+		glGenBuffers(1, &m_InstanceVB);
+		glBindBuffer(GL_ARRAY_BUFFER, m_InstanceVB);
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(void*)offsetof(Instance, center));
+		glVertexAttribDivisor(1, 1);
+
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(void*)offsetof(Instance, color));
+		glVertexAttribDivisor(2, 1);
+
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(void*)offsetof(Instance, rotation));
+		glVertexAttribDivisor(3, 1);
+
+		glBindVertexArray(0);
+
 		animation_program = compileProgram("Shaders/animation.vert",
 														 "Shaders/animation.frag");
+		m_ParticleShaderViewProj = glGetUniformLocation(animation_program, "u_ViewProj");
 	}
 
-	//glUseProgram(m_ParticleShader->GetRendererID());
-	glUseProgram(animation_program);
-	//glUniformMatrix4fv(m_ParticleShaderViewProj, 1, GL_FALSE, glm::value_ptr(camera.GetViewProjectionMatrix()));
-
-	glm::mat4 proj(camera.projectionMatrix*scene.viewMatrix);
-	glUniformMatrix4fv(glGetUniformLocation(animation_program, "u_ViewProj"),
-	1, GL_FALSE, glm::value_ptr(proj));
+	const ParticlePool& pool = m_ParticlePool;
+	if (pool.Count() == 0)
+		return;
+
+	// Blending needs the particles back to front. Start from last frame's
+	// order, less the slots freed since and with the slots taken since, which
+	// is close to sorted while the camera and the particles move smoothly.
+	const size_t count = pool.Count();
+	const size_t drawn = m_DrawOrder.size();
+	size_t kept = 0;
+	for (uint32_t i : m_DrawOrder)
+	{
+		if (i < count)
+			m_DrawOrder[kept++] = i;
+	}
+	m_DrawOrder.resize(kept);
+	for (size_t i = drawn; i < count; ++i)
+		m_DrawOrder.push_back(uint32_t(i));
+
+	// Depth along the view axis; the most negative is the farthest
+	const glm::mat4& view = scene.viewMatrix;
+	m_DepthKeys.resize(count);
+	ThreadPool::shared().parallelFor(count, CHUNK,
+		[this, &pool, &view, alpha](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; ++k)
+		{
+			size_t i = m_DrawOrder[k];
+			glm::vec3 previous(pool.PreviousX[i], pool.PreviousY[i], pool.PreviousZ[i]);
+			glm::vec3 position = glm::mix(previous, pool.Position(i), alpha);
+			float depth = view[0][2] * position.x + view[1][2] * position.y +
+				view[2][2] * position.z + view[3][2];
+			m_DepthKeys[k] = RadixSort::key(depth);
+		}
+	});
+	{
+		PROFILE_SCOPE("Sort particles");
+		m_DepthSort.sort(m_DepthKeys, m_DrawOrder);
+	}
 
-	for (auto& particle : m_ParticlePool)
+	// Fill the instances in draw order, in chunks on the pool
+	m_Instances.resize(count);
+	ThreadPool::shared().parallelFor(count, CHUNK,
+		[this, &pool, alpha](size_t begin, size_t end)
 	{
-		if (!particle.Active)
-			continue;
+		for (size_t k = begin; k < end; ++k)
+		{
+			size_t i = m_DrawOrder[k];
 
-		// Fade away particles
-		float life = particle.LifeRemaining / particle.LifeTime;
-		glm::vec4 color = glm::lerp(particle.ColorEnd, particle.ColorBegin, life);
-		color.a = color.a * life;
+			// Fade away particles
+			float life = pool.LifeRemaining[i] / pool.LifeTime[i];
+			glm::vec4 color = glm::lerp(pool.ColorEnd[i], pool.ColorBegin[i], life);
+			color.a = color.a * life;
 
-		float size = glm::lerp(particle.SizeEnd, particle.SizeBegin, life);
+			float size = glm::lerp(pool.SizeEnd[i], pool.SizeBegin[i], life);
 
-		// Render
-		glm::mat4 transform = glm::translate(glm::mat4(1.0f), particle.Position )
-			* glm::rotate(glm::mat4(1.0f), particle.Rotation, { 0.0f, 0.0f, 1.0f })
-			* glm::scale(glm::mat4(1.0f), { size, size, size });
+			glm::vec3 previous(pool.PreviousX[i], pool.PreviousY[i], pool.PreviousZ[i]);
+			glm::vec3 position = glm::mix(previous, pool.Position(i), alpha);
 
-		glUniformMatrix4fv(glGetUniformLocation(animation_program, "u_Transform"),
-		1, GL_FALSE, glm::value_ptr(transform));
-		glUniform4fv(glGetUniformLocation(animation_program, "u_Color"),
-		1, glm::value_ptr(color));
-		glBindVertexArray(m_QuadVA);
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr);
-	}
+			Instance& instance = m_Instances[k];
+			instance.center = glm::vec4(position, size);
+			instance.color = color;
+			instance.rotation = pool.Rotation[i];
+		}
+	});
+
+	// Orphan last frame's storage so the driver does not wait for draws still
+	// reading it
+	glBindBuffer(GL_ARRAY_BUFFER, m_InstanceVB);
+	glBufferData(GL_ARRAY_BUFFER, m_Instances.size() * sizeof(Instance),
+		nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, m_Instances.size() * sizeof(Instance),
+		m_Instances.data());
+
+	glUseProgram(animation_program);
+
+	glm::mat4 proj(camera.projectionMatrix*scene.viewMatrix);
+	glUniformMatrix4fv(m_ParticleShaderViewProj, 1, GL_FALSE, glm::value_ptr(proj));
+
+	glBindVertexArray(m_QuadVA);
+	glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr,
+		GLsizei(m_Instances.size()));
+	glBindVertexArray(0);
 }
 
 void ParticleSystem::PointGenerator(const State& particleProps, glm::vec3 position)
 {
-	Particle& particle = m_ParticlePool[m_PoolIndex];
-	particle.Active = true;
-	particle.Position = position;
-	particle.Rotation = Random::Float() * 2.0f * glm::pi<float>();
-
 	// Velocity
 	glm::vec3 randomVector(Random::Float() - 0.5f, Random::Float() - 0.5f, Random::Float() - 0.5f);
-	particle.Velocity = (particleProps.Velocity * randomVector);
-
-	// Color
-	particle.ColorBegin = particleProps.ColorBegin;
-	particle.ColorEnd = particleProps.ColorEnd;
-
-	particle.LifeTime = particleProps.LifeTime;
-	particle.LifeRemaining = particleProps.LifeTime;
-	particle.SizeBegin = particleProps.SizeBegin + particleProps.SizeVariation * (Random::Float() - 0.5f);
-	particle.SizeEnd = particleProps.SizeEnd;
-
-	m_PoolIndex = --m_PoolIndex % m_ParticlePool.size();
+	Spawn(particleProps, position, particleProps.Velocity * randomVector);
 }
 
 void ParticleSystem::DirectedGenerator(const State& particleProps, glm::vec3 position, glm::vec3 direction)
 {
-	Particle& particle = m_ParticlePool[m_PoolIndex];
-	particle.Active = true;
-	particle.Position = position;
-	particle.Rotation = Random::Float() * 2.0f * glm::pi<float>();
-
 	// Velocity
 	glm::vec3 randomVector(Random::Float() - 0.5f, Random::Float() - 0.5f, Random::Float() - 0.5f);
-	particle.Velocity = (particleProps.Velocity * (randomVector + direction));
+	Spawn(particleProps, position, particleProps.Velocity * (randomVector + direction));
+}
 
-	// Color
-	particle.ColorBegin = particleProps.ColorBegin;
-	particle.ColorEnd = particleProps.ColorEnd;
+void ParticleSystem::DiscGenerator(const State& particleProps, glm::vec3 center, float radius, glm::vec3 normal)
+{
+	glm::vec3 randomVector((Random::Float() - 0.5f) * radius,
+	(Random::Float() - 0.5f) * radius, (Random::Float() - 0.5f) * radius);
+
+	Spawn(particleProps, center + randomVector, normal);
+}
 
-	particle.LifeTime = particleProps.LifeTime;
-	particle.LifeRemaining = particleProps.LifeTime;
-	particle.SizeBegin = particleProps.SizeBegin + particleProps.SizeVariation * (Random::Float() - 0.5f);
-	particle.SizeEnd = particleProps.SizeEnd;
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Count the particles each generator owes for a tick
+/// @param deltaTime Tick length in seconds
+///
+/// The rate is integrated over time and the fraction of a particle left over
+/// is carried to the next tick, so emission does not depend on the tick or
+/// frame rate. Bursts are added when they fall due.
+size_t ParticleSystem::Emission(float deltaTime)
+{
+	m_EmissionDebt += emissionRate * deltaTime;
+	float whole = std::floor(m_EmissionDebt);
+	m_EmissionDebt -= whole;
+	size_t count = size_t(whole);
 
-	m_PoolIndex = --m_PoolIndex % m_ParticlePool.size();
+	if (burstCount > 0)
+	{
+		if (m_BurstTimer <= 0.0f)
+		{
+			count += burstCount;
+			m_BurstTimer = burstInterval > 0.0f ? m_BurstTimer + burstInterval
+				: std::numeric_limits<float>::infinity();
+		}
+		m_BurstTimer -= deltaTime;
+	}
+	return count;
 }
 
-void ParticleSystem::DiscGenerator(const State& particleProps, glm::vec3 center, float radius, glm::vec3 normal)
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Spawn particles from every generator of the system
+/// @param particleProps Properties of the new particles
+/// @param count Particles per generator; those that do not fit in the pool
+///              are dropped
+void ParticleSystem::Emit(const State& particleProps, size_t count)
 {
-	Particle& particle = m_ParticlePool[m_PoolIndex];
-	particle.Active = true;
+	PROFILE_SCOPE("Emit particles");
 
-	glm::vec3 randomVector((Random::Float() - 0.5f) * radius,
-	(Random::Float() - 0.5f) * radius, (Random::Float() - 0.5f) * radius);
+	const ParticlePool& pool = m_ParticlePool;
 
-	particle.Position = center + randomVector;
-	particle.Rotation = Random::Float() * 2.0f * glm::pi<float>();
+	if (hasDiscGenerator)
+	{
+		for (size_t n = std::min(count, pool.Capacity() - pool.Count()); n > 0; --n)
+			DiscGenerator(particleProps, discGen.center, discGen.radius, discGen.normal);
+	}
 
-	// Velocity
-	particle.Velocity = normal;
+	if (hasDirectedGenerator)
+	{
+		for (size_t n = std::min(count, pool.Capacity() - pool.Count()); n > 0; --n)
+			DirectedGenerator(particleProps, dirGen.position, dirGen.direction);
+	}
 
-	// Color
-	particle.ColorBegin = particleProps.ColorBegin;
-	particle.ColorEnd = particleProps.ColorEnd;
+	if (hasPointGenerator)
+	{
+		for (size_t n = std::min(count, pool.Capacity() - pool.Count()); n > 0; --n)
+			PointGenerator(particleProps, pGen.position);
+	}
+}
 
-	particle.LifeTime = particleProps.LifeTime;
-	particle.LifeRemaining = particleProps.LifeTime;
-	particle.SizeBegin = particleProps.SizeBegin + particleProps.SizeVariation * (Random::Float() - 0.5f);
-	particle.SizeEnd = particleProps.SizeEnd;
+// Append a new particle; when the pool is full the particle is dropped rather
+// than taking the place of a live one
+void ParticleSystem::Spawn(const State& particleProps, glm::vec3 position, glm::vec3 velocity)
+{
+	ParticlePool& pool = m_ParticlePool;
+	size_t i = pool.Add();
+	if (i == pool.Capacity())
+		return;
+
+	pool.PositionX[i] = pool.PreviousX[i] = position.x;
+	pool.PositionY[i] = pool.PreviousY[i] = position.y;
+	pool.PositionZ[i] = pool.PreviousZ[i] = position.z;
+	pool.Rotation[i] = Random::Float() * 2.0f * glm::pi<float>();
+	pool.SetVelocity(i, velocity);
+
+	// Color
+	pool.ColorBegin[i] = particleProps.ColorBegin;
+	pool.ColorEnd[i] = particleProps.ColorEnd;
 
-	m_PoolIndex = --m_PoolIndex % m_ParticlePool.size();
+	pool.LifeTime[i] = particleProps.LifeTime;
+	pool.LifeRemaining[i] = particleProps.LifeTime;
+	pool.SizeBegin[i] = particleProps.SizeBegin + particleProps.SizeVariation * (Random::Float() - 0.5f);
+	pool.SizeEnd[i] = particleProps.SizeEnd;
 }
 
 #endif
@@ -4,6 +4,9 @@
 #include "GLInclude.h"
 #include "camera.h"
 #include <vector>
+#include "aligned.h"
+#include "barneshut.h"
+#include "radixsort.h"
 #include "scene.h"
 
 struct State
@@ -15,28 +18,53 @@ struct State
 	float LifeTime = 1.0f;
 };
 
-class ParticleSystem
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Particle attributes as structure of arrays
+///
+/// Each attribute is a stream of its own, aligned and padded to a whole number
+/// of LANES, so the update kernels load four (SSE) or eight (AVX) particles'
+/// worth of one attribute at once and never run a scalar tail. The live
+/// particles are kept packed in [0, Count()): Add appends one and Kill moves
+/// the last live particle into the freed slot. The kernels run over whole
+/// registers, so they also compute on the leftovers just past Count(), which
+/// nothing reads.
+////////////////////////////////////////////////////////////////////////////////
+struct ParticlePool
 {
-public:
-	ParticleSystem();
+	static const size_t LANES = 8; // Widest SIMD width, in floats
 
-	struct Particle
-	{
-		glm::vec3 Position;
-		glm::vec3 Velocity;
-		glm::vec4 ColorBegin, ColorEnd;
-		float Rotation = 0.0f;
-		float SizeBegin, SizeEnd;
+	AlignedFloats PositionX, PositionY, PositionZ;
+	AlignedFloats PreviousX, PreviousY, PreviousZ; // Position one tick ago, for interpolation
+	AlignedFloats VelocityX, VelocityY, VelocityZ;
+	AlignedFloats Rotation;
+	AlignedFloats SizeBegin, SizeEnd;
+	AlignedFloats LifeTime, LifeRemaining;
+	std::vector<glm::vec4> ColorBegin, ColorEnd;
 
-		float LifeTime = 1.0f;
-		float LifeRemaining = 0.0f;
+	void Resize(size_t capacity);
 
-		bool Active = false;
-	};
+	size_t Add();
+	void Kill(size_t i);
+
+	size_t Count() const { return m_Count; }
+	size_t Capacity() const { return m_Capacity; }
+	size_t Padded() const { return PositionX.size(); }
+
+	glm::vec3 Position(size_t i) const { return glm::vec3(PositionX[i], PositionY[i], PositionZ[i]); }
+	glm::vec3 Velocity(size_t i) const { return glm::vec3(VelocityX[i], VelocityY[i], VelocityZ[i]); }
+	void SetVelocity(size_t i, const glm::vec3& velocity);
 
-	struct Particle particle;
+private:
+	size_t m_Count = 0;
+	size_t m_Capacity = 0;
+};
 
-	bool CheckCollision(Particle& objectOne, Particle& objectTwo);
+class ParticleSystem
+{
+public:
+	ParticleSystem();
+
+	static bool CheckCollision(const ParticlePool& one, size_t i, const ParticlePool& two, size_t j);
 
 	bool hasPointGenerator = false;
 	bool hasDirectedGenerator = false;
@@ -44,17 +72,31 @@ public:
 	bool hasGravity = false;
 
 	void OnUpdate(float ts);
-	void OnRender(Camera& camera, Scene& scene);
+	void OnRender(Camera& camera, Scene& scene, float alpha = 1.0f);
 
 	void PointGenerator(const State& particleProperties, glm::vec3 position);
 	void DirectedGenerator(const State& particleProperties, glm::vec3 position, glm::vec3 direction);
 	void DiscGenerator(const State& particleProperties, glm::vec3 center, float radius, glm::vec3 normal);
 
-	void Attractor(glm::vec3 position, float mass, float deltaTime);
-	void Repulsor(glm::vec3 position, float mass, float deltaTime);
-	void Wind(glm::vec3 magnitude, float deltaTime);
-	void Rotator(glm::vec3 position, float deltaTime);
-	void Gravity(float deltaTime);
+	void CompileForces();
+
+	size_t Emission(float deltaTime);
+	void Emit(const State& particleProperties, size_t count);
+
+	// Emission of each generator, from its scene entry
+	float emissionRate = 60.0f; // Particles per second, one per 60 Hz tick by default
+	size_t burstCount = 0;      // Particles emitted at once on top of the rate
+	float burstInterval = 0.0f; // Seconds between bursts; 0 for a single burst
+
+	// Gravitation between the system's own particles, sized as mass
+	float nBodyStrength = 0.0f; // Gravitational constant; 0 for none, negative repels
+	float openingAngle = 0.5f;  // Barnes-Hut accuracy; 0 sums every pair
+	float softening = 0.1f;     // Keeps close pairs from flinging each other away
+
+	// Collisions with the scene's objects
+	bool collidesWithScene = true;
+	float bounce = 0.5f;   // Share of the speed into a face kept, reversed
+	float friction = 0.1f; // Share of the speed along a face lost
 
 	struct PointGenerator
 	{
@@ -99,20 +141,50 @@ public:
 		glm::vec3 position;
 	};
 
+	// A registered force, resolved once for the update pass
+	struct Force
+	{
+		enum Type { ROTATOR, ATTRACTOR, REPULSOR, WIND, GRAVITY };
+
+		Type type;
+		glm::vec3 vector; // Center, or the wind's magnitude
+		float mass;
+	};
+
 	struct DiscGenerator discGen;
 	struct DirectedGenerator dirGen;
 	struct PointGenerator pGen;
 
-	std::vector<Particle> m_ParticlePool;
+	ParticlePool m_ParticlePool;
+	BarnesHut m_Gravitation;
 	std::vector<struct Attractor> attractorSet;
 	std::vector<struct Repulsor> repulsorSet;
 	std::vector<struct Wind> windSet;
 	std::vector<struct Rotator> rotatorSet;
-	uint32_t m_PoolIndex = 999;
+	std::vector<Force> m_Forces; // In the order OnUpdate applies them
+
+	// What animation.vert needs of one particle, streamed every frame
+	struct Instance
+	{
+		glm::vec4 center; // Interpolated position, and size in w
+		glm::vec4 color;
+		float rotation;
+	};
 
 	GLuint m_QuadVA{0};
+	GLuint m_InstanceVB{0};
+	std::vector<Instance> m_Instances;
+	std::vector<uint32_t> m_DrawOrder; // Particles back to front, as last drawn
+	std::vector<uint32_t> m_DepthKeys;
+	RadixSort m_DepthSort;
   GLuint animation_program{0};
-	GLint m_ParticleShaderViewProj, m_ParticleShaderTransform, m_ParticleShaderColor;
+	GLint m_ParticleShaderViewProj{-1};
+
+private:
+	float m_EmissionDebt = 0.0f; // Fraction of a particle owed from past ticks
+	float m_BurstTimer = 0.0f;   // Seconds until the next burst
+
+	void Spawn(const State& particleProps, glm::vec3 position, glm::vec3 velocity);
 };
 
 #endif
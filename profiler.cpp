@@ -0,0 +1,258 @@
+#ifndef __PROFILER_CPP__
+#define __PROFILER_CPP__
+
+#include "profiler.h"
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const size_t CAPACITY = 1 << 16; ///< Events per thread, a power of two
+
+struct Event {
+  const char* name;
+  uint64_t start;  ///< Nanoseconds since g_epoch
+  uint64_t end;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Single-producer ring of events
+///
+/// Only the owning thread writes. It fills the slot and then publishes it by
+/// advancing head with release order, so a reader that loads head with
+/// acquire order sees every published slot. Slots the writer may have reused
+/// while the reader was copying are detected from head and discarded.
+////////////////////////////////////////////////////////////////////////////////
+struct ThreadBuffer {
+  uint32_t id{0};
+  std::atomic<const char*> name{nullptr};
+  std::atomic<uint64_t> head{0};
+  Event events[CAPACITY];
+};
+
+const std::chrono::steady_clock::time_point g_epoch =
+  std::chrono::steady_clock::now();
+
+std::mutex g_registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers; ///< Never shrinks
+
+thread_local ThreadBuffer* t_buffer = nullptr;
+
+ThreadBuffer* registerBuffer(const char* _name) {
+  std::lock_guard<std::mutex> lock(g_registryMutex);
+  g_buffers.emplace_back(new ThreadBuffer());
+  ThreadBuffer* buffer = g_buffers.back().get();
+  buffer->id = g_buffers.size();
+  buffer->name.store(_name, std::memory_order_release);
+  return buffer;
+}
+
+ThreadBuffer* threadBuffer() {
+  if (!t_buffer) {
+    t_buffer = registerBuffer(nullptr);
+  }
+  return t_buffer;
+}
+
+inline void append(ThreadBuffer* _buffer, const Event& _event) {
+  uint64_t head = _buffer->head.load(std::memory_order_relaxed);
+  _buffer->events[head & (CAPACITY - 1)] = _event;
+  _buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// GPU queries, only touched by the thread owning the GL context
+struct GpuQuery {
+  const char* name;
+  GLuint begin;
+  GLuint end;
+};
+
+std::vector<GpuQuery> g_gpuOpen;       ///< Scopes begun but not ended
+std::deque<GpuQuery> g_gpuPending;     ///< Ended, results not yet read
+std::vector<GLuint> g_gpuFree;
+ThreadBuffer* g_gpuBuffer = nullptr;   ///< Shown as its own thread
+int64_t g_gpuOffset{0};                ///< CPU minus GPU clock, nanoseconds
+bool g_gpuCalibrated{false};
+
+GLuint allocateQuery() {
+  if (g_gpuFree.empty()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+  GLuint query = g_gpuFree.back();
+  g_gpuFree.pop_back();
+  return query;
+}
+
+void writeEscaped(std::ostream& _os, const char* _s) {
+  for (; *_s; ++_s) {
+    if (*_s == '"' || *_s == '\\') {
+      _os << '\\';
+    }
+    _os << *_s;
+  }
+}
+
+}
+
+namespace Profiler {
+
+std::atomic<bool> g_enabled{false};
+
+void setEnabled(bool _enabled) {
+  g_enabled.store(_enabled, std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Nanoseconds since the program started, on a monotonic clock
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+void record(const char* _name, uint64_t _start, uint64_t _end) {
+  append(threadBuffer(), {_name, _start, _end});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Name the calling thread in dumps
+/// @param _name String literal
+void setThreadName(const char* _name) {
+  threadBuffer()->name.store(_name, std::memory_order_release);
+}
+
+void beginGpu(const char* _name) {
+  GLuint query = allocateQuery();
+  glQueryCounter(query, GL_TIMESTAMP);
+  g_gpuOpen.push_back({_name, query, 0});
+}
+
+void endGpu() {
+  if (g_gpuOpen.empty()) {
+    return;
+  }
+  GpuQuery query = g_gpuOpen.back();
+  g_gpuOpen.pop_back();
+  query.end = allocateQuery();
+  glQueryCounter(query.end, GL_TIMESTAMP);
+  g_gpuPending.push_back(query);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Record GPU scopes whose queries completed; call once per frame
+///
+/// GPU timestamps are moved onto the CPU clock with an offset measured once,
+/// so GPU work lines up with the CPU scopes that issued it.
+void collectGpu() {
+
+  if (g_gpuPending.empty()) {
+    return;
+  }
+
+  if (!g_gpuCalibrated) {
+    GLint64 gpu = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu);
+    g_gpuOffset = int64_t(now()) - int64_t(gpu);
+    g_gpuBuffer = registerBuffer("GPU");
+    g_gpuCalibrated = true;
+  }
+
+  // Queries complete in submission order
+  while (!g_gpuPending.empty()) {
+    GpuQuery& query = g_gpuPending.front();
+
+    GLint available = 0;
+    glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+    append(g_gpuBuffer, {query.name, uint64_t(int64_t(begin) + g_gpuOffset),
+      uint64_t(int64_t(end) + g_gpuOffset)});
+
+    g_gpuFree.push_back(query.begin);
+    g_gpuFree.push_back(query.end);
+    g_gpuPending.pop_front();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Write the recorded events as a Chrome trace_event JSON file
+/// @param _filename Output file, for chrome://tracing or Perfetto
+/// @return False if the file could not be written
+bool dump(const std::string& _filename) {
+
+  std::ofstream ofs(_filename);
+  if (!ofs) {
+    return false;
+  }
+
+  std::vector<Event> events;
+  size_t total = 0;
+  bool first = true;
+
+  ofs << std::fixed << std::setprecision(3);
+  ofs << "{\"traceEvents\":[\n";
+
+  std::lock_guard<std::mutex> lock(g_registryMutex);
+  for (const std::unique_ptr<ThreadBuffer>& buffer : g_buffers) {
+
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t begin = head > CAPACITY ? head - CAPACITY : 0;
+
+    events.clear();
+    for (uint64_t i = begin; i < head; ++i) {
+      events.push_back(buffer->events[i & (CAPACITY - 1)]);
+    }
+
+    // Drop slots overwritten, or being overwritten, during the copy
+    uint64_t after = buffer->head.load(std::memory_order_acquire);
+    uint64_t valid = after >= CAPACITY ? after - CAPACITY + 1 : 0;
+    size_t skip = valid > begin ? std::min<uint64_t>(valid - begin, events.size()) : 0;
+
+    const char* name = buffer->name.load(std::memory_order_acquire);
+    ofs << (first ? "" : ",\n")
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << buffer->id << ",\"args\":{\"name\":\"";
+    if (name) {
+      writeEscaped(ofs, name);
+    } else {
+      ofs << "Thread " << buffer->id;
+    }
+    ofs << "\"}}";
+    first = false;
+
+    for (size_t i = skip; i < events.size(); ++i) {
+      const Event& e = events[i];
+      ofs << ",\n{\"name\":\"";
+      writeEscaped(ofs, e.name);
+      ofs << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+          << ",\"ts\":" << e.start / 1000.0
+          << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+    }
+    total += events.size() - skip;
+  }
+
+  ofs << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  std::cout << "Profiler: wrote " << total << " events to " << _filename
+    << std::endl;
+  return bool(ofs);
+}
+
+}
+
+#endif
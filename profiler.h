@@ -0,0 +1,117 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Scoped CPU and GPU timers recorded for Chrome's trace viewer
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+// STL
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// GL
+#include "GLInclude.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Process-wide event recorder
+///
+/// Each thread appends to its own fixed-size ring buffer, so recording takes
+/// no lock; only the oldest events are lost when a buffer wraps. dump() may
+/// run while other threads record. Event names must be string literals, as
+/// only the pointer is stored.
+///
+/// Recording starts disabled, and a disabled scope costs one relaxed load.
+/// Building with -DPROFILER_DISABLED removes the scopes entirely.
+////////////////////////////////////////////////////////////////////////////////
+namespace Profiler {
+
+  extern std::atomic<bool> g_enabled;
+
+  inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+  }
+  void setEnabled(bool _enabled);
+
+  uint64_t now();
+  void record(const char* _name, uint64_t _start, uint64_t _end);
+  void setThreadName(const char* _name);
+
+  void beginGpu(const char* _name);
+  void endGpu();
+  void collectGpu();
+
+  bool dump(const std::string& _filename);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Records the time from construction to destruction
+////////////////////////////////////////////////////////////////////////////////
+class ProfileScope {
+
+  public:
+
+    explicit ProfileScope(const char* _name) :
+      m_name(Profiler::enabled() ? _name : nullptr),
+      m_start(m_name ? Profiler::now() : 0) {}
+
+    ~ProfileScope() {
+      if (m_name) {
+        Profiler::record(m_name, m_start, Profiler::now());
+      }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+  private:
+
+    const char* m_name;
+    uint64_t m_start;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Records the GPU time of the commands issued during its lifetime
+///
+/// Only for the thread owning the GL context. Results arrive a few frames
+/// later, when collectGpu() finds the queries complete.
+////////////////////////////////////////////////////////////////////////////////
+class GpuProfileScope {
+
+  public:
+
+    explicit GpuProfileScope(const char* _name) :
+      m_active(Profiler::enabled()) {
+      if (m_active) {
+        Profiler::beginGpu(_name);
+      }
+    }
+
+    ~GpuProfileScope() {
+      if (m_active) {
+        Profiler::endGpu();
+      }
+    }
+
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+  private:
+
+    bool m_active;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if defined(PROFILER_DISABLED)
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) \
+  GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __RADIXSORT_CPP__
+#define __RADIXSORT_CPP__
+
+#include "radixsort.h"
+
+// STL
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Insertion sort keys that are nearly in order
+/// @return Whether they are sorted; false if the budget of moves ran out,
+///         leaving them partly sorted
+bool RadixSort::insertion(std::vector<uint32_t>& _keys,
+                          std::vector<uint32_t>& _values) const {
+
+  size_t budget = MOVES * _keys.size();
+  for (size_t i = 1; i < _keys.size(); ++i) {
+    uint32_t key = _keys[i];
+    if (key >= _keys[i - 1]) {
+      continue;
+    }
+
+    uint32_t value = _values[i];
+    size_t j = i;
+    do {
+      if (budget-- == 0) {
+        // Put back what is in hand, keeping the pairs together
+        _keys[j] = key;
+        _values[j] = value;
+        return false;
+      }
+      _keys[j] = _keys[j - 1];
+      _values[j] = _values[j - 1];
+      --j;
+    } while (j > 0 && key < _keys[j - 1]);
+    _keys[j] = key;
+    _values[j] = value;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sort values by their keys, smallest first, keeping ties in order
+/// @param _keys   Key of each value, sorted along
+/// @param _values Values to sort
+void RadixSort::sort(std::vector<uint32_t>& _keys,
+                     std::vector<uint32_t>& _values) {
+
+  const size_t count = _keys.size();
+  m_radix = false;
+
+  size_t descents = 0;
+  for (size_t i = 1; i < count; ++i) {
+    descents += _keys[i] < _keys[i - 1];
+  }
+  if (descents == 0) {
+    return;
+  }
+  if (descents * DESCENTS <= count && insertion(_keys, _values)) {
+    return;
+  }
+  m_radix = true;
+
+  const uint32_t mask = (1u << BITS) - 1;
+  std::memset(m_counts, 0, sizeof(m_counts));
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t key = _keys[i];
+    for (int pass = 0; pass < PASSES; ++pass) {
+      m_counts[pass][(key >> (BITS * pass)) & mask]++;
+    }
+  }
+
+  m_keys.resize(count);
+  m_values.resize(count);
+
+  for (int pass = 0; pass < PASSES; ++pass) {
+    const int shift = BITS * pass;
+    uint32_t* counts = m_counts[pass];
+
+    // A digit shared by every key leaves the order as it is
+    if (counts[(_keys[0] >> shift) & mask] == count) {
+      continue;
+    }
+
+    // Counts to offsets
+    uint32_t offset = 0;
+    for (uint32_t d = 0; d <= mask; ++d) {
+      uint32_t n = counts[d];
+      counts[d] = offset;
+      offset += n;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      uint32_t key = _keys[i];
+      uint32_t slot = counts[(key >> shift) & mask]++;
+      m_keys[slot] = key;
+      m_values[slot] = _values[i];
+    }
+
+    _keys.swap(m_keys);
+    _values.swap(m_values);
+  }
+}
+
+#endif
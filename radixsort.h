@@ -0,0 +1,59 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Stable sort of 32-bit keys that reuses its memory across calls
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __RADIXSORT_H__
+#define __RADIXSORT_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sorts values by 32-bit keys, for orders that change a little from
+///        call to call
+///
+/// Keys already in order are left alone. Keys with few descents are
+/// insertion sorted, up to a budget of moves, which catches orders that moved
+/// a little since the last call. Otherwise, or once the budget runs out, an
+/// LSD radix sort runs three 11-bit passes, all histograms taken in one read,
+/// and skips the passes whose digit is the same for every key. The passes
+/// ping-pong with buffers kept between calls, so once they are as large as
+/// the largest input nothing is allocated.
+////////////////////////////////////////////////////////////////////////////////
+class RadixSort {
+
+  public:
+
+    static const int BITS = 11;         ///< Digit width of a pass
+    static const int PASSES = 3;        ///< Digits in a key
+    static const size_t DESCENTS = 64;  ///< Keys per descent, at least, for an
+                                        ///< insertion sort to be tried
+    static const size_t MOVES = 4;      ///< Insertion moves per key before
+                                        ///< giving up on it
+
+    void sort(std::vector<uint32_t>& _keys, std::vector<uint32_t>& _values);
+
+    /// Key of a float that sorts as the float does
+    static uint32_t key(float _f) {
+      uint32_t bits;
+      std::memcpy(&bits, &_f, sizeof(bits));
+      return bits ^ (bits & 0x80000000u ? 0xffffffffu : 0x80000000u);
+    }
+
+    bool radix() const { return m_radix; }
+
+  private:
+
+    bool insertion(std::vector<uint32_t>& _keys,
+                   std::vector<uint32_t>& _values) const;
+
+    std::vector<uint32_t> m_keys;   ///< Ping-pong buffers of the passes
+    std::vector<uint32_t> m_values;
+    uint32_t m_counts[PASSES][1 << BITS]; ///< Histogram of each digit
+    bool m_radix{false};            ///< Whether the last sort was a radix sort
+};
+
+#endif
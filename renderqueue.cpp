@@ -0,0 +1,126 @@
+#ifndef __RENDERQUEUE_CPP__
+#define __RENDERQUEUE_CPP__
+
+#include "renderqueue.h"
+
+// STL
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Quantize a view-space distance into the low bits of a sort key
+/// @param _viewDepth Distance along the view direction
+/// @param _near Near plane distance
+/// @param _far Far plane distance
+/// @return Depth bits, increasing with distance
+uint64_t SortKey::depth(float _viewDepth, float _near, float _far) {
+  float t = (_viewDepth - _near) / (_far - _near);
+  t = std::min(std::max(t, 0.0f), 1.0f);
+  return (uint64_t)(t * ((1u << DepthBits) - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Add a worker's packets, pointing its items at the merged instances
+void RenderQueue::append(const CommandBuffer& _commands) {
+
+  const uint32_t base = m_instances.size();
+  m_instances.insert(m_instances.end(), _commands.instances.begin(),
+    _commands.instances.end());
+
+  for (const RenderItem& item : _commands.items) {
+    m_items.push_back({item.key, item.batch, base + item.instance});
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sort items by key, least significant byte first
+///
+/// All eight byte histograms are built in one pass over the keys. A byte that
+/// is equal in every key cannot change the order, so its pass is skipped;
+/// since most key fields are only a few bits wide, typically only three or
+/// four of the eight passes run.
+void RenderQueue::sort() {
+
+  const size_t count = m_items.size();
+  if (count < 2) {
+    return;
+  }
+
+  size_t histogram[8][256];
+  std::fill(&histogram[0][0], &histogram[0][0] + 8 * 256, 0);
+
+  for (const RenderItem& item : m_items) {
+    for (int pass = 0; pass < 8; ++pass) {
+      histogram[pass][(item.key >> (pass * 8)) & 0xff]++;
+    }
+  }
+
+  m_scratch.resize(count);
+  RenderItem* src = m_items.data();
+  RenderItem* dst = m_scratch.data();
+
+  for (int pass = 0; pass < 8; ++pass) {
+    size_t* h = histogram[pass];
+
+    if (h[(src[0].key >> (pass * 8)) & 0xff] == count) {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (int b = 0; b < 256; ++b) {
+      size_t c = h[b];
+      h[b] = offset;
+      offset += c;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      dst[h[(src[i].key >> (pass * 8)) & 0xff]++] = src[i];
+    }
+
+    std::swap(src, dst);
+  }
+
+  if (src != m_items.data()) {
+    std::copy(src, src + count, m_items.data());
+  }
+}
+
+GLStateCache::GLStateCache() {
+  reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Forget the shadowed state, e.g. after other code changed bindings
+void GLStateCache::reset() {
+  m_program = 0;
+  std::fill(m_textures, m_textures + Units, GLuint(-1));
+  m_activeUnit = GLuint(-1);
+  textureBinds = 0;
+  skippedBinds = 0;
+}
+
+void GLStateCache::useProgram(GLuint _program) {
+  if (_program != m_program) {
+    glUseProgram(_program);
+    m_program = _program;
+  }
+}
+
+void GLStateCache::bindTexture(GLuint _unit, GLuint _texture) {
+  if (_unit < Units && m_textures[_unit] == _texture) {
+    skippedBinds++;
+    return;
+  }
+
+  if (_unit != m_activeUnit) {
+    glActiveTexture(GL_TEXTURE0 + _unit);
+    m_activeUnit = _unit;
+  }
+  glBindTexture(GL_TEXTURE_2D, _texture);
+  textureBinds++;
+
+  if (_unit < Units) {
+    m_textures[_unit] = _texture;
+  }
+}
+
+#endif
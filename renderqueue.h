@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Sorted draw submission with redundant GL state elimination
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+// STL
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "frustum.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Packing of the 64-bit draw sort key
+///
+/// From most to least significant: program, texture set, material, mesh and
+/// quantized view depth. Sorting the keys groups draws by the most expensive
+/// state first, keeps every instance of a mesh contiguous, and orders each
+/// mesh's instances front to back so early depth rejection works.
+///
+/// Ids wider than their field are masked, so past 4096 materials or batches
+/// unrelated draws may share a field and sort together. That only costs
+/// state changes: the replay compares the batches' full ids, never the
+/// fields, to decide what to rebind.
+////////////////////////////////////////////////////////////////////////////////
+namespace SortKey {
+
+  const int DepthBits = 16;
+  const int MeshBits = 12;
+  const int MaterialBits = 12;
+  const int TextureBits = 16;
+  const int ProgramBits = 4;
+
+  const int MeshShift = DepthBits;
+  const int MaterialShift = MeshShift + MeshBits;
+  const int TextureShift = MaterialShift + MaterialBits;
+  const int ProgramShift = TextureShift + TextureBits;
+
+  inline uint64_t field(uint64_t _value, int _bits, int _shift) {
+    return (_value & ((uint64_t(1) << _bits) - 1)) << _shift;
+  }
+
+  inline uint64_t make(uint32_t _program, uint32_t _textureSet,
+                       uint32_t _material, uint32_t _mesh) {
+    return field(_program, ProgramBits, ProgramShift) |
+           field(_textureSet, TextureBits, TextureShift) |
+           field(_material, MaterialBits, MaterialShift) |
+           field(_mesh, MeshBits, MeshShift);
+  }
+
+  inline uint32_t program(uint64_t _key) {
+    return (_key >> ProgramShift) & ((1u << ProgramBits) - 1);
+  }
+  inline uint32_t textureSet(uint64_t _key) {
+    return (_key >> TextureShift) & ((1u << TextureBits) - 1);
+  }
+  inline uint32_t material(uint64_t _key) {
+    return (_key >> MaterialShift) & ((1u << MaterialBits) - 1);
+  }
+
+  uint64_t depth(float _viewDepth, float _near, float _far);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Texture bound to each of the six material units
+////////////////////////////////////////////////////////////////////////////////
+struct TextureSet {
+  GLuint units[6];
+
+  bool operator<(const TextureSet& _other) const {
+    return std::memcmp(units, _other.units, sizeof(units)) < 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Everything installMaterials uploads, so equal materials share an id
+////////////////////////////////////////////////////////////////////////////////
+struct MaterialState {
+  float values[5];  ///< Ambient rgba and shininess
+  int flags;        ///< Has-texture bits and the light source flag
+
+  bool operator<(const MaterialState& _other) const {
+    int c = std::memcmp(values, _other.values, sizeof(values));
+    return c != 0 ? c < 0 : flags < _other.flags;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Assigns small consecutive ids to distinct values for sort keys
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+class InternTable {
+
+  public:
+
+    uint32_t intern(const T& _value) {
+      auto it = m_ids.find(_value);
+      if (it != m_ids.end()) {
+        return it->second;
+      }
+      uint32_t id = m_ids.size();
+      m_ids[_value] = id;
+      return id;
+    }
+
+    size_t size() const { return m_ids.size(); }
+
+  private:
+
+    std::map<T, uint32_t> m_ids;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Per-instance vertex data, attribute locations 3-7
+////////////////////////////////////////////////////////////////////////////////
+struct InstanceData {
+  glm::mat4 model; ///< Locations 3-6
+  glm::vec4 color; ///< Location 7
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief One visible object waiting to be drawn
+////////////////////////////////////////////////////////////////////////////////
+struct RenderItem {
+  uint64_t key;
+  uint32_t batch;     ///< Index of the instance batch
+  uint32_t instance;  ///< Index of the instance data in the same queue
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Draw packets recorded by one worker thread
+///
+/// Each recording task owns one buffer, so recording needs no locks. Items
+/// are small enough to sort; the instance data they point to is only copied
+/// once more, when the GL thread streams it.
+////////////////////////////////////////////////////////////////////////////////
+struct CommandBuffer {
+  std::vector<RenderItem> items;
+  std::vector<InstanceData> instances;
+  CullStats stats;  ///< Of the objects this buffer's task culled
+
+  void clear() {
+    items.clear();
+    instances.clear();
+    stats = CullStats();
+  }
+
+  void push(uint64_t _key, uint32_t _batch, const InstanceData& _instance) {
+    items.push_back({_key, _batch, uint32_t(instances.size())});
+    instances.push_back(_instance);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Per-frame list of draws, sorted by key with an LSD radix sort
+///
+/// Storage is kept between frames so steady-state frames do not allocate.
+////////////////////////////////////////////////////////////////////////////////
+class RenderQueue {
+
+  public:
+
+    void clear() {
+      m_items.clear();
+      m_instances.clear();
+    }
+    void append(const CommandBuffer& _commands);
+    void sort();
+
+    const std::vector<RenderItem>& items() const { return m_items; }
+    const std::vector<InstanceData>& instances() const { return m_instances; }
+
+  private:
+
+    std::vector<RenderItem> m_items;
+    std::vector<RenderItem> m_scratch;
+    std::vector<InstanceData> m_instances;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Shadow copy of bound GL state, so unchanged state is not resent
+////////////////////////////////////////////////////////////////////////////////
+class GLStateCache {
+
+  public:
+
+    GLStateCache();
+
+    void reset();
+    void useProgram(GLuint _program);
+    void bindTexture(GLuint _unit, GLuint _texture);
+
+    size_t textureBinds{0};    ///< glBindTexture calls issued since reset
+    size_t skippedBinds{0};    ///< glBindTexture calls avoided since reset
+
+  private:
+
+    static const int Units = 8;
+
+    GLuint m_program;
+    GLuint m_textures[Units];
+    GLuint m_activeUnit;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define __SCENE_CPP__
 
 // STL
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
@@ -16,6 +17,7 @@
 #include <glm/ext.hpp>
 
 #include "scene.h"
+#include "profiler.h"
 
 Scene::Scene() {}
 Scene::~Scene() {}
@@ -49,30 +51,36 @@ void Scene::addCamera(Camera& cam) {
   camera = cam;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Trace one ray per pixel into the framebuffer
+///
+/// Pixels are visited in square tiles, each timed as one profiler scope, so
+/// traces show where the expensive parts of the image are.
 void Scene::rayTracer(std::unique_ptr<glm::vec4[]> & frame, int pixelX, int pixelY) {
 
-  int x = -1;
-  int y = -1;
+  const int tile = 32;
+  const bool perspective = camera.getCameraView().compare("perspective") == 0;
 
-  for (int i = 0; i < pixelX*pixelY; ++i) {
+  for (int tileY = 0; tileY < pixelY; tileY += tile) {
+    for (int tileX = 0; tileX < pixelX; tileX += tile) {
 
-    x++;
+      PROFILE_SCOPE("Trace tile");
 
-    if (i % (pixelX) == 0) {
-      y++;
-      x = 0;
-    }
-
-    Ray ray = Ray();
+      for (int y = tileY; y < std::min(tileY + tile, pixelY); ++y) {
+        for (int x = tileX; x < std::min(tileX + tile, pixelX); ++x) {
 
-    if (camera.getCameraView().compare("perspective") == 0) {
-      ray = camera.makePerspectiveViewRay(x, y);
-    } else {
-      ray = camera.makeParallelViewRay(x, y);
-    }
+          Ray ray = Ray();
 
-    frame[i] = trace(ray, 5);
+          if (perspective) {
+            ray = camera.makePerspectiveViewRay(x, y);
+          } else {
+            ray = camera.makeParallelViewRay(x, y);
+          }
 
+          frame[y * pixelX + x] = trace(ray, 5);
+        }
+      }
+    }
   }
 }
 
@@ -0,0 +1,331 @@
+#ifndef __SCENEBVH_CPP__
+#define __SCENEBVH_CPP__
+
+#include "scenebvh.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "object.h"
+#include "particlesystem.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+namespace {
+
+const size_t CHUNK = 4096;  ///< Particles swept by one pool task
+const int STACK = 64;       ///< Deepest traversal; the tree is balanced
+const float SKIN = 1e-3f;   ///< Gap left between a stopped particle and a face
+
+/// @brief Whether a moving point, within the first _limit of its motion,
+///        comes within _radius of a box
+bool reaches(const glm::vec3& _min, const glm::vec3& _max,
+             const glm::vec3& _from, const glm::vec3& _motion, float _radius,
+             float _limit) {
+
+  float t0 = 0.0f;
+  float t1 = _limit;
+  for (int a = 0; a < 3; ++a) {
+    float lo = _min[a] - _radius;
+    float hi = _max[a] + _radius;
+    if (std::fabs(_motion[a]) < 1e-12f) {
+      if (_from[a] < lo || _from[a] > hi) {
+        return false;
+      }
+      continue;
+    }
+    float inv = 1.0f / _motion[a];
+    float near = (lo - _from[a]) * inv;
+    float far = (hi - _from[a]) * inv;
+    if (near > far) {
+      std::swap(near, far);
+    }
+    t0 = std::max(t0, near);
+    t1 = std::min(t1, far);
+    if (t0 > t1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Rebuild the hierarchy from the objects' current meshes
+/// @param _objects Objects whose meshes are loaded
+void SceneBVH::build(const std::vector<std::shared_ptr<Object>>& _objects) {
+
+  PROFILE_SCOPE("Build scene BVH");
+
+  std::vector<Triangle> triangles;
+  std::vector<glm::vec3> centroids;
+
+  for (const std::shared_ptr<Object>& object : _objects) {
+    if (!object->asset || object->isSkyBox) {
+      continue;
+    }
+
+    const mesh& data = object->asset->data;
+    const vertex* vertices = data.vertexData();
+    const uint32_t* indices = data.indexed() ? data.indexData() : nullptr;
+    const size_t count = indices ? data.indexCount() : data.vertexCount();
+
+    for (size_t t = 0; t + 2 < count; t += 3) {
+      glm::vec3 v[3];
+      for (int k = 0; k < 3; ++k) {
+        const vertex& source = vertices[indices ? indices[t + k] : t + k];
+        v[k] = glm::vec3(object->modelMatrix * glm::vec4(source.m_p, 1.0f));
+      }
+
+      Triangle triangle;
+      triangle.v0 = v[0];
+      triangle.e1 = v[1] - v[0];
+      triangle.e2 = v[2] - v[0];
+
+      glm::vec3 normal = glm::cross(triangle.e1, triangle.e2);
+      float area = glm::length(normal);
+      if (area < 1e-12f) {
+        continue;
+      }
+      triangle.normal = normal / area;
+      triangle.d00 = glm::dot(triangle.e1, triangle.e1);
+      triangle.d01 = glm::dot(triangle.e1, triangle.e2);
+      triangle.d11 = glm::dot(triangle.e2, triangle.e2);
+      triangle.invDenom = 1.0f / (triangle.d00 * triangle.d11 -
+                                  triangle.d01 * triangle.d01);
+
+      triangles.push_back(triangle);
+      centroids.push_back((v[0] + v[1] + v[2]) / 3.0f);
+    }
+  }
+
+  m_nodes.clear();
+  m_triangles.clear();
+  if (triangles.empty()) {
+    return;
+  }
+
+  std::vector<uint32_t> order(triangles.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+
+  m_triangles.swap(triangles);
+  m_nodes.reserve(2 * m_triangles.size() / LEAF + 1);
+  split(0, uint32_t(order.size()), centroids, order);
+
+  // Leaves index the triangles in split order
+  triangles.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    triangles[i] = m_triangles[order[i]];
+  }
+  m_triangles.swap(triangles);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Add the node of some triangles, and below it their subtree
+/// @param _begin       First triangle, in _order
+/// @param _end         One past the last
+/// @param _centroids   Triangle centers, by triangle
+/// @param _order       Triangles, partitioned in place
+void SceneBVH::split(uint32_t _begin, uint32_t _end,
+                     const std::vector<glm::vec3>& _centroids,
+                     std::vector<uint32_t>& _order) {
+
+  const uint32_t index = uint32_t(m_nodes.size());
+  m_nodes.emplace_back();
+
+  Node node;
+  node.min = glm::vec3(std::numeric_limits<float>::max());
+  node.max = glm::vec3(-std::numeric_limits<float>::max());
+  glm::vec3 low = node.min;
+  glm::vec3 high = node.max;
+
+  for (uint32_t i = _begin; i < _end; ++i) {
+    const Triangle& t = m_triangles[_order[i]];
+    for (const glm::vec3& v : { t.v0, t.v0 + t.e1, t.v0 + t.e2 }) {
+      node.min = glm::min(node.min, v);
+      node.max = glm::max(node.max, v);
+    }
+    low = glm::min(low, _centroids[_order[i]]);
+    high = glm::max(high, _centroids[_order[i]]);
+  }
+
+  if (_end - _begin <= LEAF) {
+    node.first = _begin;
+    node.count = _end - _begin;
+    m_nodes[index] = node;
+    return;
+  }
+
+  glm::vec3 extent = high - low;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                 : (extent.y > extent.z ? 1 : 2);
+
+  uint32_t middle = _begin + (_end - _begin) / 2;
+  std::nth_element(_order.begin() + _begin, _order.begin() + middle,
+    _order.begin() + _end, [&](uint32_t _a, uint32_t _b) {
+      return _centroids[_a][axis] < _centroids[_b][axis];
+    });
+
+  split(_begin, middle, _centroids, _order);
+  node.first = uint32_t(m_nodes.size());
+  node.count = 0;
+  split(middle, _end, _centroids, _order);
+  m_nodes[index] = node;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Whether a point projects onto a triangle's face
+bool SceneBVH::inside(const Triangle& _tri, const glm::vec3& _point,
+                      const glm::vec3& _normal) {
+
+  glm::vec3 v = _point - _tri.v0;
+  v -= _normal * glm::dot(_normal, v);
+  float d20 = glm::dot(v, _tri.e1);
+  float d21 = glm::dot(v, _tri.e2);
+  float b1 = (_tri.d11 * d20 - _tri.d01 * d21) * _tri.invDenom;
+  float b2 = (_tri.d00 * d21 - _tri.d01 * d20) * _tri.invDenom;
+  return b1 >= 0.0f && b2 >= 0.0f && b1 + b2 <= 1.0f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Find the earliest face a moving sphere touches
+/// @param _from   Center at the start of the motion
+/// @param _motion Displacement of the center over the tick
+/// @param _radius Radius of the sphere
+/// @param _hit    Set to the contact, as a fraction of the motion
+/// @return Whether some face is touched
+bool SceneBVH::sweep(const glm::vec3& _from, const glm::vec3& _motion,
+                     float _radius, Hit& _hit) const {
+
+  _hit.t = 1.0f;
+  bool found = false;
+
+  uint32_t stack[STACK];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    const Node& node = m_nodes[stack[--top]];
+    if (!reaches(node.min, node.max, _from, _motion, _radius, _hit.t)) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      // The first child is next to its parent
+      stack[top++] = node.first;
+      stack[top++] = uint32_t(&node - m_nodes.data()) + 1;
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+      const Triangle& tri = m_triangles[i];
+
+      // Signed distances of the start and the end from the plane, seen from
+      // the side the particle starts on
+      glm::vec3 normal = tri.normal;
+      float s0 = glm::dot(normal, _from - tri.v0);
+      float s1 = s0 + glm::dot(normal, _motion);
+      if (s0 < 0.0f) {
+        normal = -normal;
+        s0 = -s0;
+        s1 = -s1;
+      }
+
+      float t;
+      if (s0 >= _radius) {
+        if (s1 >= _radius) {
+          continue;
+        }
+        t = (s0 - _radius) / (s0 - s1);
+      } else if (s1 < s0) {
+        t = 0.0f; // Already touching, and moving in
+      } else {
+        continue;
+      }
+      if (t >= _hit.t) {
+        continue;
+      }
+
+      // The touching point must be on the face. Where it falls off an edge,
+      // the center crossing the face still counts, so that nothing slips
+      // through the seams of a mesh
+      if (!inside(tri, _from + t * _motion, normal)) {
+        if (s1 >= 0.0f) {
+          continue;
+        }
+        t = s0 / (s0 - s1);
+        if (t >= _hit.t || !inside(tri, _from + t * _motion, normal)) {
+          continue;
+        }
+      }
+
+      _hit.t = t;
+      _hit.normal = normal;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Stop the particles that ran into the scene during the last update,
+///        and bounce them
+/// @param _pool      Workers
+/// @param _particles Pool just updated, its previous positions still at the
+///                   start of the tick
+/// @param _bounce    Restitution: the share of the normal speed kept
+/// @param _friction  Share of the tangential speed lost
+void SceneBVH::collide(ThreadPool& _pool, ParticlePool& _particles,
+                       float _bounce, float _friction) const {
+
+  if (m_nodes.empty() || _particles.Count() == 0) {
+    return;
+  }
+
+  PROFILE_SCOPE("Scene collisions");
+
+  _pool.parallelFor(_particles.Count(), CHUNK,
+    [&](size_t _begin, size_t _end) {
+      for (size_t i = _begin; i < _end; ++i) {
+
+        glm::vec3 from(_particles.PreviousX[i], _particles.PreviousY[i],
+                       _particles.PreviousZ[i]);
+        glm::vec3 motion = _particles.Position(i) - from;
+        if (motion == glm::vec3(0.0f)) {
+          continue;
+        }
+
+        // The cube drawn has the particle's current size as its edge
+        float life = _particles.LifeRemaining[i] / _particles.LifeTime[i];
+        float size = _particles.SizeEnd[i] +
+                     (_particles.SizeBegin[i] - _particles.SizeEnd[i]) * life;
+
+        Hit hit;
+        if (!sweep(from, motion, 0.5f * std::fabs(size), hit)) {
+          continue;
+        }
+
+        glm::vec3 stop = from + hit.t * motion + hit.normal * SKIN;
+        _particles.PositionX[i] = stop.x;
+        _particles.PositionY[i] = stop.y;
+        _particles.PositionZ[i] = stop.z;
+
+        glm::vec3 velocity = _particles.Velocity(i);
+        float normalSpeed = glm::dot(velocity, hit.normal);
+        glm::vec3 tangent = velocity - normalSpeed * hit.normal;
+        if (normalSpeed < 0.0f) {
+          normalSpeed = -normalSpeed * _bounce;
+        }
+        _particles.SetVelocity(i, tangent * (1.0f - _friction) +
+                                  normalSpeed * hit.normal);
+      }
+    });
+}
+
+#endif
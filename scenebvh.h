@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Bounding volume hierarchy of the scene's triangles, for particles
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __SCENEBVH_H__
+#define __SCENEBVH_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+class Object;
+class ThreadPool;
+struct ParticlePool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Static BVH over the world space triangles of the loaded objects,
+///        which particles bounce off
+///
+/// Built from the same mesh data setupVertices has the loader upload, moved
+/// by each object's model matrix; planes and spheres of GLFW scenes are
+/// meshes too. Nodes split their triangles at the median of the longest axis
+/// of the centroids, down to LEAF triangles, and are laid out depth first.
+///
+/// Each tick, every particle sweeps a sphere of half its size from its
+/// previous position to its new one. The earliest face it touches, from
+/// either side, stops it there; the velocity's normal part is reflected and
+/// scaled by the restitution, and its tangential part is scaled down by the
+/// friction. Edges and corners are not swept: a particle grazing one without
+/// touching a face passes, and one whose center crosses a face next to an
+/// edge is stopped where it crosses. Particles are independent, so a pool is
+/// queried in chunks on the thread pool.
+////////////////////////////////////////////////////////////////////////////////
+class SceneBVH {
+
+  public:
+
+    static const size_t LEAF = 4; ///< Most triangles in a leaf
+
+    void build(const std::vector<std::shared_ptr<Object>>& _objects);
+
+    void collide(ThreadPool& _pool, ParticlePool& _particles, float _bounce,
+                 float _friction) const;
+
+    bool empty() const { return m_nodes.empty(); }
+    size_t triangles() const { return m_triangles.size(); }
+
+  private:
+
+    /// Triangle with what the plane and barycentric tests need
+    struct Triangle {
+      glm::vec3 v0;
+      glm::vec3 e1, e2;      ///< Edges from v0
+      glm::vec3 normal;      ///< Unit length
+      float d00, d01, d11;   ///< Dot products of the edges
+      float invDenom;
+    };
+
+    /// Leaves have count triangles from first; inner nodes have their first
+    /// child right after them and their second child at first
+    struct Node {
+      glm::vec3 min;
+      uint32_t first;
+      glm::vec3 max;
+      uint32_t count;
+    };
+
+    /// Earliest contact of a sweep
+    struct Hit {
+      float t;
+      glm::vec3 normal;      ///< Facing the particle's start
+    };
+
+    void split(uint32_t _begin, uint32_t _end,
+               const std::vector<glm::vec3>& _centroids,
+               std::vector<uint32_t>& _order);
+    static bool inside(const Triangle& _tri, const glm::vec3& _point,
+                       const glm::vec3& _normal);
+    bool sweep(const glm::vec3& _from, const glm::vec3& _motion, float _radius,
+               Hit& _hit) const;
+
+    std::vector<Triangle> m_triangles;
+    std::vector<Node> m_nodes;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __SCHEDULER_CPP__
+#define __SCHEDULER_CPP__
+
+#include "scheduler.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Constructor
+/// @param _tick Simulation timestep
+/// @param _framePeriod Minimum time between frames
+/// @param _maxSteps Most ticks one frame may run; beyond that the simulation
+///        slows down rather than spending ever longer catching up
+FrameScheduler::FrameScheduler(double _tick, double _framePeriod,
+                               int _maxSteps) :
+  m_tick(_tick), m_framePeriod(_framePeriod), m_maxSteps(_maxSteps) {}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start a frame
+/// @param _now Current time
+/// @return Number of simulation ticks to run before rendering
+int FrameScheduler::beginFrame(double _now) {
+
+  m_frameStart = _now;
+
+  if (m_previous < 0.0) {
+    m_previous = _now;
+    m_deadline = _now;
+  }
+
+  m_accumulator += _now - m_previous;
+  m_previous = _now;
+
+  int steps = int(m_accumulator / m_tick);
+  if (steps > m_maxSteps) {
+    m_droppedTicks += steps - m_maxSteps;
+    std::printf("Scheduler: dropped %d ticks after a %.1f ms stall\n",
+      steps - m_maxSteps, m_accumulator * 1000.0);
+    steps = m_maxSteps;
+    m_accumulator = std::fmod(m_accumulator, m_tick);
+  } else {
+    m_accumulator -= steps * m_tick;
+  }
+
+  // Schedule on a fixed grid so the frame rate does not drift; after a long
+  // frame, start again from now instead of running back-to-back frames
+  m_deadline += m_framePeriod;
+  if (m_deadline < _now) {
+    m_deadline = _now + m_framePeriod;
+  }
+
+  return steps;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Finish a frame and check it against the budget
+/// @param _now Current time, after the frame was submitted
+void FrameScheduler::endFrame(double _now) {
+  m_frameTime = _now - m_frameStart;
+  if (m_frameTime > m_framePeriod) {
+    m_overruns++;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Time left until the next frame is due, for the caller to sleep
+double FrameScheduler::waitTime(double _now) const {
+  return std::max(0.0, m_deadline - _now);
+}
+
+#endif
@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Frame pacing with a fixed simulation timestep
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+// STL
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Decides when frames start and how many simulation ticks each runs
+///
+/// Elapsed time is accumulated and consumed in fixed ticks, so the simulation
+/// behaves the same at any frame rate; the remainder gives the interpolation
+/// factor between the last two simulated states. Frames are paced to a fixed
+/// period and the caller sleeps until the next one is due instead of polling.
+///
+/// Times are in seconds on any monotonic clock, e.g. glfwGetTime().
+////////////////////////////////////////////////////////////////////////////////
+class FrameScheduler {
+
+  public:
+
+    FrameScheduler(double _tick, double _framePeriod, int _maxSteps);
+
+    int beginFrame(double _now);
+    void endFrame(double _now);
+
+    double waitTime(double _now) const;
+
+    double tick() const { return m_tick; }
+    float alpha() const { return float(m_accumulator / m_tick); }
+
+    size_t overruns() const { return m_overruns; }
+    size_t droppedTicks() const { return m_droppedTicks; }
+    double lastFrameTime() const { return m_frameTime; }
+
+  private:
+
+    double m_tick;          ///< Simulated seconds per step
+    double m_framePeriod;   ///< Target seconds between frame starts
+    int m_maxSteps;         ///< Steps per frame before time is dropped
+
+    double m_accumulator{0.0};
+    double m_previous{-1.0};  ///< Start of the last frame, -1 before the first
+    double m_deadline{0.0};   ///< When the next frame is due
+    double m_frameStart{0.0};
+    double m_frameTime{0.0};  ///< Work time of the last frame
+
+    size_t m_overruns{0};     ///< Frames whose work exceeded the period
+    size_t m_droppedTicks{0}; ///< Ticks skipped to catch up after stalls
+};
+
+#endif
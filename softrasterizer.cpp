@@ -0,0 +1,628 @@
+#ifndef __SOFTRASTERIZER_CPP__
+#define __SOFTRASTERIZER_CPP__
+
+#include "softrasterizer.h"
+
+// STL
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "occlusion.h"
+#include "profiler.h"
+#include "scene.h"
+#include "texturemanager.h"
+#include "threadpool.h"
+
+namespace {
+
+const uint32_t NO_TRIANGLE = 0xffffffffu;
+
+const glm::vec4 CLEAR_COLOR(0.1f, 0.0f, 0.2f, 0.0f); ///< As glClearColor
+const glm::vec4 FOG_COLOR(0.1f, 0.0f, 0.2f, 1.0f);
+
+/// @brief Component-wise power, for the shader's pow(result, vec3(e))
+glm::vec3 power(const glm::vec3& _v, float _e) {
+  return glm::vec3(std::pow(std::max(_v.x, 0.0f), _e),
+                   std::pow(std::max(_v.y, 0.0f), _e),
+                   std::pow(std::max(_v.z, 0.0f), _e));
+}
+
+}
+
+SoftwareRasterizer::SoftwareRasterizer(ThreadPool& _pool) : m_pool(_pool) {}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Bilinear lookup with repeat wrapping, as GL_REPEAT and GL_LINEAR
+/// @param _uv Texture coordinate; (0, 0) is the bottom left texel
+/// @return Color; gray maps fill RGB, and alpha is 1 if missing, as the
+///         swizzle of TextureManager::upload reads them
+glm::vec4 SoftwareRasterizer::Texture::sample(const glm::vec2& _uv) const {
+
+  if (pixels.empty()) {
+    return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  }
+
+  float u = _uv.x * width - 0.5f;
+  float v = _uv.y * height - 0.5f;
+  float fu = std::floor(u);
+  float fv = std::floor(v);
+  float tu = u - fu;
+  float tv = v - fv;
+
+  auto wrap = [](int _i, int _size) {
+    _i %= _size;
+    return _i < 0 ? _i + _size : _i;
+  };
+  int x0 = wrap(int(fu), width);
+  int x1 = wrap(int(fu) + 1, width);
+  int y0 = wrap(int(fv), height);
+  int y1 = wrap(int(fv) + 1, height);
+
+  auto texel = [this](int _x, int _y) {
+    const unsigned char* p = &pixels[(size_t(_y) * width + _x) * channels];
+    // Gray and gray-alpha images swizzle as TextureManager::upload sets up
+    if (channels <= 2) {
+      float gray = p[0] / 255.0f;
+      return glm::vec4(gray, gray, gray, channels == 2 ? p[1] / 255.0f : 1.0f);
+    }
+    glm::vec4 c(0.0f, 0.0f, 0.0f, 1.0f);
+    for (int k = 0; k < std::min(channels, 4); ++k) {
+      c[k] = p[k] / 255.0f;
+    }
+    return c;
+  };
+
+  glm::vec4 bottom = glm::mix(texel(x0, y0), texel(x1, y0), tu);
+  glm::vec4 top = glm::mix(texel(x0, y1), texel(x1, y1), tu);
+  return glm::mix(bottom, top, tv);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Look up a decoded material map
+/// @param _has Whether the material uses the map
+/// @param _path Image filename
+/// @return The map, or null if the material does not use it
+const SoftwareRasterizer::Texture*
+SoftwareRasterizer::texture(bool _has, const std::string& _path) const {
+
+  if (!_has) {
+    return nullptr;
+  }
+  auto found = m_textures.find(_path);
+  return found == m_textures.end() ? nullptr : found->second.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Decode, on the pool, the maps of the visible objects not seen yet
+///
+/// Maps are kept for the rasterizer's lifetime, so each is decoded once.
+void SoftwareRasterizer::loadTextures() {
+
+  std::vector<std::string> missing;
+  for (const Draw& draw : m_draws) {
+    const Material& m = draw.object->material;
+    const std::pair<bool, const std::string*> maps[] = {
+      {m.hasDiffuseTexture, &m.diffuseTexture},
+      {m.hasSpecularTexture, &m.specularTexture},
+      {m.hasEmissionTexture, &m.emissionTexture}};
+
+    for (const auto& map : maps) {
+      if (map.first && !m_textures.count(*map.second)) {
+        m_textures[*map.second] = nullptr;
+        missing.push_back(*map.second);
+      }
+    }
+  }
+
+  if (missing.empty()) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<Texture>> decoded(missing.size());
+  m_pool.parallelFor(missing.size(), 1, [&](size_t _begin, size_t _end) {
+    for (size_t i = _begin; i < _end; ++i) {
+      DecodedImage image;
+      decoded[i].reset(new Texture());
+      if (TextureManager::decode(missing[i], image)) {
+        decoded[i]->width = image.width;
+        decoded[i]->height = image.height;
+        decoded[i]->channels = image.channels;
+        decoded[i]->pixels = std::move(image.pixels);
+      }
+    }
+  });
+
+  for (size_t i = 0; i < missing.size(); ++i) {
+    if (decoded[i]->pixels.empty()) {
+      std::cout << "could not find texture file" << missing[i] << std::endl;
+    }
+    m_textures[missing[i]] = std::move(decoded[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Move the scene's lights into view space, as drawGLFW installs them
+void SoftwareRasterizer::prepareLights(const Scene& _scene) {
+
+  const glm::mat4& view = _scene.viewMatrix;
+  m_lights.clear();
+
+  for (const std::shared_ptr<DirectionalLight>& light : _scene.directionalLights) {
+    ShadedLight l;
+    l.position = glm::vec3(view * glm::vec4(light->position, 1.0f));
+    l.color = glm::vec3(light->color);
+    l.diffuse = glm::vec3(light->diffuseIntensity);
+    l.specular = glm::vec3(light->specularIntensity);
+    l.exponent = 2.2f;
+    l.attenuated = false;
+    l.spot = false;
+    m_lights.push_back(l);
+  }
+
+  for (const std::shared_ptr<PointLight>& light : _scene.pointLights) {
+    ShadedLight l;
+    l.position = glm::vec3(view * glm::vec4(light->position, 1.0f));
+    l.color = glm::vec3(light->color);
+    l.diffuse = glm::vec3(light->diffuseIntensity);
+    l.specular = glm::vec3(light->specularIntensity);
+    l.ac = light->ac;
+    l.al = light->al;
+    l.aq = light->aq;
+    l.exponent = 1.2f;
+    l.attenuated = true;
+    l.spot = false;
+    m_lights.push_back(l);
+  }
+
+  for (const std::shared_ptr<SpotLight>& light : _scene.spotLights) {
+    ShadedLight l;
+    l.position = glm::vec3(view * glm::vec4(light->position, 1.0f));
+    l.direction = glm::normalize(
+      glm::vec3(view * glm::vec4(glm::normalize(light->direction), 0.0f)));
+    l.color = glm::vec3(light->color);
+    l.diffuse = glm::vec3(light->diffuseIntensity);
+    l.specular = glm::vec3(light->specularIntensity);
+    l.ac = light->ac;
+    l.al = light->al;
+    l.aq = light->aq;
+    l.cutOff = std::cos(light->cutOffAngle);
+    l.outerCutOff = std::cos(light->outerCutOffAngle);
+    l.exponent = 0.8f;
+    l.attenuated = true;
+    l.spot = true;
+    m_lights.push_back(l);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Run the vertex stage over one object and set up its triangles
+/// @param _draw Index into m_draws
+/// @param _triangles Receives the triangles that reach the screen
+///
+/// Triangles are clipped against the near plane; the other planes are left
+/// to the screen bounds and the depth test.
+void SoftwareRasterizer::transform(size_t _draw,
+                                   std::vector<Triangle>& _triangles) const {
+
+  const Draw& draw = m_draws[_draw];
+  const mesh& data = draw.object->asset->data;
+
+  // inverse-transpose of the MV matrix, for transforming normal vectors
+  const glm::mat3 normalMatrix =
+    glm::transpose(glm::inverse(glm::mat3(draw.modelView)));
+
+  const vertex* vertices = data.vertexData();
+  const size_t vertexCount = data.vertexCount();
+
+  thread_local std::vector<ClipVertex> out;
+  out.resize(vertexCount);
+  for (size_t i = 0; i < vertexCount; ++i) {
+    ClipVertex& o = out[i];
+    glm::vec4 p = draw.modelView * glm::vec4(vertices[i].m_p, 1.0f);
+    o.clip = m_projection * p;
+    o.position = glm::vec3(p);
+    o.view = -glm::normalize(o.position);
+    o.normal = glm::normalize(normalMatrix * vertices[i].m_n);
+    o.uv = vertices[i].m_t;
+  }
+
+  const uint32_t* indices = data.indexData();
+  const size_t count = indices ? data.indexCount() : vertexCount;
+
+  for (size_t t = 0; t + 2 < count; t += 3) {
+
+    const ClipVertex* v[3];
+    int behind = 0;
+    for (int k = 0; k < 3; ++k) {
+      v[k] = &out[indices ? indices[t + k] : t + k];
+      behind += v[k]->clip.z < -v[k]->clip.w;
+    }
+
+    if (behind == 3) {
+      continue;
+    }
+    if (behind == 0) {
+      const ClipVertex triangle[3] = {*v[0], *v[1], *v[2]};
+      setup(triangle, uint32_t(_draw), _triangles);
+      continue;
+    }
+
+    // Walk the edges, keeping the vertices in front of the near plane and
+    // adding one where an edge crosses it; the result is a fan of one or two
+    // triangles
+    ClipVertex polygon[4];
+    int size = 0;
+    for (int k = 0; k < 3; ++k) {
+      const ClipVertex& a = *v[k];
+      const ClipVertex& b = *v[(k + 1) % 3];
+      float da = a.clip.z + a.clip.w;
+      float db = b.clip.z + b.clip.w;
+
+      if (da >= 0.0f) {
+        polygon[size++] = a;
+      }
+      if ((da >= 0.0f) != (db >= 0.0f)) {
+        float s = da / (da - db);
+        ClipVertex& c = polygon[size++];
+        c.clip = glm::mix(a.clip, b.clip, s);
+        c.position = glm::mix(a.position, b.position, s);
+        c.view = glm::mix(a.view, b.view, s);
+        c.normal = glm::mix(a.normal, b.normal, s);
+        c.uv = glm::mix(a.uv, b.uv, s);
+      }
+    }
+
+    for (int k = 1; k + 1 < size; ++k) {
+      const ClipVertex triangle[3] = {polygon[0], polygon[k], polygon[k + 1]};
+      setup(triangle, uint32_t(_draw), _triangles);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Set up one clipped triangle for rasterization
+///
+/// Triangles off screen or seen edge-on are dropped. Both windings are kept,
+/// as the GL path does not cull faces either.
+void SoftwareRasterizer::setup(const ClipVertex* _v, uint32_t _draw,
+                               std::vector<Triangle>& _triangles) const {
+
+  glm::vec3 s[3];
+  int order[3] = {0, 1, 2};
+  for (int k = 0; k < 3; ++k) {
+    s[k] = EdgeTriangle::toScreen(_v[k].clip, m_width, m_height);
+  }
+
+  Triangle t;
+  if (!t.setup(s, m_width, m_height, order)) {
+    return;
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    const ClipVertex& v = _v[order[k]];
+    t.invW[k] = 1.0f / v.clip.w;
+    t.position[k] = v.position;
+    t.view[k] = v.view;
+    t.normal[k] = v.normal;
+    t.uv[k] = v.uv;
+  }
+  t.draw = _draw;
+
+  _triangles.push_back(t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sort the triangles overlapping one row of tiles into its bins
+/// @param _row Tile row
+///
+/// Triangles keep their draw order within each bin.
+void SoftwareRasterizer::binRow(int _row) {
+
+  const int y0 = _row * TILE;
+  const int y1 = y0 + TILE - 1;
+
+  for (int x = 0; x < m_tilesX; ++x) {
+    m_bins[_row * m_tilesX + x].clear();
+  }
+
+  for (uint32_t i = 0; i < m_triangles.size(); ++i) {
+    const Triangle& t = m_triangles[i];
+    if (t.maxY < y0 || t.minY > y1) {
+      continue;
+    }
+    for (int x = t.minX / TILE; x <= t.maxX / TILE; ++x) {
+      m_bins[_row * m_tilesX + x].push_back(i);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Rasterize the triangles of one tile, then shade its pixels
+/// @param _tile Tile index, row major from the bottom left
+/// @param _frame Frame receiving the tile's pixels
+void SoftwareRasterizer::renderTile(int _tile, glm::vec4* _frame) const {
+
+  const int tileX = (_tile % m_tilesX) * TILE;
+  const int tileY = (_tile / m_tilesX) * TILE;
+
+  alignas(16) float depth[TILE * TILE];
+  uint32_t nearest[TILE * TILE];
+  std::fill(depth, depth + TILE * TILE, 1.0f);
+  std::fill(nearest, nearest + TILE * TILE, NO_TRIANGLE);
+
+  for (uint32_t index : m_bins[_tile]) {
+
+    const Triangle& t = m_triangles[index];
+    int x0 = std::max(t.minX, tileX) - tileX;
+    int x1 = std::min(t.maxX, tileX + TILE - 1) - tileX;
+    int y0 = std::max(t.minY, tileY) - tileY;
+    int y1 = std::min(t.maxY, tileY + TILE - 1) - tileY;
+
+    for (int y = y0; y <= y1; ++y) {
+
+      float* row = depth + y * TILE;
+      uint32_t* ids = nearest + y * TILE;
+
+      // Less or equal, as the GL path's depth function
+#if defined(EDGERASTER_SSE)
+      scanRow(t, tileY + y, x0, x1, tileX,
+        [row, ids, index](int _x, __m128 _inside, __m128 _z) {
+          __m128 old = _mm_load_ps(row + _x);
+          __m128 pass = _mm_and_ps(_inside, _mm_cmple_ps(_z, old));
+          int mask = _mm_movemask_ps(pass);
+          if (mask == 0) {
+            return;
+          }
+          _mm_store_ps(row + _x, _mm_or_ps(_mm_and_ps(pass, _z),
+                                           _mm_andnot_ps(pass, old)));
+          for (int k = 0; k < 4; ++k) {
+            if (mask & (1 << k)) {
+              ids[_x + k] = index;
+            }
+          }
+        });
+#else
+      scanRow(t, tileY + y, x0, x1, tileX,
+        [row, ids, index](int _x, float _z) {
+          if (_z <= row[_x]) {
+            row[_x] = _z;
+            ids[_x] = index;
+          }
+        });
+#endif
+    }
+  }
+
+  const int width = std::min(TILE, m_width - tileX);
+  const int height = std::min(TILE, m_height - tileY);
+  for (int y = 0; y < height; ++y) {
+    glm::vec4* out = _frame + size_t(tileY + y) * m_width + tileX;
+    for (int x = 0; x < width; ++x) {
+      uint32_t id = nearest[y * TILE + x];
+      out[x] = id == NO_TRIANGLE ? CLEAR_COLOR :
+        shade(m_triangles[id], tileX + x + 0.5f, tileY + y + 0.5f);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Shade one pixel of a triangle as experimental.frag does
+/// @param _t Nearest triangle at the pixel
+/// @param _px Pixel center
+/// @param _py Pixel center
+/// @return Pixel color
+glm::vec4 SoftwareRasterizer::shade(const Triangle& _t, float _px,
+                                    float _py) const {
+
+  const Draw& draw = m_draws[_t.draw];
+  const Object& object = *draw.object;
+
+  if (object.isLocalLightSource) {
+    return object.color;
+  }
+
+  // Perspective-correct weights from the screen space ones
+  float w[3];
+  float sum = 0.0f;
+  for (int k = 0; k < 3; ++k) {
+    w[k] = _t.edge(k, _px, _py) * _t.invArea * _t.invW[k];
+    sum += w[k];
+  }
+  for (int k = 0; k < 3; ++k) {
+    w[k] /= sum;
+  }
+
+  const glm::vec3 P = w[0] * _t.position[0] + w[1] * _t.position[1] +
+                      w[2] * _t.position[2];
+  const glm::vec3 V = w[0] * _t.view[0] + w[1] * _t.view[1] +
+                      w[2] * _t.view[2];
+  const glm::vec3 N = glm::normalize(w[0] * _t.normal[0] +
+    w[1] * _t.normal[1] + w[2] * _t.normal[2]);
+  const glm::vec2 tc = w[0] * _t.uv[0] + w[1] * _t.uv[1] + w[2] * _t.uv[2];
+
+  const glm::vec3 diffuseMap = draw.diffuse ?
+    glm::vec3(draw.diffuse->sample(tc)) : glm::vec3(1.0f);
+  const glm::vec3 specularMap = draw.specular ?
+    glm::vec3(draw.specular->sample(tc)) : glm::vec3(1.0f);
+  const float shininess = object.material.shininess;
+
+  glm::vec3 result(0.0f);
+  for (const ShadedLight& light : m_lights) {
+
+    glm::vec3 lightDir = glm::normalize(light.position - P);
+    float diff = std::max(glm::dot(N, lightDir), 0.0f);
+    glm::vec3 reflectDir = glm::reflect(-lightDir, N);
+    float spec = std::pow(std::max(glm::dot(V, reflectDir), 0.0f), shininess);
+
+    float attenuation = 1.0f;
+    if (light.attenuated) {
+      float distance = glm::length(light.position - P);
+      attenuation = 1.0f / (light.ac + light.al * distance +
+        light.aq * distance * distance);
+    }
+    if (light.spot) {
+      float theta = glm::dot(lightDir, -light.direction);
+      float epsilon = light.cutOff - light.outerCutOff;
+      attenuation *= glm::clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
+    }
+
+    glm::vec3 ambient = m_ambient * diffuseMap * light.color;
+    glm::vec3 diffuse = light.diffuse * diff * diffuseMap * light.color;
+    glm::vec3 specular = light.specular * spec * specularMap * light.color;
+
+    result += power((ambient + diffuse + specular) * attenuation, light.exponent);
+  }
+
+  if (draw.emission) {
+    result += glm::vec3(draw.emission->sample(tc));
+  }
+
+  glm::vec4 color(result, 1.0f);
+  if (m_fog) {
+    float d = glm::length(P);
+    float f = 1.0f - glm::clamp((100.0f - d) / 100.0f, 0.0f, 1.0f);
+    color = glm::mix(color, FOG_COLOR, f);
+  }
+  return color;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Render a frame of the scene from its camera
+/// @param _scene Scene whose view matrix, camera projection and lights are used
+/// @param _objects Objects whose meshes are loaded; sky boxes are skipped
+/// @param _occlusion Occluders rendered for this view, or null
+/// @param _frame Receives _width by _height pixels, rows bottom up
+/// @param _width Frame width
+/// @param _height Frame height
+void SoftwareRasterizer::render(
+    const Scene& _scene, const std::vector<std::shared_ptr<Object>>& _objects,
+    const OcclusionCuller* _occlusion, glm::vec4* _frame, int _width,
+    int _height) {
+
+  m_width = _width;
+  m_height = _height;
+  m_tilesX = (_width + TILE - 1) / TILE;
+  m_tilesY = (_height + TILE - 1) / TILE;
+  m_projection = _scene.camera.projectionMatrix;
+  m_ambient = glm::vec3(_scene.globalAmbient.ambientIntensity);
+  m_fog = _scene.fog;
+  m_stats = CullStats();
+
+  {
+    PROFILE_SCOPE("Cull");
+
+    Frustum frustum;
+    frustum.extract(m_projection * _scene.viewMatrix);
+    const bool occlusion = _occlusion && !_occlusion->empty();
+
+    m_draws.clear();
+    for (const std::shared_ptr<Object>& object : _objects) {
+      if (object->isSkyBox || !object->asset) {
+        continue;
+      }
+      if (!frustum.intersects(object->worldSphere, object->worldBounds)) {
+        m_stats.culled++;
+        continue;
+      }
+      if (occlusion && !_occlusion->visible(object->worldBounds)) {
+        m_stats.occluded++;
+        continue;
+      }
+      m_stats.drawn++;
+      m_draws.push_back({object.get(), _scene.viewMatrix * object->modelMatrix,
+        nullptr, nullptr, nullptr});
+    }
+
+    loadTextures();
+    for (Draw& draw : m_draws) {
+      const Material& m = draw.object->material;
+      draw.diffuse = texture(m.hasDiffuseTexture, m.diffuseTexture);
+      draw.specular = texture(m.hasSpecularTexture, m.specularTexture);
+      draw.emission = texture(m.hasEmissionTexture, m.emissionTexture);
+    }
+
+    prepareLights(_scene);
+  }
+
+  {
+    PROFILE_SCOPE("Transform");
+
+    size_t tasks = std::min(m_pool.size() + 1, m_draws.size());
+    m_taskTriangles.resize(std::max(m_taskTriangles.size(), tasks));
+
+    m_pool.parallelFor(tasks, 1, [this, tasks](size_t _begin, size_t _end) {
+      for (size_t task = _begin; task < _end; ++task) {
+        std::vector<Triangle>& triangles = m_taskTriangles[task];
+        triangles.clear();
+        size_t first = m_draws.size() * task / tasks;
+        size_t last = m_draws.size() * (task + 1) / tasks;
+        for (size_t d = first; d < last; ++d) {
+          transform(d, triangles);
+        }
+      }
+    });
+
+    m_triangles.clear();
+    for (size_t task = 0; task < tasks; ++task) {
+      m_triangles.insert(m_triangles.end(), m_taskTriangles[task].begin(),
+                         m_taskTriangles[task].end());
+    }
+  }
+
+  {
+    PROFILE_SCOPE("Bin");
+
+    m_bins.resize(size_t(m_tilesX) * m_tilesY);
+    m_pool.parallelFor(m_tilesY, 1, [this](size_t _begin, size_t _end) {
+      for (size_t row = _begin; row < _end; ++row) {
+        binRow(int(row));
+      }
+    });
+  }
+
+  {
+    PROFILE_SCOPE("Rasterize tiles");
+
+    m_pool.parallelFor(m_bins.size(), 1, [this, _frame](size_t _begin, size_t _end) {
+      for (size_t tile = _begin; tile < _end; ++tile) {
+        renderTile(int(tile), _frame);
+      }
+    });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Write a frame as a binary PPM, top row first
+/// @param _filename Image filename
+/// @param _frame Pixels, rows bottom up; colors are clamped to [0, 1]
+/// @param _width Frame width
+/// @param _height Frame height
+/// @return False if the file could not be written
+bool SoftwareRasterizer::writePPM(const std::string& _filename,
+                                  const glm::vec4* _frame, int _width,
+                                  int _height) {
+
+  std::ofstream ofs(_filename, std::ios::binary);
+  if (!ofs) {
+    return false;
+  }
+
+  ofs << "P6\n" << _width << " " << _height << "\n255\n";
+
+  std::vector<char> row(size_t(_width) * 3);
+  for (int y = _height - 1; y >= 0; --y) {
+    const glm::vec4* src = _frame + size_t(y) * _width;
+    for (int x = 0; x < _width; ++x) {
+      for (int k = 0; k < 3; ++k) {
+        float c = glm::clamp(src[x][k], 0.0f, 1.0f);
+        row[3*x + k] = char((unsigned char)(c * 255.0f + 0.5f));
+      }
+    }
+    ofs.write(row.data(), row.size());
+  }
+  return bool(ofs);
+}
+
+#endif
@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Tiled software rasterizer for rasterizer scene files
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __SOFTRASTERIZER_H__
+#define __SOFTRASTERIZER_H__
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+#include "edgeraster.h"
+#include "frustum.h"
+
+class Object;
+class OcclusionCuller;
+class Scene;
+class ThreadPool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Renders the GLFW scenes on the CPU, for machines without a GPU
+///
+/// Objects in view are transformed and clipped against the near plane one
+/// object per pool task, and their triangles are binned into TILE by TILE
+/// pixel tiles. Each tile is then rasterized on its own: edge functions are
+/// evaluated four pixels at a time with SSE, by the scanRow the occlusion
+/// culler uses too, against a float depth buffer that
+/// records the nearest triangle of every pixel, and only that triangle is
+/// shaded, once per pixel, with perspective-correct attributes.
+///
+/// Shading follows experimental.frag: diffuse, specular and emission maps,
+/// directional, point and spot lights with each light's own attenuation, as
+/// the clustered and deferred paths use, and fog. Bump and parallax maps,
+/// dissection and blending are not implemented. Textures are sampled
+/// bilinearly without mipmaps.
+////////////////////////////////////////////////////////////////////////////////
+class SoftwareRasterizer {
+
+  public:
+
+    static const int TILE = 32;
+
+    explicit SoftwareRasterizer(ThreadPool& _pool);
+
+    void render(const Scene& _scene,
+                const std::vector<std::shared_ptr<Object>>& _objects,
+                const OcclusionCuller* _occlusion, glm::vec4* _frame,
+                int _width, int _height);
+
+    const CullStats& stats() const { return m_stats; }
+    size_t triangles() const { return m_triangles.size(); }
+
+    static bool writePPM(const std::string& _filename, const glm::vec4* _frame,
+                         int _width, int _height);
+
+  private:
+
+    /// Image of a material map in CPU memory
+    struct Texture {
+      int width{0};
+      int height{0};
+      int channels{0};
+      std::vector<unsigned char> pixels; ///< Rows bottom to top
+
+      glm::vec4 sample(const glm::vec2& _uv) const;
+    };
+
+    /// Visible object with its material maps resolved
+    struct Draw {
+      const Object* object;
+      glm::mat4 modelView;
+      const Texture* diffuse;
+      const Texture* specular;
+      const Texture* emission;
+    };
+
+    /// Point, spot or directional light in view space
+    struct ShadedLight {
+      glm::vec3 position;
+      glm::vec3 direction;    ///< Spot lights only
+      glm::vec3 color;
+      glm::vec3 diffuse;
+      glm::vec3 specular;
+      float ac, al, aq;       ///< Attenuation; none for directional lights
+      float cutOff;           ///< Cosines of the spot cones
+      float outerCutOff;
+      float exponent;         ///< Applied to the result, as in the shader
+      bool attenuated;
+      bool spot;
+    };
+
+    /// Vertex after the vertex shader, in clip space with view space outputs
+    struct ClipVertex {
+      glm::vec4 clip;
+      glm::vec3 position;
+      glm::vec3 view;    ///< Direction to the camera, as the shader's v
+      glm::vec3 normal;
+      glm::vec2 uv;
+    };
+
+    /// Screen space triangle with the vertex outputs
+    struct Triangle : EdgeTriangle {
+      float invW[3];
+      uint32_t draw;
+      glm::vec3 position[3];
+      glm::vec3 view[3];
+      glm::vec3 normal[3];
+      glm::vec2 uv[3];
+    };
+
+    const Texture* texture(bool _has, const std::string& _path) const;
+    void loadTextures();
+    void prepareLights(const Scene& _scene);
+
+    void transform(size_t _draw, std::vector<Triangle>& _triangles) const;
+    void setup(const ClipVertex* _v, uint32_t _draw,
+               std::vector<Triangle>& _triangles) const;
+    void binRow(int _row);
+    void renderTile(int _tile, glm::vec4* _frame) const;
+    glm::vec4 shade(const Triangle& _t, float _px, float _py) const;
+
+    ThreadPool& m_pool;
+
+    int m_width{0};
+    int m_height{0};
+    int m_tilesX{0};
+    int m_tilesY{0};
+
+    glm::mat4 m_projection{1.0f};
+    glm::vec3 m_ambient{0.0f};
+    bool m_fog{false};
+
+    std::vector<Draw> m_draws;
+    std::vector<ShadedLight> m_lights;
+    std::vector<std::vector<Triangle>> m_taskTriangles; ///< Per geometry task
+    std::vector<Triangle> m_triangles;       ///< All of them, in draw order
+    std::vector<std::vector<uint32_t>> m_bins; ///< Triangle indices per tile
+    CullStats m_stats;
+
+    /// Decoded maps by path; empty, and sampled as black like GL's texture 0,
+    /// if the file could not be decoded
+    std::map<std::string, std::unique_ptr<Texture>> m_textures;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef __TEXTUREMANAGER_CPP__
+#define __TEXTUREMANAGER_CPP__
+
+#include "texturemanager.h"
+#include "hash.h"
+#include "profiler.h"
+
+#include <SOIL2/SOIL2.h>
+
+// STL
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+TextureManager::TextureManager() {}
+
+TextureManager::~TextureManager() {}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Resolve a path to the form used as cache key
+/// @param _path Path as written in the scene or material file
+/// @return Absolute path with symlinks and "." / ".." removed, or the input
+///         unchanged when it cannot be resolved
+std::string TextureManager::canonicalPath(const std::string& _path) {
+  char resolved[PATH_MAX];
+  if (realpath(_path.c_str(), resolved) == nullptr) {
+    return _path;
+  }
+  return std::string(resolved);
+}
+
+bool TextureManager::readFile(const std::string& _path,
+                              std::vector<unsigned char>& _bytes) {
+  std::ifstream ifs(_path, std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  _bytes.assign(std::istreambuf_iterator<char>(ifs),
+                std::istreambuf_iterator<char>());
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Decode file contents, flipping rows so the first is the bottom
+bool TextureManager::decodeBytes(const std::vector<unsigned char>& _bytes,
+                                 DecodedImage& _image) {
+
+  unsigned char* data = SOIL_load_image_from_memory(_bytes.data(),
+    (int)_bytes.size(), &_image.width, &_image.height, &_image.channels,
+    SOIL_LOAD_AUTO);
+
+  if (data == nullptr) {
+    return false;
+  }
+
+  size_t row = (size_t)_image.width * _image.channels;
+  _image.pixels.resize(row * _image.height);
+  for (int y = 0; y < _image.height; ++y) {
+    std::copy(data + y * row, data + (y + 1) * row,
+              _image.pixels.begin() + (_image.height - 1 - y) * row);
+  }
+
+  SOIL_free_image_data(data);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Read, hash and decode an image file into CPU memory
+/// @param _path Image filename
+/// @param _image Receives the pixels and cache keys
+/// @return False if the file could not be read or decoded
+bool TextureManager::decode(const std::string& _path, DecodedImage& _image) {
+
+  PROFILE_SCOPE("Decode image");
+
+  _image.path = _path;
+  _image.key = canonicalPath(_path);
+
+  std::vector<unsigned char> bytes;
+  if (!readFile(_image.key, bytes)) {
+    return false;
+  }
+  _image.hash = hashBytes(bytes.data(), bytes.size());
+
+  return decodeBytes(bytes, _image);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Get the texture for an image file, loading it on first use
+/// @param _path Image filename
+/// @return GL texture identifier, 0 if the image could not be loaded
+GLuint TextureManager::acquire(const std::string& _path) {
+
+  std::string key = canonicalPath(_path);
+
+  auto byPath = m_byPath.find(key);
+  if (byPath != m_byPath.end()) {
+    return reference(byPath->second, key);
+  }
+
+  std::vector<unsigned char> bytes;
+  if (!readFile(key, bytes)) {
+    std::cout << "could not find texture file" << _path << std::endl;
+    return 0;
+  }
+
+  // Same contents under a different name share the existing texture, and are
+  // not even decoded
+  uint64_t hash = hashBytes(bytes.data(), bytes.size());
+  auto byHash = m_byHash.find(hash);
+  if (byHash != m_byHash.end()) {
+    return reference(byHash->second, key);
+  }
+
+  DecodedImage image;
+  image.path = _path;
+  image.key = key;
+  image.hash = hash;
+  if (!decodeBytes(bytes, image)) {
+    std::cout << "could not decode texture file" << _path << std::endl;
+    return 0;
+  }
+
+  return add(image);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Get the texture for an image decoded ahead of time
+/// @param _image Result of decode(), possibly from another thread
+/// @return GL texture identifier, 0 if the image failed to decode
+GLuint TextureManager::acquire(const DecodedImage& _image) {
+
+  auto byPath = m_byPath.find(_image.key);
+  if (byPath != m_byPath.end()) {
+    return reference(byPath->second, _image.key);
+  }
+
+  auto byHash = m_byHash.find(_image.hash);
+  if (byHash != m_byHash.end()) {
+    return reference(byHash->second, _image.key);
+  }
+
+  if (_image.pixels.empty()) {
+    std::cout << "could not load texture file" << _image.path << std::endl;
+    return 0;
+  }
+
+  return add(_image);
+}
+
+GLuint TextureManager::reference(GLuint _id, const std::string& _key) {
+  m_byPath[_key] = _id;
+  m_textures[_id].refCount++;
+  return _id;
+}
+
+GLuint TextureManager::add(const DecodedImage& _image) {
+
+  GLuint textureID = upload(_image);
+
+  Texture& texture = m_textures[textureID];
+  texture.id = textureID;
+  texture.path = _image.key;
+  texture.hash = _image.hash;
+  texture.bytes = queryMemory(textureID, texture.width, texture.height);
+  texture.refCount = 1;
+
+  m_byPath[_image.key] = textureID;
+  m_byHash[_image.hash] = textureID;
+
+  return textureID;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Drop one reference, deleting the GL texture with the last one
+/// @param _id Identifier previously returned by acquire
+void TextureManager::release(GLuint _id) {
+
+  auto it = m_textures.find(_id);
+  if (it == m_textures.end() || --it->second.refCount > 0) {
+    return;
+  }
+
+  for (auto p = m_byPath.begin(); p != m_byPath.end();) {
+    if (p->second == _id) {
+      p = m_byPath.erase(p);
+    } else {
+      ++p;
+    }
+  }
+  m_byHash.erase(it->second.hash);
+  m_textures.erase(it);
+
+  glDeleteTextures(1, &_id);
+}
+
+size_t TextureManager::memoryUsage(GLuint _id) const {
+  auto it = m_textures.find(_id);
+  return it == m_textures.end() ? 0 : it->second.bytes;
+}
+
+size_t TextureManager::totalMemory() const {
+  size_t total = 0;
+  for (const auto& t : m_textures) {
+    total += t.second.bytes;
+  }
+  return total;
+}
+
+size_t TextureManager::uniqueCount() const {
+  return m_textures.size();
+}
+
+void TextureManager::report(std::ostream& _os) const {
+  for (const auto& t : m_textures) {
+    const Texture& texture = t.second;
+    _os << "Texture " << texture.id << ": " << texture.path << " "
+        << texture.width << "x" << texture.height << " "
+        << texture.bytes / 1024 << " KiB, " << texture.refCount
+        << " references" << std::endl;
+  }
+  _os << "Textures: " << uniqueCount() << " unique, "
+      << totalMemory() / 1024 << " KiB total" << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Create a mipmapped texture from decoded pixels
+GLuint TextureManager::upload(const DecodedImage& _image) {
+
+  static const GLenum formats[] = {GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  GLenum format = formats[std::min(std::max(_image.channels, 1), 4)];
+
+  GLuint textureID;
+  glGenTextures(1, &textureID);
+  glBindTexture(GL_TEXTURE_2D, textureID);
+
+  // Rows of RGB images are not necessarily 4-byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, _image.width, _image.height, 0,
+    format, GL_UNSIGNED_BYTE, _image.pixels.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  // Gray and gray-alpha images are stored in one or two channels but sample
+  // as SOIL_LOAD_AUTO gave them: gray in RGB, and alpha from the second
+  if (_image.channels == 1) {
+    static const GLint gray[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, gray);
+  } else if (_image.channels == 2) {
+    static const GLint grayAlpha[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, grayAlpha);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, textureID);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+#if defined(OSX)
+  if (glewIsSupported("GL_EXT_texture_filter_anisotropic")) {
+    GLfloat anisoSetting = 0.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &anisoSetting);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisoSetting);
+  }
+#endif
+
+  return textureID;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Sum the storage of every mip level of a texture
+///
+/// The driver may pad RGB to four bytes per texel; the estimate uses the
+/// unpadded size of the internal format.
+size_t TextureManager::queryMemory(GLuint _id, int& _width, int& _height) {
+
+  glBindTexture(GL_TEXTURE_2D, _id);
+
+  GLint format = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+  size_t texelBytes = 4;
+  switch (format) {
+    case GL_RED: case GL_R8: texelBytes = 1; break;
+    case GL_RG: case GL_RG8: texelBytes = 2; break;
+    case GL_RGB: case GL_RGB8: texelBytes = 3; break;
+    default: break;
+  }
+
+  size_t bytes = 0;
+  for (GLint level = 0; ; ++level) {
+    GLint w = 0, h = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &h);
+    if (w == 0 || h == 0) {
+      break;
+    }
+    if (level == 0) {
+      _width = w;
+      _height = h;
+    }
+    bytes += (size_t)w * h * texelBytes;
+    if (w == 1 && h == 1) {
+      break;
+    }
+  }
+
+  return bytes;
+}
+
+#endif
@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Content-addressed cache of GL textures shared across objects
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __TEXTUREMANAGER_H__
+#define __TEXTUREMANAGER_H__
+
+// STL
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// GL
+#include "GLInclude.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Image decoded into CPU memory, ready for upload
+////////////////////////////////////////////////////////////////////////////////
+struct DecodedImage {
+  std::string path;       ///< Path as requested
+  std::string key;        ///< Canonical path
+  uint64_t hash{0};       ///< FNV-1a hash of the file contents
+  int width{0};
+  int height{0};
+  int channels{0};
+  std::vector<unsigned char> pixels; ///< Rows bottom to top, as GL expects
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Hands out one GL texture per unique image file.
+///
+/// Textures are keyed by canonical path and by a hash of the file contents, so
+/// the same image referenced through different relative paths (or copied under
+/// another name) is decoded and uploaded only once. Every acquire must be
+/// paired with a release; the GL texture is deleted with the last reference.
+///
+/// decode() touches no GL or manager state and may run on any thread; the
+/// other members must be called on the thread owning the GL context.
+////////////////////////////////////////////////////////////////////////////////
+class TextureManager {
+
+  public:
+
+    struct Texture {
+      GLuint id{0};
+      std::string path;       ///< Canonical path of the first file loaded
+      uint64_t hash{0};       ///< FNV-1a hash of the file contents
+      int width{0};
+      int height{0};
+      size_t bytes{0};        ///< GPU memory of all mip levels
+      int refCount{0};
+    };
+
+    TextureManager();
+    ~TextureManager();
+
+    GLuint acquire(const std::string& _path);
+    GLuint acquire(const DecodedImage& _image);
+    void release(GLuint _id);
+
+    size_t memoryUsage(GLuint _id) const;
+    size_t totalMemory() const;
+    size_t uniqueCount() const;
+    void report(std::ostream& _os) const;
+
+    static std::string canonicalPath(const std::string& _path);
+    static bool decode(const std::string& _path, DecodedImage& _image);
+
+  private:
+
+    static bool readFile(const std::string& _path,
+                         std::vector<unsigned char>& _bytes);
+    static bool decodeBytes(const std::vector<unsigned char>& _bytes,
+                            DecodedImage& _image);
+    GLuint add(const DecodedImage& _image);
+    GLuint reference(GLuint _id, const std::string& _key);
+    static GLuint upload(const DecodedImage& _image);
+    static size_t queryMemory(GLuint _id, int& _width, int& _height);
+
+    std::unordered_map<std::string, GLuint> m_byPath;
+    std::unordered_map<uint64_t, GLuint> m_byHash;
+    std::unordered_map<GLuint, Texture> m_textures;
+};
+
+#endif
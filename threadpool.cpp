@@ -0,0 +1,137 @@
+#ifndef __THREADPOOL_CPP__
+#define __THREADPOOL_CPP__
+
+#include "threadpool.h"
+#include "profiler.h"
+
+// STL
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Start the workers
+/// @param _threads Number of threads, 0 for one less than the hardware
+///        concurrency (the main thread is the remaining one)
+ThreadPool::ThreadPool(size_t _threads) {
+
+  if (_threads == 0) {
+    size_t hardware = std::thread::hardware_concurrency();
+    _threads = hardware > 1 ? hardware - 1 : 1;
+  }
+
+  for (size_t i = 0; i < _threads; ++i) {
+    m_workers.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (std::thread& worker : m_workers) {
+    worker.join();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Pool used by the engine, created on first use
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::submit(std::function<void()> _task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(_task));
+  }
+  m_wake.notify_one();
+}
+
+void ThreadPool::run() {
+
+  Profiler::setThreadName("Worker");
+
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+      if (m_stop && m_tasks.empty()) {
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    PROFILE_SCOPE("Task");
+    task();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Call _body over [0, _count) in chunks, in parallel
+/// @param _count Number of elements
+/// @param _grain Minimum elements per chunk
+/// @param _body Called with [begin, end) of each chunk
+///
+/// Chunks are claimed from a shared counter by the caller and by helper tasks.
+/// Helpers that start after every chunk is claimed return immediately, so the
+/// shared state is reference counted to outlive this call.
+void ThreadPool::parallelFor(size_t _count, size_t _grain,
+                             const std::function<void(size_t, size_t)>& _body) {
+
+  if (_count == 0) {
+    return;
+  }
+
+  _grain = std::max<size_t>(_grain, 1);
+  size_t chunks = std::min((_count + _grain - 1) / _grain, size() + 1);
+  size_t chunkSize = (_count + chunks - 1) / chunks;
+
+  if (chunks == 1) {
+    _body(0, _count);
+    return;
+  }
+
+  struct Shared {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+
+  // Only referenced while chunks remain, i.e. before this call returns
+  const std::function<void(size_t, size_t)>* body = &_body;
+
+  auto work = [shared, body, chunks, chunkSize, _count]() {
+    for (;;) {
+      size_t chunk = shared->next.fetch_add(1);
+      if (chunk >= chunks) {
+        return;
+      }
+      size_t begin = chunk * chunkSize;
+      size_t end = std::min(begin + chunkSize, _count);
+      if (begin < end) {
+        (*body)(begin, end);
+      }
+      if (shared->done.fetch_add(1) + 1 == chunks) {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->finished.notify_all();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < chunks; ++i) {
+    submit(work);
+  }
+  work();
+
+  std::unique_lock<std::mutex> lock(shared->mutex);
+  shared->finished.wait(lock, [&] { return shared->done.load() == chunks; });
+}
+
+#endif
@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief Fixed pool of worker threads shared by the engine
+////////////////////////////////////////////////////////////////////////////////
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+// STL
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+/// @brief Runs tasks on a fixed set of threads
+///
+/// submit() queues fire-and-forget work. parallelFor() splits a range into
+/// chunks and returns when all are done; the calling thread works on chunks
+/// too, so it is safe to call from inside a task.
+////////////////////////////////////////////////////////////////////////////////
+class ThreadPool {
+
+  public:
+
+    explicit ThreadPool(size_t _threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> _task);
+
+    void parallelFor(size_t _count, size_t _grain,
+                     const std::function<void(size_t, size_t)>& _body);
+
+    size_t size() const { return m_workers.size(); }
+
+    static ThreadPool& shared();
+
+  private:
+
+    void run();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop{false};
+};
+
+#endif